@@ -17,35 +17,115 @@
  */
 
 /**
- * @file atomic.c  - Implementation of atomic opertions for the gateway
+ * @file atomic.c  - The sharded counters of the gateway
+ *
+ * The atomic operations themselves are inline, in atomic.h, apart from
+ * the out of line copy of atomic_add.
  *
  * @verbatim
  * Revision History
  *
  * Date		Who		Description
  * 10/06/13	Mark Riddoch	Initial implementation
+ * 16/10/26	agent		Atomic operations moved inline, sharded counters
  *
  * @endverbatim
  */
+#include <stdlib.h>
+#include <string.h>
+#define	ATOMIC_OUT_OF_LINE
+#include <atomic.h>
+
+__thread int	counter_shard = -1;
+static int	next_shard = 0;
 
 /**
- * Implementation of an atomic add operation for the X86 processor.
- * Adds a value to the contents of a location pointed to by the first parameter.
- * The add operation is atomic and the return value is the value stored in the location
- * prior to the operation. The number that is added may be signed, therefore atomic_subtract
- * is merely an atomic add with a negative value.
+ * The out of line copy of atomic_add, see atomic.h
  *
  * @param variable	Pointer the the variable to add to
  * @param value		Value to be added
- * @return		Pointer to the value of variable before the add occured
+ * @return		The value of variable before the add occured
  */
 int
 atomic_add(int *variable, int value)
 {
-	asm volatile(
-		"lock; xaddl %%eax, %2;"
-		:"=a" (value)
-		: "a" (value), "m" (*variable)
-		: "memory" );
-	return value;
+	return atomic_add_int(variable, value, ATOMIC_SEQ_CST);
+}
+
+/**
+ * Assign the calling thread a shard of the counters, the threads are
+ * given the shards in turn.
+ *
+ * @return The shard of the thread
+ */
+int
+counter_shard_init()
+{
+	counter_shard = atomic_add_int(&next_shard, 1, ATOMIC_RELAXED) &
+			(COUNTER_SHARDS - 1);
+	return counter_shard;
+}
+
+/**
+ * Allocate a sharded counter, with a value of zero
+ *
+ * @return The counter or NULL if no memory could be allocated
+ */
+COUNTER
+counter_alloc()
+{
+void	*rval;
+
+	if (posix_memalign(&rval, sizeof(COUNTER_SHARD),
+			   COUNTER_SHARDS * sizeof(COUNTER_SHARD)) != 0)
+		return NULL;
+	memset(rval, 0, COUNTER_SHARDS * sizeof(COUNTER_SHARD));
+	return (COUNTER)rval;
+}
+
+/**
+ * Free a sharded counter
+ *
+ * @param counter	The counter
+ */
+void
+counter_free(COUNTER counter)
+{
+	free(counter);
+}
+
+/**
+ * Return the value of a sharded counter, the sum of its shards
+ *
+ * @param counter	The counter
+ * @return		The value of the counter
+ */
+long
+counter_read(COUNTER counter)
+{
+long	sum = 0;
+int	i;
+
+	if (counter == NULL)
+		return 0;
+	for (i = 0; i < COUNTER_SHARDS; i++)
+		sum += __atomic_load_n(&counter[i].value, ATOMIC_RELAXED);
+	return sum;
+}
+
+/**
+ * Set a sharded counter back to zero, updates made at the same time may
+ * be lost.
+ *
+ * @param counter	The counter
+ */
+void
+counter_reset(COUNTER counter)
+{
+int	i;
+
+	if (counter == NULL)
+		return;
+	for (i = 0; i < COUNTER_SHARDS; i++)
+		__atomic_store_n(&counter[i].value, 0, ATOMIC_RELAXED);
 }
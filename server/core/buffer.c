@@ -35,16 +35,293 @@
  * @endverbatim
  */
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <buffer.h>
 #include <atomic.h>
+#include <spinlock.h>
+#include <config.h>
+#include <dcb.h>
+#include <gw.h>
+#include <thread.h>
 #include <skygw_debug.h>
 
+/**
+ * The memory allocated for a buffer. The first GWBUF that refers to the
+ * data, the shared buffer and the data itself are held in one block, the
+ * data follows the block.
+ */
+typedef struct {
+	GWBUF		buf;		/*< The GWBUF returned by gwbuf_alloc */
+	SHARED_BUF	sbuf;		/*< The shared buffer */
+	int		pool;		/*< The pool the block was carved from */
+} GWBUF_BLOCK;
+
+/*< The block that holds a shared buffer */
+#define	GWBUF_BLOCK_OF(s)	((GWBUF_BLOCK *)((char *)(s) - offsetof(GWBUF_BLOCK, sbuf)))
+
+#define	GWBUF_CACHE_BYTES	(256 * 1024) /*< Cached by a thread per class */
+#define	GWBUF_CACHE_MIN		4	/*< Minimum blocks cached per class */
+#define	GWBUF_BATCH		8	/*< Blocks moved to or from the pool at once */
+#define	GWBUF_CACHE_HEADERS	256	/*< Clone headers kept by each thread */
+#define	GWBUF_NPOOLS		(GWBUF_MAX_NODES + 1) /*< The shared pool and the node pools */
+
+/**
+ * A size class of the buffer pool. The blocks of a class are carved from
+ * arenas that are mapped for the class alone and that are never unmapped,
+ * freed blocks are only ever reused for the same class. The memory of the
+ * pool can therefore not become fragmented, however long the gateway runs.
+ *
+ * The counters are updated when blocks move between the pool and the
+ * caches of the threads, so a block cached by a thread counts as in use.
+ *
+ * Pool 0 is shared by the threads without a preferred NUMA node, pool n + 1
+ * is used by the threads that prefer node n. Only the threads of a node
+ * carve blocks from the arenas of its pool, so the pages of the arenas are
+ * first touched, and placed, on that node. A block that is freed by a
+ * thread of another node is returned to the pool it came from rather than
+ * cached by the thread that freed it.
+ */
+typedef struct {
+	SPINLOCK	lock;		/*< Protects the class */
+	unsigned int	size;		/*< The data size of the class */
+	GWBUF		*free;		/*< The free blocks */
+	char		*next;		/*< The next block to carve */
+	char		*end;		/*< The end of the current arena */
+	int		in_use;		/*< Blocks that are not in the pool */
+	int		high_water;	/*< Highest number of blocks in use */
+	int		misses;		/*< Blocks carved as none were free */
+	int		arenas;		/*< Number of arenas mapped */
+} GWBUF_CLASS;
+
+static	GWBUF_CLASS	classes[GWBUF_NPOOLS][GWBUF_NCLASSES];
+static	int		pool_init_done = 0;
+static	SPINLOCK	pool_init_lock = SPINLOCK_INIT;
+static	SPINLOCK_CLASS	pool_lock_class = SPINLOCK_CLASS_INIT("buffer_pool");
+static	int		n_oversize = 0;		/*< Allocations larger than any class */
+static	int		n_huge_fail = 0;	/*< Arenas without huge pages */
+
+/**
+ * The per thread caches of recently freed memory, the blocks of each size
+ * class and the headers of cloned buffers. All are LIFO lists linked
+ * through the next pointer of the GWBUF, so the memory that is reused is
+ * likely to still be in the CPU cache.
+ */
+static __thread GWBUF	*block_cache[GWBUF_NCLASSES];
+static __thread int	n_block_cache[GWBUF_NCLASSES];
+static __thread GWBUF	*header_cache = NULL;
+static __thread int	n_header_cache = 0;
+
+/**
+ * Initialise the size classes of the buffer pool
+ */
+static void
+gwbuf_pool_init()
+{
+int	i, p;
+
+	spinlock_acquire(&pool_init_lock);
+	if (!pool_init_done)
+	{
+		for (p = 0; p < GWBUF_NPOOLS; p++)
+		{
+			for (i = 0; i < GWBUF_NCLASSES; i++)
+			{
+				spinlock_init(&classes[p][i].lock);
+				spinlock_set_class(&classes[p][i].lock,
+						   &pool_lock_class);
+				classes[p][i].size = GWBUF_MIN_CLASS << i;
+			}
+		}
+		pool_init_done = 1;
+	}
+	spinlock_release(&pool_init_lock);
+}
+
+/**
+ * Return the pool of the calling thread
+ *
+ * @return	The pool of the node the thread prefers, or the shared pool
+ */
+static int
+gwbuf_thread_pool()
+{
+	if (thread_node < 0 || thread_node >= GWBUF_MAX_NODES)
+		return 0;
+	return thread_node + 1;
+}
+
+/**
+ * Return the size class of a buffer
+ *
+ * @param size	The data size
+ * @return	The size class or -1 if the size is larger than any class
+ */
+static int
+gwbuf_class(unsigned int size)
+{
+int	class = 0;
+
+	if (size > GWBUF_MAX_CLASS)
+		return -1;
+	while ((GWBUF_MIN_CLASS << class) < size)
+		class++;
+	return class;
+}
+
+/**
+ * Map a new arena for the buffer pool, using huge pages if so configured.
+ * Explicit huge pages may not have been reserved, in which case normal
+ * pages are used.
+ *
+ * @return	The arena or NULL if no memory could be mapped
+ */
+static char *
+gwbuf_arena_map()
+{
+void	*arena = MAP_FAILED;
+int	mode = config_buffer_hugepages();
+
+#ifdef MAP_HUGETLB
+	if (mode == BUFFER_HUGEPAGES_HUGETLB)
+	{
+		arena = mmap(NULL, GWBUF_ARENA_SIZE, PROT_READ|PROT_WRITE,
+			     MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if (arena == MAP_FAILED)
+			atomic_add(&n_huge_fail, 1);
+	}
+#endif
+	if (arena == MAP_FAILED)
+		arena = mmap(NULL, GWBUF_ARENA_SIZE, PROT_READ|PROT_WRITE,
+			     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (arena == MAP_FAILED)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	if (mode == BUFFER_HUGEPAGES_TRANSPARENT)
+		madvise(arena, GWBUF_ARENA_SIZE, MADV_HUGEPAGE);
+#endif
+	return (char *)arena;
+}
+
+/**
+ * Move up to GWBUF_BATCH blocks of a size class from the pool to the cache
+ * of the calling thread, carving new blocks if the pool has none.
+ *
+ * @param class	The size class
+ * @return	The number of blocks added to the cache
+ */
+static int
+gwbuf_pool_get(int class)
+{
+int		pool = gwbuf_thread_pool();
+GWBUF_CLASS	*c = &classes[pool][class];
+size_t		bsize = sizeof(GWBUF_BLOCK) + c->size;
+GWBUF		*block;
+char		*arena;
+int		n = 0;
+
+	spinlock_acquire(&c->lock);
+	while (n < GWBUF_BATCH)
+	{
+		if ((block = c->free) != NULL)
+		{
+			c->free = block->next;
+		}
+		else
+		{
+			if (c->next == NULL || c->next + bsize > c->end)
+			{
+				if ((arena = gwbuf_arena_map()) == NULL)
+					break;
+				c->next = arena;
+				c->end = arena + GWBUF_ARENA_SIZE;
+				c->arenas++;
+			}
+			block = (GWBUF *)c->next;
+			((GWBUF_BLOCK *)block)->pool = pool;
+			c->next += bsize;
+			c->misses++;
+		}
+		block->next = block_cache[class];
+		block_cache[class] = block;
+		n++;
+	}
+	n_block_cache[class] += n;
+	c->in_use += n;
+	if (c->in_use > c->high_water)
+		c->high_water = c->in_use;
+	spinlock_release(&c->lock);
+	return n;
+}
+
+/**
+ * Return a block to the pool it was carved from
+ *
+ * @param block	The block
+ * @param class	The size class of the block
+ */
+static void
+gwbuf_pool_return(GWBUF_BLOCK *block, int class)
+{
+GWBUF_CLASS	*c = &classes[block->pool][class];
+
+	spinlock_acquire(&c->lock);
+	block->buf.next = c->free;
+	c->free = &block->buf;
+	c->in_use--;
+	spinlock_release(&c->lock);
+}
+
+/**
+ * Return blocks from the cache of the calling thread to the pool, until
+ * the cache is down to half its limit.
+ *
+ * @param class	The size class
+ * @param limit	The number of blocks the thread may cache
+ */
+static void
+gwbuf_pool_put(int class, int limit)
+{
+int		pool = gwbuf_thread_pool();
+GWBUF_CLASS	*c = &classes[pool][class];
+GWBUF		*block, *other = NULL;
+int		n = 0;
+
+	spinlock_acquire(&c->lock);
+	while (n_block_cache[class] > limit / 2)
+	{
+		block = block_cache[class];
+		block_cache[class] = block->next;
+		n_block_cache[class]--;
+		if (((GWBUF_BLOCK *)block)->pool != pool)
+		{
+			/*< Cached before the thread chose its node */
+			block->next = other;
+			other = block;
+			continue;
+		}
+		block->next = c->free;
+		c->free = block;
+		n++;
+	}
+	c->in_use -= n;
+	spinlock_release(&c->lock);
+
+	while ((block = other) != NULL)
+	{
+		other = block->next;
+		gwbuf_pool_return((GWBUF_BLOCK *)block, class);
+	}
+}
+
 /**
  * Allocate a new gateway buffer structure of size bytes.
  *
- * For now we allocate memory directly from malloc for buffer the management
- * structure and the actual data buffer itself. We may swap at a future date
- * to a more effecient mechanism.
+ * The buffer structure, the shared buffer and the data area are allocated
+ * as one block. Blocks up to GWBUF_MAX_CLASS bytes come from the power of
+ * two size classes of the buffer pool, through the cache of the calling
+ * thread, larger ones from malloc.
  *
  * @param	size The size in bytes of the data area required
  * @return	Pointer to the buffer structure or NULL if memory could not
@@ -53,55 +330,154 @@
 GWBUF	*
 gwbuf_alloc(unsigned int size)
 {
+GWBUF_BLOCK	*block;
 GWBUF		*rval;
-SHARED_BUF	*sbuf;
+int		class = gwbuf_class(size);
+unsigned int	capacity = size;
 
-	// Allocate the buffer header
-	if ((rval = (GWBUF *)malloc(sizeof(GWBUF))) == NULL)
+	if (class >= 0)
 	{
-		return NULL;
-	}
-
-	// Allocate the shared data buffer
-	if ((sbuf = (SHARED_BUF *)malloc(sizeof(SHARED_BUF))) == NULL)
-	{
-		free(rval);
-		return NULL;
+		if (!pool_init_done)
+			gwbuf_pool_init();
+		if (block_cache[class] == NULL && gwbuf_pool_get(class) == 0)
+			return NULL;
+		block = (GWBUF_BLOCK *)block_cache[class];
+		block_cache[class] = block_cache[class]->next;
+		n_block_cache[class]--;
+		capacity = classes[0][class].size;
 	}
-
-	// Allocate the space for the actual data
-	if ((sbuf->data = (unsigned char *)malloc(size)) == NULL)
+	else
 	{
-		free(rval);
-		free(sbuf);
-		return NULL;
+		if ((block = (GWBUF_BLOCK *)malloc(sizeof(GWBUF_BLOCK) + size)) == NULL)
+			return NULL;
+		atomic_add(&n_oversize, 1);
 	}
-	rval->start = sbuf->data;
+	block->sbuf.data = (unsigned char *)(block + 1);
+	block->sbuf.refcount = 1;
+	block->sbuf.size = capacity;
+	block->sbuf.info = NULL;
+	rval = &block->buf;
+	rval->start = block->sbuf.data;
 	rval->end = rval->start + size;
-	sbuf->refcount = 1;
-	rval->sbuf = sbuf;
+	rval->sbuf = &block->sbuf;
 	rval->next = NULL;
 	rval->command = 0;
         CHK_GWBUF(rval);
 	return rval;
 }
 
+/**
+ * Release the packet metadata of a shared buffer
+ *
+ * @param sbuf	The shared buffer, no longer referenced by any GWBUF
+ */
+static void
+gwbuf_info_free(SHARED_BUF *sbuf)
+{
+GWBUF_INFO	*info, *next;
+
+	for (info = sbuf->info; info != NULL; info = next)
+	{
+		next = info->next;
+		free(info->sql_copy);
+		free(info);
+	}
+	sbuf->info = NULL;
+}
+
 /**
  * Free a gateway buffer
  *
+ * The GWBUF allocated with the data may be freed before its clones, the
+ * block is only released when the last reference to the data goes.
+ *
  * @param buf The buffer to free
  */
 void
 gwbuf_free(GWBUF *buf)
 {
-	atomic_add(&buf->sbuf->refcount, -1);
+SHARED_BUF	*sbuf = buf->sbuf;
+GWBUF_BLOCK	*block = GWBUF_BLOCK_OF(sbuf);
+int		class, limit;
+
         CHK_GWBUF(buf);
-	if (buf->sbuf->refcount == 0)
+	if (buf != &block->buf)
+	{
+		/*< The header of a clone */
+		if (n_header_cache < GWBUF_CACHE_HEADERS)
+		{
+			buf->next = header_cache;
+			header_cache = buf;
+			n_header_cache++;
+		}
+		else
+			free(buf);
+	}
+	if (atomic_add(&sbuf->refcount, -1) != 1)
+		return;
+	if (sbuf->info != NULL)
+		gwbuf_info_free(sbuf);
+	if ((class = gwbuf_class(sbuf->size)) < 0)
+	{
+		free(block);
+		return;
+	}
+	if (block->pool != gwbuf_thread_pool())
+	{
+		/*< The memory stays on the node it was placed on */
+		gwbuf_pool_return(block, class);
+		return;
+	}
+	block->buf.next = block_cache[class];
+	block_cache[class] = &block->buf;
+	limit = GWBUF_CACHE_BYTES / sbuf->size;
+	if (limit < GWBUF_CACHE_MIN)
+		limit = GWBUF_CACHE_MIN;
+	if (++n_block_cache[class] > limit)
+		gwbuf_pool_put(class, limit);
+}
+
+/**
+ * Print the statistics of the buffer pool
+ *
+ * @param dcb	DCB to print to
+ */
+void
+dprintBufferPool(DCB *dcb)
+{
+GWBUF_CLASS	*c;
+int		i, p;
+
+	if (!pool_init_done)
+		gwbuf_pool_init();
+	dcb_printf(dcb, "Buffer pool arena size:		%d KB\n",
+		   GWBUF_ARENA_SIZE / 1024);
+	dcb_printf(dcb, "Oversize allocations:		%d\n", n_oversize);
+	dcb_printf(dcb, "Arenas without huge pages:	%d\n", n_huge_fail);
+	for (p = 0; p < GWBUF_NPOOLS; p++)
 	{
-                free(buf->sbuf->data);
-		free(buf->sbuf);
+		/*< The shared pool is always shown, a node pool once used */
+		for (i = 0; p > 0 && i < GWBUF_NCLASSES; i++)
+			if (classes[p][i].arenas > 0)
+				break;
+		if (i == GWBUF_NCLASSES)
+			continue;
+		if (p == 0)
+			dcb_printf(dcb, "Shared pool\n");
+		else
+			dcb_printf(dcb, "Pool of node %d\n", p - 1);
+		dcb_printf(dcb, "	Size	In use	High water	Misses	Arenas\n");
+		for (i = 0; i < GWBUF_NCLASSES; i++)
+		{
+			c = &classes[p][i];
+			dcb_printf(dcb, "	%-6u	%-6d	%-10d	%-6d	%d\n",
+				   c->size,
+				   c->in_use,
+				   c->high_water,
+				   c->misses,
+				   c->arenas);
+		}
 	}
-	free(buf);
 }
 
 /**
@@ -119,7 +495,12 @@ gwbuf_clone(GWBUF *buf)
 {
 GWBUF	*rval;
 
-	if ((rval = (GWBUF *)malloc(sizeof(GWBUF))) == NULL)
+	if ((rval = header_cache) != NULL)
+	{
+		header_cache = rval->next;
+		n_header_cache--;
+	}
+	else if ((rval = (GWBUF *)malloc(sizeof(GWBUF))) == NULL)
 	{
 		return NULL;
 	}
@@ -163,8 +544,9 @@ GWBUF	*ptr = head;
  * Consume data from a buffer in the linked list. The assumption is to consume
  * n bytes from the buffer chain.
  *
- * If after consuming the bytes from the first buffer that buffer becomes
- * empty it will be freed and the linked list updated.
+ * Each buffer at the head of the chain that becomes empty as a result of
+ * consuming the bytes will be freed and the linked list updated, so a
+ * single call may consume data from several buffers.
  *
  * The return value is the new head of the linked list.
  *
@@ -178,15 +560,22 @@ GWBUF	*ptr = head;
 GWBUF *
 gwbuf_consume(GWBUF *head, unsigned int length)
 {
-GWBUF *rval = head;
+GWBUF		*rval = head;
+unsigned int	n;
 
         CHK_GWBUF(head);
-	GWBUF_CONSUME(head, length);
-	if (GWBUF_EMPTY(head))
-	{
-		rval = head->next;
+	do {
+		n = GWBUF_LENGTH(rval);
+		if (length < n)
+			n = length;
+		GWBUF_CONSUME(rval, n);
+		length -= n;
+		if (!GWBUF_EMPTY(rval))
+			break;
+		head = rval;
+		rval = rval->next;
 		gwbuf_free(head);
-	}
+	} while (rval != NULL && length > 0);
 	return rval;
 }
 
@@ -208,3 +597,302 @@ int	rval = 0;
 	}
 	return rval;
 }
+
+/**
+ * Initialise an empty buffer queue
+ *
+ * @param queue	The queue to initialise
+ */
+void
+gwbuf_queue_init(GWBUF_QUEUE *queue)
+{
+	queue->head = NULL;
+	queue->tail = NULL;
+	queue->length = 0;
+}
+
+/**
+ * Append a buffer chain to a buffer queue. The cost is proportional to the
+ * length of the chain being appended, not the length of the queue.
+ *
+ * This call should be made with the caller holding the lock for the queue.
+ *
+ * @param queue	The queue to append to
+ * @param buf	The buffer chain to append
+ */
+void
+gwbuf_queue_append(GWBUF_QUEUE *queue, GWBUF *buf)
+{
+GWBUF	*ptr;
+
+	if (buf == NULL)
+		return;
+	if (queue->tail == NULL)
+		queue->head = buf;
+	else
+		queue->tail->next = buf;
+	for (ptr = buf; ; ptr = ptr->next)
+	{
+		queue->length += GWBUF_LENGTH(ptr);
+		if (ptr->next == NULL)
+			break;
+	}
+	queue->tail = ptr;
+}
+
+/**
+ * Consume data from the head of a buffer queue, freeing any buffers that
+ * become empty.
+ *
+ * This call should be made with the caller holding the lock for the queue.
+ *
+ * @param queue		The queue to consume from
+ * @param length	The amount of data to consume
+ */
+void
+gwbuf_queue_consume(GWBUF_QUEUE *queue, unsigned int length)
+{
+	if (queue->head == NULL)
+		return;
+	if (length > queue->length)
+		length = queue->length;
+	queue->head = gwbuf_consume(queue->head, length);
+	queue->length -= length;
+	if (queue->head == NULL)
+	{
+		queue->tail = NULL;
+		queue->length = 0;
+	}
+}
+
+/**
+ * Remove the entire buffer chain from a queue, leaving the queue empty.
+ *
+ * This call should be made with the caller holding the lock for the queue.
+ *
+ * @param queue	The queue
+ * @return	The buffer chain that was held in the queue
+ */
+GWBUF *
+gwbuf_queue_take(GWBUF_QUEUE *queue)
+{
+GWBUF	*rval = queue->head;
+
+	gwbuf_queue_init(queue);
+	return rval;
+}
+
+/**
+ * Make the data of a buffer chain contiguous. A chain of one buffer is
+ * returned as it is, otherwise the data is copied to a new buffer and the
+ * chain is freed.
+ *
+ * @param head	The buffer chain
+ * @return	The contiguous buffer or NULL if no memory could be allocated,
+ *		in which case the chain is left untouched
+ */
+GWBUF *
+gwbuf_make_contiguous(GWBUF *head)
+{
+GWBUF		*rval, *next;
+unsigned char	*ptr;
+
+	if (head == NULL || head->next == NULL)
+		return head;
+	if ((rval = gwbuf_alloc(gwbuf_length(head))) == NULL)
+		return NULL;
+	rval->command = head->command;
+	ptr = GWBUF_DATA(rval);
+	for (; head != NULL; head = next)
+	{
+		next = head->next;
+		memcpy(ptr, GWBUF_DATA(head), GWBUF_LENGTH(head));
+		ptr += GWBUF_LENGTH(head);
+		gwbuf_free(head);
+	}
+	return rval;
+}
+
+/**
+ * Copy data from a buffer chain, the data may span any number of buffers.
+ *
+ * @param head		The buffer chain
+ * @param offset	The offset of the data in the chain
+ * @param len		The number of bytes to copy
+ * @param dest		Where to copy the data to
+ * @return		The number of bytes copied, less than len if the
+ *			chain holds less data
+ */
+unsigned int
+gwbuf_copy_data(GWBUF *head, unsigned int offset, unsigned int len,
+		unsigned char *dest)
+{
+unsigned int	n, copied = 0;
+
+	while (head != NULL && offset >= GWBUF_LENGTH(head))
+	{
+		offset -= GWBUF_LENGTH(head);
+		head = head->next;
+	}
+	for (; head != NULL && copied < len; head = head->next)
+	{
+		n = GWBUF_LENGTH(head) - offset;
+		if (n > len - copied)
+			n = len - copied;
+		memcpy(dest + copied, (unsigned char *)GWBUF_DATA(head) + offset, n);
+		copied += n;
+		offset = 0;
+	}
+	return copied;
+}
+
+/**
+ * Split the first len bytes off a buffer chain. No data is copied, a buffer
+ * that holds data from both sides of the split is cloned and each of the
+ * two buffers refers to its part of the data.
+ *
+ * @param head	The buffer chain, updated to the remainder of the chain
+ * @param len	The number of bytes to split off
+ * @return	The chain of the first len bytes, the whole chain if it holds
+ *		no more than len bytes, or NULL if len is 0 or on error
+ */
+GWBUF *
+gwbuf_split(GWBUF **head, unsigned int len)
+{
+GWBUF	*rval = *head, *buf = *head, *last = NULL, *clone;
+
+	if (buf == NULL || len == 0)
+		return NULL;
+	while (buf != NULL && len >= GWBUF_LENGTH(buf))
+	{
+		len -= GWBUF_LENGTH(buf);
+		last = buf;
+		buf = buf->next;
+	}
+	if (buf == NULL)
+	{
+		*head = NULL;
+		return rval;
+	}
+	if (len > 0)
+	{
+		if ((clone = gwbuf_clone(buf)) == NULL)
+			return NULL;
+		clone->end = clone->start + len;
+		GWBUF_CONSUME(buf, len);
+		if (last == NULL)
+			rval = clone;
+		else
+			last->next = clone;
+	}
+	else
+	{
+		last->next = NULL;
+	}
+	*head = buf;
+	return rval;
+}
+
+/**
+ * Return the length of the first MySQL packet in a buffer chain, the header
+ * may span buffers.
+ *
+ * @param head	The buffer chain
+ * @return	The length of the packet including the header, or 0 if the
+ *		chain does not hold the whole header
+ */
+unsigned int
+gwbuf_mysql_packet_length(GWBUF *head)
+{
+unsigned char	hdr[3];
+
+	if (gwbuf_copy_data(head, 0, 3, hdr) != 3)
+		return 0;
+	return GWBUF_MYSQL_HEADER_LEN + (hdr[0] | (hdr[1] << 8) | (hdr[2] << 16));
+}
+
+/**
+ * Take the first complete MySQL packet from a buffer chain. This is used to
+ * iterate over the pipelined packets in a chain,
+ *
+ *	while ((packet = gwbuf_mysql_next_packet(&queue)) != NULL)
+ *
+ * after which queue holds the incomplete packet at the end, if any.
+ *
+ * @param head	The buffer chain, updated to the remainder of the chain
+ * @return	The packet or NULL if the chain holds no complete packet
+ */
+GWBUF *
+gwbuf_mysql_next_packet(GWBUF **head)
+{
+unsigned int	len = gwbuf_mysql_packet_length(*head);
+
+	if (len == 0 || gwbuf_length(*head) < len)
+		return NULL;
+	return gwbuf_split(head, len);
+}
+
+/**
+ * Return the metadata of the MySQL packet at the start of a buffer chain,
+ * the packet is parsed the first time the metadata is asked for and the
+ * result is kept with the shared buffer. The text of a COM_QUERY refers
+ * to the data when the packet is held in the first buffer, otherwise it
+ * is copied once.
+ *
+ * @param head	The buffer chain
+ * @return	The metadata or NULL if the packet is incomplete or no memory
+ *		could be allocated
+ */
+GWBUF_INFO *
+gwbuf_mysql_info(GWBUF *head)
+{
+SHARED_BUF	*sbuf;
+GWBUF_INFO	*info;
+unsigned int	offset, len;
+unsigned char	command;
+
+	if (head == NULL)
+		return NULL;
+	sbuf = head->sbuf;
+	offset = (unsigned char *)head->start - sbuf->data;
+	for (info = sbuf->info; info != NULL; info = info->next)
+	{
+		if (info->offset == offset)
+			return info;
+	}
+	if ((len = gwbuf_mysql_packet_length(head)) == 0 ||
+	    gwbuf_length(head) < len)
+		return NULL;
+	if ((info = (GWBUF_INFO *)calloc(1, sizeof(GWBUF_INFO))) == NULL)
+		return NULL;
+	info->offset = offset;
+	info->packet_len = len;
+	info->command = -1;
+	if (gwbuf_copy_data(head, GWBUF_MYSQL_HEADER_LEN, 1, &command) == 1)
+		info->command = command;
+	if (info->command == GWBUF_MYSQL_COM_QUERY &&
+	    len > GWBUF_MYSQL_HEADER_LEN + 1)
+	{
+		info->sql_len = len - GWBUF_MYSQL_HEADER_LEN - 1;
+		if (GWBUF_LENGTH(head) >= len)
+		{
+			info->sql = (char *)head->start + GWBUF_MYSQL_HEADER_LEN + 1;
+		}
+		else if ((info->sql_copy = (char *)malloc(info->sql_len)) != NULL)
+		{
+			gwbuf_copy_data(head, GWBUF_MYSQL_HEADER_LEN + 1,
+					info->sql_len, (unsigned char *)info->sql_copy);
+			info->sql = info->sql_copy;
+		}
+		else
+		{
+			info->sql_len = 0;
+		}
+	}
+	/*< The clones of the buffer may be described by other threads */
+	do {
+		info->next = sbuf->info;
+	} while (!__sync_bool_compare_and_swap(&sbuf->info, info->next, info));
+	return info;
+}
+
@@ -287,10 +287,31 @@ int			error_count = 0;
 		{
                         char *servers;
 			char *roptions;
+			char *high;
+			char *low;
+			char *idle;
+			char *connect;
                         
 			servers = config_get_value(obj->parameters, "servers");
 			roptions = config_get_value(obj->parameters,
                                                     "router_options");
+			high = config_get_value(obj->parameters,
+                                                "writeq_high_water");
+			low = config_get_value(obj->parameters,
+                                               "writeq_low_water");
+			idle = config_get_value(obj->parameters,
+                                                "connection_timeout");
+			connect = config_get_value(obj->parameters,
+                                                   "backend_connect_timeout");
+			if (obj->element)
+			{
+				serviceSetWriteQueueLimits(obj->element,
+                                                           high ? atoi(high) : 0,
+                                                           low ? atoi(low) : 0);
+				serviceSetTimeouts(obj->element,
+                                                   idle ? atoi(idle) : 0,
+                                                   connect ? atoi(connect) : 0);
+			}
 			if (servers && obj->element)
 			{
 				char *s = strtok(servers, ",");
@@ -521,6 +542,109 @@ config_threadcount()
 	return gateway.n_threads;
 }
 
+/**
+ * Return whether each polling thread should use its own epoll set
+ *
+ * @return Non-zero if the poll sets are sharded per thread
+ */
+int
+config_poll_sharding()
+{
+	return gateway.poll_sharding;
+}
+
+/**
+ * Return the event notification backend the polling threads should use
+ *
+ * @return POLL_BACKEND_EPOLL or POLL_BACKEND_IO_URING
+ */
+int
+config_poll_backend()
+{
+	return gateway.poll_backend;
+}
+
+/**
+ * Return the CPUs the polling threads should be bound to
+ *
+ * @return The thread affinity specification or NULL if not bound
+ */
+char *
+config_thread_affinity()
+{
+	return gateway.thread_affinity;
+}
+
+/**
+ * Return whether the polling threads should prefer the memory of the
+ * NUMA node of the CPUs they are bound to
+ *
+ * @return Non-zero if node local memory is preferred
+ */
+int
+config_numa_local()
+{
+	return gateway.numa_local;
+}
+
+/**
+ * Return the number of bytes that are read from a DCB for each read event
+ * before the other DCBs that have events are served
+ *
+ * @return The read budget in bytes, 0 if unlimited
+ */
+int
+config_read_budget()
+{
+	return gateway.read_budget;
+}
+
+/**
+ * Return whether new connections are accepted by a dedicated thread and
+ * handed to the polling threads
+ *
+ * @return Non-zero if there is an acceptor thread
+ */
+int
+config_acceptor_thread()
+{
+	return gateway.acceptor_thread;
+}
+
+/**
+ * Return the time for which the resolved address of a server is used
+ * before the name is resolved again
+ *
+ * @return The time in seconds, 0 if the address is never refreshed
+ */
+int
+config_resolve_ttl()
+{
+	return gateway.resolve_ttl;
+}
+
+/**
+ * Return the use of huge pages by the arenas of the buffer pool
+ *
+ * @return One of the BUFFER_HUGEPAGES values
+ */
+int
+config_buffer_hugepages()
+{
+	return gateway.buffer_hugepages;
+}
+
+/**
+ * Return whether the spinlock classes are profiled from start up
+ *
+ * @return Non-zero if lock profiling is enabled
+ */
+int
+config_lock_profiling()
+{
+	return gateway.lock_profiling;
+}
+
 /**
  * Configuration handler for items in the global [MaxScale] section
  *
@@ -533,6 +657,48 @@ handle_global_item(const char *name, const char *value)
 {
 	if (strcmp(name, "threads") == 0) {
 		gateway.n_threads = atoi(value);
+	} else if (strcmp(name, "poll_sharding") == 0) {
+		gateway.poll_sharding = atoi(value);
+	} else if (strcmp(name, "poll_backend") == 0) {
+		/*<
+		 * The io_uring backend only replaces epoll_wait, the reads
+		 * and writes are still system calls of their own, so it is
+		 * not offered until they are submitted through the ring too.
+		 */
+		if (strcasecmp(value, "io_uring") == 0)
+		{
+			LOGIF(LE, (skygw_log_write_flush(
+				LOGFILE_ERROR,
+				"Warning : The io_uring event backend is not "
+				"available, using epoll instead.")));
+			gateway.poll_backend = POLL_BACKEND_EPOLL;
+		}
+		else if (strcasecmp(value, "epoll") == 0)
+			gateway.poll_backend = POLL_BACKEND_EPOLL;
+		else
+			return 0;
+	} else if (strcmp(name, "thread_affinity") == 0) {
+		free(gateway.thread_affinity);
+		gateway.thread_affinity = strdup(value);
+	} else if (strcmp(name, "numa_local") == 0) {
+		gateway.numa_local = atoi(value);
+	} else if (strcmp(name, "read_budget") == 0) {
+		gateway.read_budget = atoi(value);
+	} else if (strcmp(name, "acceptor_thread") == 0) {
+		gateway.acceptor_thread = atoi(value);
+	} else if (strcmp(name, "resolve_ttl") == 0) {
+		gateway.resolve_ttl = atoi(value);
+	} else if (strcmp(name, "buffer_hugepages") == 0) {
+		if (strcasecmp(value, "hugetlb") == 0)
+			gateway.buffer_hugepages = BUFFER_HUGEPAGES_HUGETLB;
+		else if (strcasecmp(value, "transparent") == 0)
+			gateway.buffer_hugepages = BUFFER_HUGEPAGES_TRANSPARENT;
+		else if (strcasecmp(value, "none") == 0)
+			gateway.buffer_hugepages = BUFFER_HUGEPAGES_NONE;
+		else
+			return 0;
+	} else if (strcmp(name, "lock_profiling") == 0) {
+		gateway.lock_profiling = atoi(value);
         } else {
                 return 0;
         }
@@ -546,6 +712,16 @@ static void
 global_defaults()
 {
 	gateway.n_threads = 1;
+	gateway.poll_sharding = 0;
+	gateway.poll_backend = POLL_BACKEND_EPOLL;
+	free(gateway.thread_affinity);
+	gateway.thread_affinity = NULL;
+	gateway.numa_local = 0;
+	gateway.read_budget = DEFAULT_READ_BUDGET;
+	gateway.acceptor_thread = 0;
+	gateway.resolve_ttl = DEFAULT_RESOLVE_TTL;
+	gateway.buffer_hugepages = BUFFER_HUGEPAGES_NONE;
+	gateway.lock_profiling = 0;
 }
 
 /**
@@ -696,10 +872,31 @@ SERVER			*server;
 		{
                         char *servers;
 			char *roptions;
+			char *high;
+			char *low;
+			char *idle;
+			char *connect;
                         
 			servers = config_get_value(obj->parameters, "servers");
 			roptions = config_get_value(obj->parameters,
                                                     "router_options");
+			high = config_get_value(obj->parameters,
+                                                "writeq_high_water");
+			low = config_get_value(obj->parameters,
+                                               "writeq_low_water");
+			idle = config_get_value(obj->parameters,
+                                                "connection_timeout");
+			connect = config_get_value(obj->parameters,
+                                                   "backend_connect_timeout");
+			if (obj->element)
+			{
+				serviceSetWriteQueueLimits(obj->element,
+                                                           high ? atoi(high) : 0,
+                                                           low ? atoi(low) : 0);
+				serviceSetTimeouts(obj->element,
+                                                   idle ? atoi(idle) : 0,
+                                                   connect ? atoi(connect) : 0);
+			}
 			if (servers && obj->element)
 			{
 				char *s = strtok(servers, ",");
@@ -787,6 +984,10 @@ static char *service_params[] =
                 "servers",
                 "user",
                 "passwd",
+                "writeq_high_water",
+                "writeq_low_water",
+                "connection_timeout",
+                "backend_connect_timeout",
                 NULL
         };
 
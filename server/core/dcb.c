@@ -54,6 +54,9 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 #include <dcb.h>
 #include <spinlock.h>
 #include <server.h>
@@ -62,28 +65,97 @@
 #include <modules.h>
 #include <router.h>
 #include <errno.h>
+#include <sys/socket.h>
 #include <gw.h>
 #include <poll.h>
 #include <atomic.h>
+#include <splice.h>
+#include <config.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
 
+#ifndef IOV_MAX
+#define IOV_MAX		1024	/*< Linux limit on the buffers of a writev */
+#endif
+
 extern int lm_enabled_logfiles_bitmask;
 
+/**
+ * A list of retired DCBs, kept in the order in which they were retired.
+ * There is one list per polling thread and a further list for DCBs that
+ * are closed by threads that do not poll. Each list is padded to a cache
+ * line of its own, the spinlock is only ever contended on the shared list.
+ */
+typedef struct {
+	SPINLOCK	lock;		/*< Protects the list */
+	DCB		*head;		/*< The oldest retired DCB */
+	DCB		*tail;		/*< The most recently retired DCB */
+	char		pad[64 - sizeof(SPINLOCK) - 2 * sizeof(DCB *)];
+} DCB_RETIRED;
+
+/* The lock classes of the DCB locks, for the lock profile */
+static	SPINLOCK_CLASS	dcbspin_class = SPINLOCK_CLASS_INIT("dcbspin");
+static	SPINLOCK_CLASS	retired_class = SPINLOCK_CLASS_INIT("retiredspin");
+static	SPINLOCK_CLASS	initlock_class = SPINLOCK_CLASS_INIT("dcb_initlock");
+static	SPINLOCK_CLASS	writeq_class = SPINLOCK_CLASS_INIT("writeqlock");
+static	SPINLOCK_CLASS	delayq_class = SPINLOCK_CLASS_INIT("delayqlock");
+static	SPINLOCK_CLASS	authlock_class = SPINLOCK_CLASS_INIT("authlock");
+
 static	DCB		*allDCBs = NULL;	/* Diagnotics need a list of DCBs */
-static	DCB		*zombies = NULL;
-static	SPINLOCK	dcbspin = SPINLOCK_INIT;
-static	SPINLOCK	zombiespin = SPINLOCK_INIT;
+static	SPINLOCK	dcbspin = SPINLOCK_TICKET_INIT_CLASS(&dcbspin_class);
+static	DCB_RETIRED	*retired = NULL;	/* The retired DCB lists */
+static	int		n_retired = 0;		/* Number of polling threads */
 
 static void dcb_final_free(DCB *dcb);
+static int  dcb_writev_chain(DCB *dcb, GWBUF *queue);
+static void dcb_throttle_release(DCB *dcb);
+static int  dcb_has_output(DCB *dcb);
+static void dcb_pollout_idle(DCB *dcb);
+static void dcb_idle_expired(void *data);
+static void dcb_connect_expired(void *data);
 static bool dcb_set_state_nomutex(
         DCB*              dcb,
         const dcb_state_t new_state,
         dcb_state_t*      old_state);
 
-DCB* dcb_get_zombies(void)
+/**
+ * Initialise the retired DCB lists, one per polling thread and one
+ * that is shared by all other threads.
+ *
+ * @param nthreads	The number of polling threads
+ */
+void
+dcb_reclaim_init(int nthreads)
+{
+int	i;
+
+	if ((retired = (DCB_RETIRED *)calloc(nthreads + 1,
+					sizeof(DCB_RETIRED))) == NULL)
+	{
+		perror("calloc");
+		exit(-1);
+	}
+	for (i = 0; i <= nthreads; i++)
+	{
+		spinlock_init(&retired[i].lock);
+		spinlock_set_class(&retired[i].lock, &retired_class);
+	}
+	n_retired = nthreads;
+}
+
+/**
+ * Check if there are retired DCBs waiting to be freed by a polling thread
+ *
+ * @param threadid	The polling thread
+ * @return		Non-zero if there are DCBs waiting to be freed
+ */
+int
+dcb_has_zombies(int threadid)
 {
-        return zombies;
+	if (retired == NULL)
+		return 0;
+	return retired[threadid].head != NULL ||
+		(threadid == 0 && retired[n_retired].head != NULL);
 }
 
 /**
@@ -115,13 +187,20 @@ if ((rval = calloc(1, sizeof(DCB))) == NULL)
         rval->dcb_read_active = false;
 #endif
         spinlock_init(&rval->dcb_initlock);
+	spinlock_set_class(&rval->dcb_initlock, &initlock_class);
 	spinlock_init(&rval->writeqlock);
+	spinlock_set_class(&rval->writeqlock, &writeq_class);
 	spinlock_init(&rval->delayqlock);
+	spinlock_set_class(&rval->delayqlock, &delayq_class);
+	gwbuf_queue_init(&rval->writeq);
+	gwbuf_queue_init(&rval->delayq);
 	spinlock_init(&rval->authlock);
+	spinlock_set_class(&rval->authlock, &authlock_class);
         rval->fd = -1;
+	rval->owner = -1;
+	rval->timer.wheel = -1;
 	memset(&rval->stats, 0, sizeof(DCBSTATS));	// Zero the statistics
 	rval->state = DCB_STATE_ALLOC;
-	bitmask_init(&rval->memdata.bitmask);
 
 	spinlock_acquire(&dcbspin);
 	if (allDCBs == NULL)
@@ -138,90 +217,108 @@ if ((rval = calloc(1, sizeof(DCB))) == NULL)
 }
 
 /** 
- * Add the DCB to the end of zombies list. 
+ * Retire a DCB by adding it to the end of the retired list of the calling
+ * thread.
  *
  * Adding to list occurs once per DCB. This is ensured by changing the
- * state of DCB to DCB_STATE_ZOMBIE after addition. Prior insertion, DCB state
- * is checked and operation proceeds only if state differs from DCB_STATE_ZOMBIE.
+ * state of DCB to DCB_STATE_ZOMBIE, only the thread that makes the transition
+ * from DCB_STATE_NOPOLLING adds the DCB to a list. The DCB is tagged with a
+ * new epoch and may be freed once every polling thread has observed it.
+ *
  * @param dcb The DCB to add to the zombie list
  * @return none
  */
 void
 dcb_add_to_zombieslist(DCB *dcb)
 {
-        bool        succp = false;
-        dcb_state_t prev_state = DCB_STATE_UNDEFINED;
+        dcb_state_t  prev_state = DCB_STATE_UNDEFINED;
+        DCB_RETIRED *list;
+        int          threadid;
         
         CHK_DCB(dcb);        
 
-        /*<
-         * Protect zombies list access.
-         */
-	spinlock_acquire(&zombiespin);
         /*<
          * If dcb is already added to zombies list, return.
          */
-        if (dcb->state != DCB_STATE_NOPOLLING) {
-                ss_dassert(dcb->state != DCB_STATE_POLLING &&
-                           dcb->state != DCB_STATE_LISTENING);
-                spinlock_release(&zombiespin);
+        if (!dcb_set_state(dcb, DCB_STATE_ZOMBIE, &prev_state) ||
+            prev_state != DCB_STATE_NOPOLLING)
+        {
+                ss_dassert(prev_state != DCB_STATE_POLLING &&
+                           prev_state != DCB_STATE_LISTENING);
                 return;
         }
-#if 1
-        /*<
-         * Add closing dcb to the top of the list.
-         */
-        dcb->memdata.next = zombies;
-        zombies = dcb;
-#else
-	if (zombies == NULL) {
-		zombies = dcb;
-        } else {
-		DCB *ptr = zombies;
-		while (ptr->memdata.next)
-		{
-                        ss_info_dassert(
-                                ptr->memdata.next->state == DCB_STATE_ZOMBIE,
-                                "Next zombie is not in DCB_STATE_ZOMBIE state");
-
-                        ss_info_dassert(
-                                ptr != dcb,
-                                "Attempt to add DCB to zombies list although it "
-                                "is already there.");
-                        
-			if (ptr == dcb)
-			{
-				LOGIF(LE, (skygw_log_write_flush(
-                                        LOGFILE_ERROR,
-                                        "Error : Attempt to add DCB to zombies "
-                                        "list when it is already in the list")));
-				break;
-			}
-			ptr = ptr->memdata.next;
-		}
-		if (ptr != dcb) {
-                        ptr->memdata.next = dcb;
-                }
-	}
-#endif
+        threadid = poll_thread_id();
+        list = &retired[threadid < 0 ? n_retired : threadid];
+        dcb->memdata.next = NULL;
+
+        spinlock_acquire(&list->lock);
+        dcb->memdata.epoch = poll_epoch_advance();
+        if (list->tail == NULL)
+                list->head = dcb;
+        else
+                list->tail->memdata.next = dcb;
+        list->tail = dcb;
+        spinlock_release(&list->lock);
+
         /*<
-         * Set state which indicates that it has been added to zombies
-         * list.
+         * A DCB retired by a thread that does not poll will be freed by the
+         * first polling thread, make sure it looks at it.
          */
-        succp = dcb_set_state(dcb, DCB_STATE_ZOMBIE, &prev_state);
-        ss_info_dassert(succp, "Failed to set DCB_STATE_ZOMBIE");
-        
-	spinlock_release(&zombiespin);
+        if (threadid < 0)
+                poll_wakeup(0);
 }
 
+/**
+ * Detach the DCBs that may be freed from the head of a retired list.
+ *
+ * @param list		The retired list
+ * @param min_epoch	The oldest epoch observed by the polling threads
+ * @return		The chain of DCBs to free
+ */
+static DCB *
+dcb_retired_expire(DCB_RETIRED *list, unsigned long min_epoch)
+{
+DCB		*victims = NULL, *last = NULL;
+unsigned long	wait_epoch;
 
+	/*<
+	 * Perform a dirty read to see if there is anything in the list,
+	 * this avoids taking the spinlock when the list is empty.
+	 */
+	if (list->head == NULL)
+		return NULL;
+
+	spinlock_acquire(&list->lock);
+	while (list->head && list->head->memdata.epoch <= min_epoch)
+	{
+		DCB *dcb = list->head;
+
+		list->head = dcb->memdata.next;
+		if (list->head == NULL)
+			list->tail = NULL;
+		ss_info_dassert(dcb->state == DCB_STATE_ZOMBIE,
+				"dcb not in DCB_STATE_ZOMBIE state.");
+		dcb->memdata.next = NULL;
+		if (last == NULL)
+			victims = dcb;
+		else
+			last->memdata.next = dcb;
+		last = dcb;
+	}
+	/*<
+	 * Any remaining DCBs are waiting for polling threads that have not
+	 * passed a quiescent point, these may be sleeping in epoll_wait.
+	 */
+	wait_epoch = list->head ? list->head->memdata.epoch : 0;
+	spinlock_release(&list->lock);
+	if (wait_epoch)
+		poll_epoch_wake(wait_epoch);
+	return victims;
+}
 
 /**
  * Free a DCB and remove it from the chain of all DCBs
  *
- * NB This is called with the caller holding the zombie queue
- * spinlock
- *
  * @param dcb The DCB to free
  */
 static void
@@ -274,13 +371,15 @@ dcb_final_free(DCB *dcb)
 		}
 	}
 
+	timer_cancel(&dcb->timer);
+	if (dcb->splice != NULL)
+		splice_release(dcb);
 	if (dcb->protocol != NULL)
 		free(dcb->protocol);
 	if (dcb->data)
 		free(dcb->data);
 	if (dcb->remote)
 		free(dcb->remote);
-	bitmask_free(&dcb->memdata.bitmask);
 	free(dcb);
 }
 
@@ -288,86 +387,41 @@ dcb_final_free(DCB *dcb)
  * Process the DCB zombie queue
  *
  * This routine is called by each of the polling threads with
- * the thread id of the polling thread. It must clear the bit in
- * the memdata bitmask for the polling thread that calls it. If the
- * operation of clearing this bit means that no bits are set in
- * the memdata.bitmask then the DCB is no longer able to be 
- * referenced and it can be finally removed.
+ * the thread id of the polling thread, at a point at which the thread
+ * holds no references to retired DCBs. It frees the DCBs on the retired
+ * list of the thread that were retired in an epoch which every polling
+ * thread has since observed. The first polling thread also processes the
+ * list of DCBs retired by threads that do not poll.
  *
  * @param	threadid	The thread ID of the caller
+ * @return	The DCBs that remain on the retired list of the caller
  */
 DCB*
 dcb_process_zombies(int threadid)
 {
-DCB	*ptr, *lptr;
-DCB*    dcb_list = NULL;
-DCB*    dcb = NULL;
-bool    succp = false;
+DCB*    	dcb_list = NULL;
+DCB*    	dcb = NULL;
+bool    	succp = false;
+unsigned long	min_epoch;
 
-	/*<
-	 * Perform a dirty read to see if there is anything in the queue.
-	 * This avoids threads hitting the queue spinlock when the queue 
-	 * is empty. This will really help when the only entry is being
-	 * freed, since the queue is updated before the expensive call to
-	 * dcb_final_free.
-	 */
-	if (!zombies)
+	if (retired == NULL || !dcb_has_zombies(threadid))
 		return NULL;
 
-	spinlock_acquire(&zombiespin);
-	ptr = zombies;
-	lptr = NULL;
-	while (ptr)
-	{                    
-		bitmask_clear(&ptr->memdata.bitmask, threadid);
-		if (bitmask_isallclear(&ptr->memdata.bitmask))
-		{
-			/*<
-			 * Remove the DCB from the zombie queue
- 			 * and call the final free routine for the
-			 * DCB
-			 *
-			 * ptr is the DCB we are processing
-			 * lptr is the previous DCB on the zombie queue
-			 * or NULL if the DCB is at the head of the queue
-			 * tptr is the DCB after the one we are processing
-			 * on the zombie queue
-			 */
-			DCB	*tptr = ptr->memdata.next;
-			if (lptr == NULL)
-				zombies = tptr;
-			else
-				lptr->memdata.next = tptr;
-                        LOGIF(LD, (skygw_log_write_flush(
-                                LOGFILE_DEBUG,
-                                "%lu [dcb_process_zombies] Remove dcb %p fd %d "
-                                "in state %s from zombies list.",
-                                pthread_self(),
-                                ptr,
-                                ptr->fd,
-                                STRDCBSTATE(ptr->state)))); 
-                        ss_info_dassert(ptr->state == DCB_STATE_ZOMBIE,
-                                        "dcb not in DCB_STATE_ZOMBIE state.");
-                        /*<
-                         * Move dcb to linked list of victim dcbs.
-                         */
-                        if (dcb_list == NULL) {
-                                dcb_list = ptr;
-                                dcb = dcb_list;
-                        } else {
-                                dcb->memdata.next = ptr;
-                                dcb = dcb->memdata.next;
-                        }
-                        dcb->memdata.next = NULL;
-			ptr = tptr;
-		}
-		else
+	min_epoch = poll_epoch_min();
+	dcb_list = dcb_retired_expire(&retired[threadid], min_epoch);
+	if (threadid == 0)
+	{
+		dcb = dcb_retired_expire(&retired[n_retired], min_epoch);
+		if (dcb_list == NULL)
+			dcb_list = dcb;
+		else if (dcb != NULL)
 		{
-			lptr = ptr;
-			ptr = ptr->memdata.next;
+			DCB *ptr = dcb_list;
+			while (ptr->memdata.next)
+				ptr = ptr->memdata.next;
+			ptr->memdata.next = dcb;
 		}
 	}
-	spinlock_release(&zombiespin);
 
         dcb = dcb_list;
         /*< Close, and set DISCONNECTED victims */
@@ -410,7 +464,7 @@ bool    succp = false;
                 dcb_final_free(dcb);
                 dcb = dcb_next;
         }
-        return zombies;
+        return retired[threadid].head;
 }
 
 /**
@@ -506,6 +560,7 @@ int             rc;
 	 * EPOLLOUT event that will be received once the connection
 	 * is established.
 	 */
+        dcb->events = EPOLLOUT;
         
         /*<
          * Add the dcb in the poll set
@@ -517,84 +572,144 @@ int             rc;
                 dcb_final_free(dcb);
                 return NULL;
         }
+        /*<
+         * Fail the connection if it is not established in time, the
+         * check is made when the timer expires.
+         */
+        if (session->service->connect_timeout > 0)
+        {
+                timer_add(&dcb->timer,
+                          dcb->owner,
+                          session->service->connect_timeout * 1000UL,
+                          dcb_connect_expired,
+                          dcb);
+        }
 	/*<
 	 * The dcb will be addded into poll set by dcb->func.connect
 	 */
-	atomic_add(&server->stats.n_connections, 1);
-	atomic_add(&server->stats.n_current, 1);
+	counter_inc(server->stats.n_connections);
+	counter_inc(server->stats.n_current);
         
 	return dcb;
 }
 
 
+/**
+ * Per thread cache of spare read buffers of MAX_BUFFER_SIZE bytes. A read
+ * that only partially fills a buffer copies the data into a buffer of the
+ * exact size and leaves the large buffer here for the next read.
+ */
+static __thread GWBUF	*dcb_read_spare[2];
+
+/**
+ * Take a read buffer of MAX_BUFFER_SIZE bytes, either from the spares of
+ * the calling thread or a newly allocated one.
+ *
+ * @param idx	The spare buffer slot
+ * @return	The buffer or NULL if none could be allocated
+ */
+static GWBUF *
+dcb_read_buffer(int idx)
+{
+GWBUF	*buf;
+
+	if ((buf = dcb_read_spare[idx]) != NULL)
+	{
+		dcb_read_spare[idx] = NULL;
+		return buf;
+	}
+	return gwbuf_alloc(MAX_BUFFER_SIZE);
+}
+
+/**
+ * Turn a full size read buffer that holds len bytes into a buffer that
+ * can be added to a chain. Buffers that are less than half used have the
+ * data copied to a buffer of the exact size so the large one can be kept
+ * as a spare, others are trimmed to the length of the data.
+ *
+ * @param idx	The spare buffer slot the buffer came from
+ * @param buf	The read buffer
+ * @param len	The number of valid bytes in the buffer
+ * @return	The buffer to add to the chain
+ */
+static GWBUF *
+dcb_read_complete(int idx, GWBUF *buf, int len)
+{
+GWBUF	*copy;
+
+	if (len < MAX_BUFFER_SIZE / 2 &&
+	    dcb_read_spare[idx] == NULL &&
+	    (copy = gwbuf_alloc(len)) != NULL)
+	{
+		memcpy(GWBUF_DATA(copy), GWBUF_DATA(buf), len);
+		dcb_read_spare[idx] = buf;
+		return copy;
+	}
+	buf->end = (char *)buf->start + len;
+	return buf;
+}
+
 /**
  * General purpose read routine to read data from a socket in the
  * Descriptor Control Block and append it to a linked list of buffers.
  * The list may be empty, in which case *head == NULL
  *
+ * The data is read directly into buffers of MAX_BUFFER_SIZE bytes, two at
+ * a time with readv, until the socket is drained. A read that does not fill
+ * both buffers means there is no more data available, so no further system
+ * call is made to find out that the read would block.
+ *
+ * No more than the read budget is read, so that a client that streams a
+ * large amount of data does not hold up the other DCBs of the polling
+ * thread. If data may be left in the socket, or the peer closed the
+ * connection after sending the data that was read, the DCB is flagged as
+ * readable and the polling loop calls the read function again later.
+ *
  * @param dcb	The DCB to read from
  * @param head	Pointer to linked list to append data to
- * @return	-1 on error, otherwise the number of read bytes on the last.
- * 0 is returned if no data available on the last iteration of while loop.
+ * @return	-1 on error or if the peer closed the connection before any
+ * data was read, otherwise the number of bytes read, which may be 0.
  */
 int
 dcb_read(DCB *dcb, GWBUF **head)
 {
-GWBUF 	  *buffer = NULL;
-int 	  b;
-int       rc;
-int       n = 0;
-int       eno = 0;
+GWBUF 	  *buffer[2];
+struct iovec iov[2];
+int       i, n;
+int       nread = 0;
+int       budget = config_read_budget();
 
         CHK_DCB(dcb);
+        dcb->readable = 0;
         while (true)
 	{
-		int bufsize;
-
-                rc = ioctl(dcb->fd, FIONREAD, &b);
-
-                if (rc == -1) {
-                        eno = errno;
-                        errno = 0;
-                        LOGIF(LE, (skygw_log_write_flush(
-                                LOGFILE_ERROR,
-                                "Error : ioctl FIONREAD for dcb %p in "
-                                "state %s fd %d failed due error %d, %s.",
-                                dcb,
-                                STRDCBSTATE(dcb->state),
-                                dcb->fd,
-                                eno,
-                                strerror(eno))));
-                        n = -1;
-                        goto return_n;
-                }
-                /*< Nothing to read - leave */
-                if (b == 0) {
-                        n = 0;
-                        goto return_n;
+                for (i = 0; i < 2; i++)
+                {
+                        if ((buffer[i] = dcb_read_buffer(i)) == NULL)
+                        {
+                                int eno = errno;
+                                /*<
+                                 * This is a fatal error which should cause
+                                 * shutdown. Todo shutdown if memory
+                                 * allocation fails.
+                                 */
+                                LOGIF(LE, (skygw_log_write_flush(
+                                        LOGFILE_ERROR,
+                                        "Error : Failed to allocate read buffer "
+                                        "for dcb %p fd %d, due %d, %s.",
+                                        dcb,
+                                        dcb->fd, 
+                                        eno,
+                                        strerror(eno))));
+                                if (i > 0)
+                                        dcb_read_spare[0] = buffer[0];
+                                ss_dassert(buffer[i] != NULL);
+                                return -1;
+                        }
+                        iov[i].iov_base = GWBUF_DATA(buffer[i]);
+                        iov[i].iov_len = MAX_BUFFER_SIZE;
                 }
-                bufsize = MIN(b, MAX_BUFFER_SIZE);
-
-		if ((buffer = gwbuf_alloc(bufsize)) == NULL)
-		{
-                        /*<
-                         * This is a fatal error which should cause shutdown.
-                         * Todo shutdown if memory allocation fails.
-                         */
-                        LOGIF(LE, (skygw_log_write_flush(
-                                LOGFILE_ERROR,
-                                "Error : Failed to allocate read buffer "
-                                "for dcb %p fd %d, due %d, %s.",
-                                dcb,
-                                dcb->fd, 
-                                eno,
-                                strerror(eno))));
-                        
-                        n = -1;
-                        ss_dassert(buffer != NULL);
-                        goto return_n;
-		}
-		GW_NOINTR_CALL(n = read(dcb->fd, GWBUF_DATA(buffer), bufsize);
+		GW_NOINTR_CALL(n = readv(dcb->fd, iov, 2);
                                dcb->stats.n_reads++);
 
 		if (n <= 0)
@@ -602,6 +717,31 @@ int       eno = 0;
                         int eno = errno;
                         errno = 0;
 
+                        dcb_read_spare[0] = buffer[0];
+                        dcb_read_spare[1] = buffer[1];
+
+                        if (n == 0)
+                        {
+                                /*<
+                                 * The peer has closed the connection, report
+                                 * it unless there is data to process first.
+                                 * No further EPOLLIN follows the EOF, so the
+                                 * DCB is flagged as readable and the next
+                                 * read reports it.
+                                 */
+                                LOGIF(LD, (skygw_log_write(
+                                        LOGFILE_DEBUG,
+                                        "%lu [dcb_read] Read EOF from dcb %p "
+                                        "in state %s fd %d.",
+                                        pthread_self(),
+                                        dcb,
+                                        STRDCBSTATE(dcb->state),
+                                        dcb->fd)));
+                                if (nread == 0)
+                                        return -1;
+                                dcb->readable = 1;
+                                return nread;
+                        }
                         if (eno != EAGAIN && eno != EWOULDBLOCK) {
                                 LOGIF(LE, (skygw_log_write_flush(
                                         LOGFILE_ERROR,
@@ -612,18 +752,13 @@ int       eno = 0;
                                         dcb->fd, 
                                         eno,
                                         strerror(eno))));
+                                return -1;
                         }
-                        else
-                        {
-                                /*<
-                                 * If read would block it means that other thread
-                                 * has probably read the data.
-                                 */
-                                n = 0;
-                        }
-                        
-			gwbuf_free(buffer);
-                        goto return_n;
+                        /*<
+                         * If read would block it means that other thread
+                         * has probably read the data.
+                         */
+                        return nread;
                 }
                 LOGIF(LD, (skygw_log_write(
                         LOGFILE_DEBUG,
@@ -634,11 +769,34 @@ int       eno = 0;
                         dcb,
                         STRDCBSTATE(dcb->state),
                         dcb->fd)));
+                nread += n;
+
 		/*< Append read data to the gwbuf */
-		*head = gwbuf_append(*head, buffer);
+                if (n <= MAX_BUFFER_SIZE)
+                {
+                        dcb_read_spare[1] = buffer[1];
+                        *head = gwbuf_append(*head,
+                                             dcb_read_complete(0, buffer[0], n));
+                }
+                else
+                {
+                        *head = gwbuf_append(*head, buffer[0]);
+                        *head = gwbuf_append(*head,
+                                             dcb_read_complete(
+                                                     1,
+                                                     buffer[1],
+                                                     n - MAX_BUFFER_SIZE));
+                }
+                /*< A short read means that the socket has been drained */
+                if (n < 2 * MAX_BUFFER_SIZE)
+                        break;
+                if (budget > 0 && nread >= budget)
+                {
+                        dcb->readable = 1;
+                        break;
+                }
 	} /*< while (true) */
-return_n:
-	return n;
+	return nread;
 }
 
 
@@ -668,7 +826,7 @@ dcb_write(DCB *dcb, GWBUF *queue)
         
         spinlock_acquire(&dcb->writeqlock);
 
-	if (dcb->writeq != NULL)
+	if (!GWBUF_QUEUE_EMPTY(&dcb->writeq))
 	{
 		/*
 		 * We have some queued data, so add our data to
@@ -679,7 +837,7 @@ dcb_write(DCB *dcb, GWBUF *queue)
 		 * the routine that drains the queue data, so we should
 		 * not have a race condition on the event.
 		 */
-		dcb->writeq = gwbuf_append(dcb->writeq, queue);
+		gwbuf_queue_append(&dcb->writeq, queue);
 		dcb->stats.n_buffered++;
                 LOGIF(LD, (skygw_log_write(
                                    LOGFILE_DEBUG,
@@ -693,12 +851,11 @@ dcb_write(DCB *dcb, GWBUF *queue)
 	}
 	else
 	{
-		int	len;
-
 		/*
 		 * Loop over the buffer chain that has been passed to us
 		 * from the reading side.
-		 * Send as much of the data in that chain as possible and
+		 * Send as much of the data in that chain as possible,
+		 * gathering the buffers into a single writev, and
 		 * add any balance to the write queue.
 		 */
 		while (queue != NULL)
@@ -720,12 +877,8 @@ dcb_write(DCB *dcb, GWBUF *queue)
                                 }
                         }
 #endif /* SS_DEBUG */
-			len = GWBUF_LENGTH(queue);
-			GW_NOINTR_CALL(
-                                w = gw_write(dcb->fd, GWBUF_DATA(queue), len);
-                                dcb->stats.n_writes++;
-                                );
-                        
+			w = dcb_writev_chain(dcb, queue);
+
 			if (w < 0)
 			{
                                 saved_errno = errno;
@@ -778,7 +931,7 @@ dcb_write(DCB *dcb, GWBUF *queue)
                  * What wasn't successfully written is stored to write queue
                  * for suspended write.
                  */
-                dcb->writeq = queue;
+                gwbuf_queue_append(&dcb->writeq, queue);
                 
 		if (queue != NULL)
 		{
@@ -791,7 +944,9 @@ dcb_write(DCB *dcb, GWBUF *queue)
             saved_errno != EAGAIN &&
             saved_errno != EWOULDBLOCK)
 	{
-                queue = gwbuf_consume(queue, gwbuf_length(queue));
+                /*< The unwritten data was the whole write queue, discard it */
+                gwbuf_queue_consume(&dcb->writeq,
+                                    GWBUF_QUEUE_LENGTH(&dcb->writeq));
                 LOGIF(LE, (skygw_log_write_flush(
                         LOGFILE_ERROR,
                         "Error : Writing to %s socket failed due %d, %s.",
@@ -803,9 +958,181 @@ dcb_write(DCB *dcb, GWBUF *queue)
 		return 0;
 	}
 	spinlock_release(&dcb->writeqlock);
+
+	/*<
+	 * The queued data is written when the socket signals EPOLLOUT. The
+	 * release of the lock does not order the queue stores before the
+	 * load of the events, dcb_pollout_idle relies on that order.
+	 */
+	__sync_synchronize();
+	if (queue != NULL && (dcb->events & EPOLLOUT) == 0 &&
+	    dcb->dcb_role == DCB_ROLE_REQUEST_HANDLER)
+	{
+		poll_update_dcb(dcb, EPOLLOUT, 0);
+	}
 	return 1;
 }
 
+/**
+ * Start the idle timer of a client DCB, if the service of the DCB has an
+ * idle timeout. This is called once the DCB has been added to the poll set.
+ *
+ * @param dcb	The client DCB
+ */
+void
+dcb_idle_start(DCB *dcb)
+{
+	if (dcb->service == NULL || dcb->service->conn_timeout <= 0)
+		return;
+	dcb->last_read = timer_now();
+	timer_add(&dcb->timer,
+		  dcb->owner,
+		  dcb->service->conn_timeout * 1000UL,
+		  dcb_idle_expired,
+		  dcb);
+}
+
+/**
+ * Take the read lock of a DCB whose timer has expired and check that the
+ * DCB is still polling. The timer runs on the owner of the DCB, but with
+ * a shared epoll set the events of the DCB may be handled by any thread,
+ * so the timer is serialised with the reads of the DCB, which is where it
+ * is closed from, and may then act on it as if it were an event.
+ *
+ * @param dcb	The DCB
+ * @return	1 if the DCB is polling, with the read lock held, otherwise 0
+ */
+static int
+dcb_timer_begin(DCB *dcb)
+{
+	simple_mutex_lock(&dcb->dcb_read_lock, true);
+	if (dcb->state != DCB_STATE_POLLING)
+	{
+		simple_mutex_unlock(&dcb->dcb_read_lock);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * The idle timer of a client DCB has expired. The time of the last read is
+ * recorded by the polling loop rather than by moving the timer for every
+ * read, so the timer is moved on here if the client has been active.
+ *
+ * @param data	The client DCB
+ */
+static void
+dcb_idle_expired(void *data)
+{
+DCB		*dcb = (DCB *)data;
+unsigned long	idle, timeout;
+
+	if (!dcb_timer_begin(dcb))
+		return;
+	if (dcb->service == NULL || dcb->service->conn_timeout <= 0)
+	{
+		simple_mutex_unlock(&dcb->dcb_read_lock);
+		return;
+	}
+	timeout = dcb->service->conn_timeout * 1000UL;
+	idle = timer_now() - dcb->last_read;
+	if (idle < timeout)
+	{
+		/*<
+		 * A close that is not made from a read, such as a hangup,
+		 * changes the state under the dcb_initlock before it cancels
+		 * the timer, so the timer is never added back once the DCB
+		 * has been removed from the poll set.
+		 */
+		spinlock_acquire(&dcb->dcb_initlock);
+		if (dcb->state == DCB_STATE_POLLING)
+			timer_add(&dcb->timer,
+				  dcb->owner,
+				  timeout - idle,
+				  dcb_idle_expired,
+				  dcb);
+		spinlock_release(&dcb->dcb_initlock);
+		simple_mutex_unlock(&dcb->dcb_read_lock);
+		return;
+	}
+	LOGIF(LM, (skygw_log_write(
+		LOGFILE_MESSAGE,
+		"Closing client connection from %s to service %s, idle for "
+		"%lu seconds.",
+		dcb->remote ? dcb->remote : "unknown",
+		dcb->service->name,
+		idle / 1000)));
+	dcb->func.hangup(dcb);
+	simple_mutex_unlock(&dcb->dcb_read_lock);
+}
+
+/**
+ * The connect timer of a backend DCB has expired. If the non-blocking
+ * connect has not completed the connection is failed in the same way as
+ * if an EPOLLERR had been received for it.
+ *
+ * @param data	The backend DCB
+ */
+static void
+dcb_connect_expired(void *data)
+{
+DCB			*dcb = (DCB *)data;
+struct sockaddr_storage	addr;
+socklen_t		len = sizeof(addr);
+
+	if (!dcb_timer_begin(dcb))
+		return;
+	if (getpeername(dcb->fd, (struct sockaddr *)&addr, &len) == 0)
+	{
+		simple_mutex_unlock(&dcb->dcb_read_lock);
+		return;
+	}
+	LOGIF(LE, (skygw_log_write_flush(
+		LOGFILE_ERROR,
+		"Error : Connection of backend dcb %p fd %d for service %s "
+		"timed out.",
+		dcb,
+		dcb->fd,
+		dcb->session->service->name)));
+	dcb->func.error(dcb);
+	simple_mutex_unlock(&dcb->dcb_read_lock);
+}
+
+/**
+ * Check whether a DCB has data waiting to be written, either in its
+ * write queue or in the byte pump.
+ *
+ * @param dcb	The DCB to check
+ * @return	Non-zero if data is waiting to be written
+ */
+static int
+dcb_has_output(DCB *dcb)
+{
+	return !GWBUF_QUEUE_EMPTY(&dcb->writeq) ||
+		(dcb->splice != NULL && splice_pending(dcb) > 0);
+}
+
+/**
+ * Stop polling a DCB for EPOLLOUT once it has nothing left to write, so
+ * that the writes to the DCB no longer cause EPOLLOUT events.
+ *
+ * The writers queue their data before they add EPOLLOUT, so the check is
+ * repeated once EPOLLOUT has been removed, any data that was queued in
+ * between puts EPOLLOUT back.
+ *
+ * @param dcb	The DCB that has been drained
+ */
+static void
+dcb_pollout_idle(DCB *dcb)
+{
+	if ((dcb->events & EPOLLOUT) == 0 || dcb_has_output(dcb))
+		return;
+	poll_update_dcb(dcb, 0, EPOLLOUT);
+	__sync_synchronize();
+	if (dcb_has_output(dcb))
+		poll_update_dcb(dcb, EPOLLOUT, 0);
+}
+
 /**
  * Drain the write queue of a DCB. This is called as part of the EPOLLOUT handling
  * of a socket and will try to send any buffered data from the write queue
@@ -822,21 +1149,17 @@ int w;
 int saved_errno = 0;
 
 	spinlock_acquire(&dcb->writeqlock);
-	if (dcb->writeq)
+	if (!GWBUF_QUEUE_EMPTY(&dcb->writeq))
 	{
-		int	len;
-
 		/*
 		 * Loop over the buffer chain in the pending writeq
-		 * Send as much of the data in that chain as possible and
+		 * Send as much of the data in that chain as possible,
+		 * gathering the buffers into a single writev, and
 		 * leave any balance on the write queue.
 		 */
-		while (dcb->writeq != NULL)
+		while (!GWBUF_QUEUE_EMPTY(&dcb->writeq))
 		{
-			len = GWBUF_LENGTH(dcb->writeq);
-			GW_NOINTR_CALL(w = gw_write(dcb->fd,
-                                                    GWBUF_DATA(dcb->writeq),
-                                                    len););
+			w = dcb_writev_chain(dcb, dcb->writeq.head);
 			saved_errno = errno;
                         errno = 0;
                         
@@ -862,7 +1185,7 @@ int saved_errno = 0;
 			 * Pull the number of bytes we have written from
 			 * queue with have.
 			 */
-			dcb->writeq = gwbuf_consume(dcb->writeq, w);
+			gwbuf_queue_consume(&dcb->writeq, w);
                         LOGIF(LD, (skygw_log_write(
                                 LOGFILE_DEBUG,
                                 "%lu [dcb_drain_writeq] Wrote %d Bytes to dcb %p "
@@ -875,10 +1198,127 @@ int saved_errno = 0;
 			n += w;
 		}
 	}
+	/*<
+	 * Resume reading from the DCBs that were paused whilst the write
+	 * queue was above the high water mark.
+	 */
+	if (dcb->throttled != NULL &&
+	    GWBUF_QUEUE_LENGTH(&dcb->writeq) <=
+	    dcb->session->service->writeq_low_water)
+	{
+		dcb_throttle_release(dcb);
+	}
 	spinlock_release(&dcb->writeqlock);
+
+	/*< Flush the data the byte pump is holding for the DCB */
+	if (dcb->splice != NULL)
+		splice_write_ready(dcb);
+	if (dcb->dcb_role == DCB_ROLE_REQUEST_HANDLER)
+		dcb_pollout_idle(dcb);
 	return n;
 }
 
+/**
+ * Pause reading from a DCB whilst the write queue of the DCB it delivers
+ * data to is above the high water mark of the service.
+ *
+ * This is called by a protocol module once the data read from peer has
+ * been written to dcb. Reading from peer resumes when the write queue of
+ * dcb drains below the low water mark of the service.
+ *
+ * @param dcb	The DCB the data was written to, usually the client
+ * @param peer	The DCB the data was read from
+ */
+void
+dcb_throttle_check(DCB *dcb, DCB *peer)
+{
+SERVICE	*service;
+
+	if (dcb == NULL || peer == NULL || dcb->session == NULL ||
+	    (service = dcb->session->service) == NULL ||
+	    service->writeq_high_water == 0 ||
+	    peer->throttled_by != NULL ||
+	    GWBUF_QUEUE_LENGTH(&dcb->writeq) <= service->writeq_high_water)
+	{
+		return;
+	}
+	spinlock_acquire(&dcb->writeqlock);
+	if (peer->throttled_by == NULL &&
+	    dcb->state == DCB_STATE_POLLING &&
+	    GWBUF_QUEUE_LENGTH(&dcb->writeq) > service->writeq_high_water)
+	{
+		LOGIF(LD, (skygw_log_write(
+			LOGFILE_DEBUG,
+			"%lu [dcb_throttle_check] %u bytes queued for dcb %p, "
+			"pause reading from dcb %p.",
+			pthread_self(),
+			GWBUF_QUEUE_LENGTH(&dcb->writeq),
+			dcb,
+			peer)));
+		peer->throttled_by = dcb;
+		peer->throttle_next = dcb->throttled;
+		dcb->throttled = peer;
+		poll_update_dcb(peer, 0, EPOLLIN);
+	}
+	spinlock_release(&dcb->writeqlock);
+}
+
+/**
+ * Resume reading from all the DCBs that were paused for a DCB.
+ *
+ * NB This is called with the caller holding the writeqlock of the DCB
+ *
+ * @param dcb	The DCB whose write queue has drained
+ */
+static void
+dcb_throttle_release(DCB *dcb)
+{
+DCB	*peer;
+
+	while ((peer = dcb->throttled) != NULL)
+	{
+		dcb->throttled = peer->throttle_next;
+		peer->throttle_next = NULL;
+		peer->throttled_by = NULL;
+		poll_update_dcb(peer, EPOLLIN, 0);
+	}
+}
+
+/**
+ * Remove a DCB that is closing from the throttling of its peers, both
+ * resuming the DCBs paused for it and leaving the list of the DCB it was
+ * paused for.
+ *
+ * @param dcb	The DCB that is closing
+ */
+static void
+dcb_throttle_detach(DCB *dcb)
+{
+DCB	*owner, **pptr;
+
+	if (dcb->throttled != NULL)
+	{
+		spinlock_acquire(&dcb->writeqlock);
+		dcb_throttle_release(dcb);
+		spinlock_release(&dcb->writeqlock);
+	}
+	if ((owner = dcb->throttled_by) != NULL)
+	{
+		spinlock_acquire(&owner->writeqlock);
+		if (dcb->throttled_by == owner)
+		{
+			pptr = &owner->throttled;
+			while (*pptr && *pptr != dcb)
+				pptr = &(*pptr)->throttle_next;
+			if (*pptr)
+				*pptr = dcb->throttle_next;
+			dcb->throttle_next = NULL;
+			dcb->throttled_by = NULL;
+		}
+		spinlock_release(&owner->writeqlock);
+	}
+}
+
 /** 
  * Removes dcb from poll set, and adds it to zombies list. As a consequense,
  * dcb first moves to DCB_STATE_NOPOLLING, and then to DCB_STATE_ZOMBIE state.
@@ -936,6 +1376,10 @@ dcb_close(DCB *dcb)
                     STRDCBSTATE(dcb->state))));
         }
         
+        dcb_throttle_detach(dcb);
+        splice_close(dcb);
+        timer_cancel(&dcb->timer);
+
         if (dcb->state == DCB_STATE_NOPOLLING) {
                 dcb_add_to_zombieslist(dcb);
         }
@@ -954,7 +1398,7 @@ printDCB(DCB *dcb)
 	printf("\tDCB state: 		%s\n", gw_dcb_state2string(dcb->state));
 	if (dcb->remote)
 		printf("\tConnected to:		%s\n", dcb->remote);
-	printf("\tQueued write data:	%d\n", gwbuf_length(dcb->writeq));
+	printf("\tQueued write data:	%d\n", GWBUF_QUEUE_LENGTH(&dcb->writeq));
 	printf("\tStatistics:\n");
 	printf("\t\tNo. of Reads: 	%d\n", dcb->stats.n_reads);
 	printf("\t\tNo. of Writes:	%d\n", dcb->stats.n_writes);
@@ -999,8 +1443,8 @@ DCB	*dcb;
 			dcb_printf(pdcb, "\tService:            %s\n", dcb->session->service->name);
 		if (dcb->remote)
 			dcb_printf(pdcb, "\tConnected to:       %s\n", dcb->remote);
-		if (dcb->writeq)
-			dcb_printf(pdcb, "\tQueued write data:  %d\n", gwbuf_length(dcb->writeq));
+		if (!GWBUF_QUEUE_EMPTY(&dcb->writeq))
+			dcb_printf(pdcb, "\tQueued write data:  %d\n", GWBUF_QUEUE_LENGTH(&dcb->writeq));
 		dcb_printf(pdcb, "\tStatistics:\n");
 		dcb_printf(pdcb, "\t\tNo. of Reads:           %d\n", dcb->stats.n_reads);
 		dcb_printf(pdcb, "\t\tNo. of Writes:          %d\n", dcb->stats.n_writes);
@@ -1024,8 +1468,14 @@ dprintDCB(DCB *pdcb, DCB *dcb)
 	dcb_printf(pdcb, "\tDCB state: 		%s\n", gw_dcb_state2string(dcb->state));
 	if (dcb->remote)
 		dcb_printf(pdcb, "\tConnected to:		%s\n", dcb->remote);
-	dcb_printf(pdcb, "\tOwning Session:   	%d\n", dcb->session);
-	dcb_printf(pdcb, "\tQueued write data:	%d\n", gwbuf_length(dcb->writeq));
+	dcb_printf(pdcb, "\tOwning Session:   	%p\n", dcb->session);
+	dcb_printf(pdcb, "\tOwning Thread:   	%d\n", dcb->owner);
+	dcb_printf(pdcb, "\tQueued write data:	%d\n", GWBUF_QUEUE_LENGTH(&dcb->writeq));
+	if (dcb->splice)
+		dcb_printf(pdcb, "\tSpliced:		%lu bytes\n",
+			dcb == dcb->splice->client ?
+			dcb->splice->upstream.bytes :
+			dcb->splice->downstream.bytes);
 	dcb_printf(pdcb, "\tStatistics:\n");
 	dcb_printf(pdcb, "\t\tNo. of Reads: 	%d\n", dcb->stats.n_reads);
 	dcb_printf(pdcb, "\t\tNo. of Writes:	%d\n", dcb->stats.n_writes);
@@ -1302,3 +1752,71 @@ int gw_write(
         return w;
 }
 
+/**
+ * Write a vector of buffers to a descriptor, the scatter-gather equivalent
+ * of gw_write.
+ *
+ * @param fd	The descriptor to write to
+ * @param iov	The buffers to write
+ * @param iovcnt	The number of buffers
+ * @return	The number of bytes written or -1 on error
+ */
+int gw_writev(
+        int                 fd,
+        const struct iovec* iov,
+        int                 iovcnt)
+{
+        int w;
+#if defined(SS_DEBUG)
+        if (dcb_fake_write_errno[fd] != 0) {
+                ss_dassert(dcb_fake_write_ev[fd] != 0);
+                /*< leave peer to read missing bytes */
+                w = write(fd, iov[0].iov_base, iov[0].iov_len/2);
+
+                if (w > 0) {
+                        w = -1;
+                        errno = dcb_fake_write_errno[fd];
+                }
+        } else {
+                w = writev(fd, iov, iovcnt);
+        }
+#else
+        w = writev(fd, iov, iovcnt);
+#endif /* SS_DEBUG && SS_TEST */
+        return w;
+}
+
+/**
+ * Write as much of a buffer chain as a single writev call allows. Up to
+ * IOV_MAX buffers from the head of the chain are gathered into one call,
+ * the caller must consume the bytes written from the chain.
+ *
+ * @param dcb	The DCB to write to
+ * @param queue	The head of the buffer chain
+ * @return	The number of bytes written or -1 on error, errno is set
+ */
+static int
+dcb_writev_chain(DCB *dcb, GWBUF *queue)
+{
+struct iovec	iov[IOV_MAX];
+GWBUF		*ptr;
+int		iovcnt = 0;
+int		w;
+
+	for (ptr = queue; ptr != NULL && iovcnt < IOV_MAX; ptr = ptr->next)
+	{
+		if (GWBUF_EMPTY(ptr))
+			continue;
+		iov[iovcnt].iov_base = GWBUF_DATA(ptr);
+		iov[iovcnt].iov_len = GWBUF_LENGTH(ptr);
+		iovcnt++;
+	}
+	if (iovcnt == 0)
+		return 0;
+	GW_NOINTR_CALL(
+		w = gw_writev(dcb->fd, iov, iovcnt);
+		dcb->stats.n_writes++;
+		);
+	return w;
+}
+
@@ -884,6 +884,7 @@ int main(int argc, char **argv)
         char*    cnf_file_path = NULL;        /*< conf file, to be freed */
         char*    cnf_file_arg = NULL;         /*< conf filename from cmd-line arg */
         void*    log_flush_thr = NULL;
+        void*    acceptor_thr = NULL;
         ssize_t  log_flush_timeout_ms = 0;
         sigset_t sigset;
         sigset_t sigpipe_mask;
@@ -1295,6 +1296,7 @@ int main(int argc, char **argv)
                 rc = MAXSCALE_BADCONFIG;
                 goto return_main;
         }
+        spinlock_profiling = config_lock_profiling();
         LOGIF(LM, (skygw_log_write(
                 LOGFILE_MESSAGE,
                 "SkySQL MaxScale %s (C) SkySQL Ab 2013,2014",
@@ -1305,6 +1307,12 @@ int main(int argc, char **argv)
                 getpid())));
     
         poll_init();
+
+        /*<
+         * Keep the addresses of the servers up to date without resolving
+         * them when connections are made.
+         */
+        server_resolver_start();
     
         /*<
          * Start the services that were created above
@@ -1337,6 +1345,14 @@ int main(int argc, char **argv)
         {
                 threads[n] = thread_start(poll_waitevents, (void *)(n + 1));
         }
+        /*<
+         * Start the acceptor thread, the listeners were added to its
+         * epoll set when the services were started.
+         */
+        if (config_acceptor_thread())
+        {
+                acceptor_thr = thread_start(poll_accept_loop, NULL);
+        }
         LOGIF(LM, (skygw_log_write(LOGFILE_MESSAGE,
                         "MaxScale started with %d server threads.",
                                    config_threadcount())));
@@ -1351,6 +1367,10 @@ int main(int argc, char **argv)
         {
                 thread_wait(threads[n]);
         }
+        if (acceptor_thr != NULL)
+        {
+                thread_wait(acceptor_thr);
+        }
         free(threads);
         free(home_dir);
         free(cnf_file_path);
@@ -1362,6 +1382,7 @@ int main(int argc, char **argv)
 
         /*< Stop all the monitors */
         monitorStopAll();
+        server_resolver_stop();
         LOGIF(LM, (skygw_log_write(
                            LOGFILE_MESSAGE,
                            "MaxScale is shutting down.")));
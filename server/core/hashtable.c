@@ -18,6 +18,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <sched.h>
 #include <hashtable.h>
 
 /**
@@ -41,10 +43,32 @@
  * the key and the value, if the actions required are different the called functions
  * must understand how to differenate the key and value.
  *
- * The hash table implements a single write, multiple reader locking policy by
- * using a pair of counters and a spinlock. The spinlock is used to protect the
- * number of readers and writers counters when taking out locks. Releasing of
- * locks uses pure atomic actions and thus does not require spinlock protection.
+ * The readers of the hash table take no locks. The writers are serialised
+ * by a spinlock and publish each change with a single pointer store, so a
+ * reader sees a chain either with or without the change. An entry that is
+ * removed is only freed once every reader that could still see it has
+ * finished. The readers announce themselves in one of two reader counts,
+ * chosen by the table epoch. A writer that needs to free memory flips the
+ * epoch, so that new readers use the other count, and waits for the count
+ * of the old epoch to drain. The reader counts are sharded, so readers on
+ * different threads do not share a cache line.
+ *
+ * The table grows when the entries outnumber the chains by HASH_LOAD_FACTOR.
+ * A new array of chains, twice the size, is published and the chains of the
+ * old array are copied to it a few at a time, by each following write, so
+ * that no single write pays for the whole resize. Until the copy completes
+ * the readers search the new array and then the old one.
+ *
+ * A table allocated with the HASHTABLE_OPEN flag uses open addressing
+ * instead, for the tables that are read on every connection. The entries
+ * are held in an array of slots and found by linear probing, the hash of
+ * each key is kept in its slot so that most probes need no call to the
+ * comparison function, and with HASHTABLE_STRING_KEYS short keys are held
+ * in the slot as well, so an entry needs no allocation of its own. A
+ * delete moves the entries that follow the slot it empties back towards
+ * their home slots, the readers detect this with a sequence count and
+ * search again. The slots are replaced by an array twice the size when
+ * they are three quarters full.
  *
  * @verbatim
  * Revision History
@@ -55,14 +79,36 @@
  * 08/01/2014	Massimiliano Pinto	Added copy and free funtion pointers for keys and values:
  *					it's possible to copy and free different data types via
  *					kcopyfn/kfreefn, vcopyfn/vfreefn
+ * 16/10/2026	agent			Lock free readers and incremental resizing
+ * 16/10/2026	agent			Open addressing tables
  *
  * @endverbatim
  */
 
-static	void hashtable_read_lock(HASHTABLE *table);
-static	void hashtable_read_unlock(HASHTABLE *table);
+#define	HASH_LOAD_FACTOR	2	/*< Entries per chain that start a resize */
+#define	HASH_MIGRATE_CHAINS	8	/*< Chains copied by each write */
+#define	HASH_OPEN_MIN_SLOTS	8	/*< The smallest array of slots */
+
+/*< Read a pointer that a writer may publish concurrently */
+#define	HASH_LOAD(p)		__atomic_load_n(&(p), ATOMIC_ACQUIRE)
+
+/*< Publish a pointer to the readers, after the data it points to */
+#define	HASH_PUBLISH(p, v)	__atomic_store_n(&(p), (v), ATOMIC_RELEASE)
+
+static	int  hashtable_read_lock(HASHTABLE *table);
+static	void hashtable_read_unlock(HASHTABLE *table, int epoch);
 static	void hashtable_write_lock(HASHTABLE *table);
 static	void hashtable_write_unlock(HASHTABLE *table);
+static	void hashtable_synchronize(HASHTABLE *table);
+static	void hashtable_migrate(HASHTABLE *table, int nchains);
+static	int  hashtable_open_alloc(HASHTABLE *table, int size);
+static	void hashtable_open_free(HASHTABLE *table);
+static	int  hashtable_open_add(HASHTABLE *table, void *key, void *value);
+static	int  hashtable_open_delete(HASHTABLE *table, void *key);
+static	void *hashtable_open_fetch(HASHTABLE *table, void *key);
+static	void hashtable_open_count(HASHTABLE *table, int *size, int *total,
+				  int *longest);
+static	void *hashtable_open_next(HASHITERATOR *iter);
 
 /**
  * Special null function used as default memory allfunctions in the hashtable
@@ -78,46 +124,100 @@ nullfn(void *data)
 	return data;
 }
 
+/**
+ * Allocate an array of empty chains
+ *
+ * @param size	The number of chains
+ * @return	The chains or NULL if no memory could be allocated
+ */
+static HASHBUCKETS *
+hashtable_buckets_alloc(int size)
+{
+HASHBUCKETS	*rval;
+
+	if ((rval = (HASHBUCKETS *)calloc(1, sizeof(HASHBUCKETS) +
+					  size * sizeof(HASHENTRIES *))) != NULL)
+		rval->size = size;
+	return rval;
+}
+
 /**
  * Allocate a new hash table
  *
- * @param size		The size of the hash table
+ * @param size		The initial size of the hash table, the table grows
+ *			as entries are added. A table of size 0 holds nothing.
  * @param hashfn	The user supplied hash function
  * @param cmpfn		The user supplied key comparison function
+ * @param flags		HASHTABLE_OPEN for an open addressing table and
+ *			HASHTABLE_STRING_KEYS if its keys are strings
  * @return The hashtable table
  */
 HASHTABLE *
-hashtable_alloc(int size, int (*hashfn)(), int (*cmpfn)())
+hashtable_alloc(int size, int (*hashfn)(), int (*cmpfn)(), int flags)
 {
 HASHTABLE 	*rval;
 
-	if ((rval = malloc(sizeof(HASHTABLE))) == NULL)
+	if ((rval = calloc(1, sizeof(HASHTABLE))) == NULL)
 		return NULL;
 
 #if defined(SS_DEBUG)
         rval->ht_chk_top = CHK_NUM_HASHTABLE;
         rval->ht_chk_tail = CHK_NUM_HASHTABLE;
 #endif
-	rval->hashsize = size;
+	rval->flags = flags;
 	rval->hashfn = hashfn;
 	rval->cmpfn = cmpfn;
 	rval->kcopyfn = nullfn;
 	rval->vcopyfn = nullfn;
 	rval->kfreefn = nullfn;
 	rval->vfreefn = nullfn;
-	rval->n_readers = 0;
-	rval->writelock = 0;
+	rval->old = NULL;
+	rval->migrated = 0;
+	rval->n_entries = 0;
+	rval->epoch = 0;
 	spinlock_init(&rval->spin);
-	if ((rval->entries = (HASHENTRIES **)calloc(size, sizeof(HASHENTRIES *))) == NULL)
+	rval->readers[0] = counter_alloc();
+	rval->readers[1] = counter_alloc();
+	if (size < 0)
+		size = 0;
+	if (rval->readers[0] == NULL || rval->readers[1] == NULL ||
+	    ((flags & HASHTABLE_OPEN) ? hashtable_open_alloc(rval, size) != 0 :
+	     (rval->buckets = hashtable_buckets_alloc(size)) == NULL))
 	{
+		counter_free(rval->readers[0]);
+		counter_free(rval->readers[1]);
 		free(rval);
 		return NULL;
 	}
-	memset(rval->entries, 0, size * sizeof(HASHENTRIES *));
 
 	return rval;
 }
 
+/**
+ * Free the entries of a chain
+ *
+ * @param table		The hash table
+ * @param entry		The first entry of the chain
+ * @param data		Free the keys and values as well as the entries
+ */
+static void
+hashtable_free_chain(HASHTABLE *table, HASHENTRIES *entry, int data)
+{
+HASHENTRIES	*ptr;
+
+	while (entry)
+	{
+		ptr = entry->next;
+		if (data)
+		{
+			table->kfreefn(entry->key);
+			table->vfreefn(entry->value);
+		}
+		free(entry);
+		entry = ptr;
+	}
+}
+
 /**
  * Delete an entire hash table
  *
@@ -127,22 +227,29 @@ void
 hashtable_free(HASHTABLE *table)
 {
 int		i;
-HASHENTRIES	*entry, *ptr;
 
 	hashtable_write_lock(table);
-	for (i = 0; i < table->hashsize; i++)
+	if (table->flags & HASHTABLE_OPEN)
 	{
-		entry = table->entries[i];
-		while (entry)
-		{
-			ptr = entry->next;
-			table->kfreefn(entry->key);
-			table->vfreefn(entry->value);
-			free(entry);
-			entry = ptr;
-		}
+		hashtable_open_free(table);
+		counter_free(table->readers[0]);
+		counter_free(table->readers[1]);
+		free(table);
+		return;
 	}
-	free(table->entries);
+	for (i = 0; i < table->buckets->size; i++)
+		hashtable_free_chain(table, table->buckets->chains[i], 1);
+	if (table->old)
+	{
+		/*< The chains that have been copied hold the same data */
+		for (i = 0; i < table->old->size; i++)
+			hashtable_free_chain(table, table->old->chains[i],
+					     i >= table->migrated);
+		free(table->old);
+	}
+	free(table->buckets);
+	counter_free(table->readers[0]);
+	counter_free(table->readers[1]);
 	free(table);
 }
 
@@ -170,6 +277,64 @@ hashtable_memory_fns(HASHTABLE *table, HASHMEMORYFN kcopyfn, HASHMEMORYFN vcopyf
 		table->vfreefn = vfreefn;
 }
 
+/**
+ * Name the lock of a hash table, the tables of the same name are shown as
+ * one lock class, "hashtable:<name>", in the lock profile.
+ *
+ * @param table		The hash table
+ * @param name		The name of the table
+ */
+void
+hashtable_set_name(HASHTABLE *table, const char *name)
+{
+char	buf[80];
+
+	snprintf(buf, sizeof(buf), "hashtable:%s", name);
+	spinlock_set_class(&table->spin, spinlock_class(buf));
+}
+
+/**
+ * Find the entry with a given key in an array of chains
+ *
+ * @param table		The hash table
+ * @param buckets	The array of chains
+ * @param hash		The hash of the key
+ * @param key		The key
+ * @return		The entry or NULL if the key is not in the chains
+ */
+static HASHENTRIES *
+hashtable_find(HASHTABLE *table, HASHBUCKETS *buckets, unsigned int hash,
+	       void *key)
+{
+HASHENTRIES	*entry;
+
+	entry = HASH_LOAD(buckets->chains[hash % buckets->size]);
+	while (entry && table->cmpfn(key, entry->key) != 0)
+		entry = HASH_LOAD(entry->next);
+	return entry;
+}
+
+/**
+ * Start to grow the table, the chains are copied to the new array by the
+ * writes that follow.
+ *
+ * NB This is called with the caller holding the write lock
+ *
+ * @param table		The hash table
+ */
+static void
+hashtable_grow(HASHTABLE *table)
+{
+HASHBUCKETS	*buckets;
+
+	if ((buckets = hashtable_buckets_alloc(table->buckets->size * 2)) == NULL)
+		return;
+	table->migrated = 0;
+	HASH_PUBLISH(table->old, table->buckets);
+	HASH_PUBLISH(table->buckets, buckets);
+	table->n_resizes++;
+}
+
 /**
  * Add an item to the hash table.
  *
@@ -181,43 +346,68 @@ hashtable_memory_fns(HASHTABLE *table, HASHMEMORYFN kcopyfn, HASHMEMORYFN vcopyf
 int
 hashtable_add(HASHTABLE *table, void *key, void *value)
 {
-        int		hashkey;
-        HASHENTRIES	*entry;
+unsigned int	hash;
+HASHBUCKETS	*buckets;
+HASHENTRIES	*ptr;
 
-        if (table->hashsize <= 0) {            
-            return 0;
-        } else {
-            hashkey = table->hashfn(key) % table->hashsize;
-        }
+	if (table->flags & HASHTABLE_OPEN)
+		return hashtable_open_add(table, key, value);
+	if (table->buckets->size <= 0)
+		return 0;
+	hash = (unsigned int)table->hashfn(key);
 	hashtable_write_lock(table);
-	entry = table->entries[hashkey % table->hashsize];
-	while (entry && table->cmpfn(key, entry->key) != 0)
-	{
-		entry = entry->next;
-	}
-	if (entry && table->cmpfn(key, entry->key) == 0)
+	hashtable_migrate(table, HASH_MIGRATE_CHAINS);
+	buckets = table->buckets;
+	if (hashtable_find(table, buckets, hash, key) != NULL ||
+	    (table->old && hashtable_find(table, table->old, hash, key) != NULL))
 	{
 		/* Duplicate key value */
 		hashtable_write_unlock(table);
 		return 0;
 	}
-	else
+	if ((ptr = (HASHENTRIES *)malloc(sizeof(HASHENTRIES))) == NULL)
 	{
-		HASHENTRIES	*ptr = (HASHENTRIES *)malloc(sizeof(HASHENTRIES));
-		if (ptr == NULL)
-		{
-			hashtable_write_unlock(table);
-			return 0;
-		}
-		ptr->key = table->kcopyfn(key);
-		ptr->value = table->vcopyfn(value);
-		ptr->next = table->entries[hashkey % table->hashsize];
-		table->entries[hashkey % table->hashsize] = ptr;
+		hashtable_write_unlock(table);
+		return 0;
 	}
+	ptr->key = table->kcopyfn(key);
+	ptr->value = table->vcopyfn(value);
+	ptr->next = buckets->chains[hash % buckets->size];
+	HASH_PUBLISH(buckets->chains[hash % buckets->size], ptr);
+	table->n_entries++;
+	if (table->old == NULL &&
+	    table->n_entries > buckets->size * HASH_LOAD_FACTOR)
+		hashtable_grow(table);
 	hashtable_write_unlock(table);
 	return 1;
 }
 
+/**
+ * Unlink the entry with a given key from an array of chains, the entry is
+ * not freed.
+ *
+ * NB This is called with the caller holding the write lock
+ *
+ * @param table		The hash table
+ * @param buckets	The array of chains
+ * @param hash		The hash of the key
+ * @param key		The key
+ * @return		The entry or NULL if the key is not in the chains
+ */
+static HASHENTRIES *
+hashtable_unlink(HASHTABLE *table, HASHBUCKETS *buckets, unsigned int hash,
+		 void *key)
+{
+HASHENTRIES	**pptr, *entry;
+
+	pptr = &buckets->chains[hash % buckets->size];
+	while ((entry = *pptr) != NULL && table->cmpfn(key, entry->key) != 0)
+		pptr = &entry->next;
+	if (entry)
+		HASH_PUBLISH(*pptr, entry->next);
+	return entry;
+}
+
 /**
  * Delete an item from the hash table that has a given key
  *
@@ -228,14 +418,26 @@ hashtable_add(HASHTABLE *table, void *key, void *value)
 int
 hashtable_delete(HASHTABLE *table, void *key)
 {
-int		hashkey = table->hashfn(key) % table->hashsize;
-HASHENTRIES	*entry, *ptr;
+unsigned int	hash;
+HASHENTRIES	*entry, *copy = NULL;
 
+	if (table->flags & HASHTABLE_OPEN)
+		return hashtable_open_delete(table, key);
+	if (table->buckets->size <= 0)
+		return 0;
+	hash = (unsigned int)table->hashfn(key);
 	hashtable_write_lock(table);
-	entry = table->entries[hashkey % table->hashsize];
-	while (entry && entry->key && table->cmpfn(key, entry->key) != 0)
+	hashtable_migrate(table, HASH_MIGRATE_CHAINS);
+	entry = hashtable_unlink(table, table->buckets, hash, key);
+	if (table->old)
 	{
-		entry = entry->next;
+		/*< A chain that has been copied holds the entry twice */
+		copy = hashtable_unlink(table, table->old, hash, key);
+		if (entry == NULL)
+		{
+			entry = copy;
+			copy = NULL;
+		}
 	}
 	if (entry == NULL)
 	{
@@ -243,38 +445,14 @@ HASHENTRIES	*entry, *ptr;
 		hashtable_write_unlock(table);
 		return 0;
 	}
+	table->n_entries--;
 
-	if (entry == table->entries[hashkey % table->hashsize])
-	{
-		/* We are removing from the first entry */
-		table->entries[hashkey % table->hashsize] = entry->next;
-		table->kfreefn(entry->key);
-		table->vfreefn(entry->value);
-
-                if (entry->next != NULL) {
-                    entry->key = entry->next->key;
-                    entry->value = entry->next->value;
-                } else {
-                    entry->key = NULL;
-                    entry->value = NULL;
-                }
-		free(entry);
-	}
-	else
-	{
-		ptr = table->entries[hashkey % table->hashsize];
-		while (ptr && ptr->next != entry)
-			ptr = ptr->next;
-		if (ptr == NULL)
-		{
-			hashtable_write_unlock(table);
-			return 0;	/* This should never happen */
-		}
-		ptr->next = entry->next;
-		table->kfreefn(entry->key);
-		table->vfreefn(entry->value);
-		free(entry);
-	}
+	/*< Readers that found the entry may still be looking at it */
+	hashtable_synchronize(table);
+	table->kfreefn(entry->key);
+	table->vfreefn(entry->value);
+	free(entry);
+	free(copy);
 	hashtable_write_unlock(table);
 	return 1;
 }
@@ -289,59 +467,105 @@ HASHENTRIES	*entry, *ptr;
 void *
 hashtable_fetch(HASHTABLE *table, void *key)
 {
-int		hashkey = table->hashfn(key) % table->hashsize;
-HASHENTRIES	*entry;
+unsigned int	hash;
+HASHBUCKETS	*buckets;
+HASHENTRIES	*entry = NULL;
+void		*rval = NULL;
+int		epoch;
 
-	hashtable_read_lock(table);
-	entry = table->entries[hashkey % table->hashsize];
-	while (entry && entry->key && table->cmpfn(key, entry->key) != 0)
+	if (table->flags & HASHTABLE_OPEN)
+		return hashtable_open_fetch(table, key);
+	hash = (unsigned int)table->hashfn(key);
+	epoch = hashtable_read_lock(table);
+	buckets = HASH_LOAD(table->buckets);
+	if (buckets->size > 0)
 	{
-		entry = entry->next;
-	}
-	if (entry == NULL)
-	{
-		hashtable_read_unlock(table);
-		return NULL;
-	}
-	else
-	{
-		hashtable_read_unlock(table);
-		return entry->value;
+		entry = hashtable_find(table, buckets, hash, key);
+		/*< Whilst the table grows an entry may only be in the old chains */
+		if (entry == NULL && (buckets = HASH_LOAD(table->old)) != NULL)
+			entry = hashtable_find(table, buckets, hash, key);
 	}
+	if (entry)
+		rval = entry->value;
+	hashtable_read_unlock(table, epoch);
+	return rval;
 }
 
 /**
- * Print hash table statistics to the standard output
+ * Complete a resize that is in progress, so that all of the entries are
+ * in the current chains.
  *
  * @param table		The hash table
  */
-void
-hashtable_stats(HASHTABLE *table)
+static void
+hashtable_settle(HASHTABLE *table)
 {
-int		total, longest, i, j;
+	if (HASH_LOAD(table->old) == NULL)
+		return;
+	hashtable_write_lock(table);
+	hashtable_migrate(table, INT_MAX);
+	hashtable_write_unlock(table);
+}
+
+/**
+ * Count the entries and the longest chain of the hash table
+ *
+ * @param table		The hash table
+ * @param size		Set to the number of chains
+ * @param total		Set to the number of entries
+ * @param longest	Set to the length of the longest chain
+ */
+static void
+hashtable_count(HASHTABLE *table, int *size, int *total, int *longest)
+{
+HASHBUCKETS	*buckets;
 HASHENTRIES	*entries;
+int		i, j, epoch;
 
-	printf("Hashtable: %p, size %d\n", table, table->hashsize);
-	total = 0;
-	longest = 0;
-	hashtable_read_lock(table);
-	for (i = 0; i < table->hashsize; i++)
+	if (table->flags & HASHTABLE_OPEN)
+	{
+		hashtable_open_count(table, size, total, longest);
+		return;
+	}
+	hashtable_settle(table);
+	*total = 0;
+	*longest = 0;
+	epoch = hashtable_read_lock(table);
+	buckets = HASH_LOAD(table->buckets);
+	for (i = 0; i < buckets->size; i++)
 	{
 		j = 0;
-		entries = table->entries[i];
+		entries = HASH_LOAD(buckets->chains[i]);
 		while (entries)
 		{
 			j++;
-			entries = entries->next;
+			entries = HASH_LOAD(entries->next);
 		}
-		total += j;
-		if (j > longest)
-			longest = j;
+		*total += j;
+		if (j > *longest)
+			*longest = j;
 	}
-	hashtable_read_unlock(table);
+	*size = buckets->size;
+	hashtable_read_unlock(table, epoch);
+}
+
+/**
+ * Print hash table statistics to the standard output
+ *
+ * @param table		The hash table
+ */
+void
+hashtable_stats(HASHTABLE *table)
+{
+int		size, total, longest;
+
+	hashtable_count(table, &size, &total, &longest);
+	printf("Hashtable: %p, size %d\n", table, size);
 	printf("\tNo. of entries:     	%d\n", total);
-	printf("\tAverage chain length:	%.1f\n", (float)total / table->hashsize);
+	printf("\tAverage chain length:	%.1f\n",
+	       size ? (float)total / size : 0.0);
 	printf("\tLongest chain length:	%d\n", longest);
+	printf("\tNo. of resizes:     	%d\n", table->n_resizes);
 }
 
 /** 
@@ -371,110 +595,559 @@ void hashtable_get_stats(
         int*  longest)
 {
         HASHTABLE*   ht;
-        HASHENTRIES* entries;
-        int          i;
-        int          j;
+        int          total;
+        int          chain;
 
         ht = (HASHTABLE *)table;
         CHK_HASHTABLE(ht);
-        
-	hashtable_read_lock(ht);
-        
-	for (i = 0; i < ht->hashsize; i++)
+
+        hashtable_count(ht, hashsize, &total, &chain);
+        *nelems += total;
+        if (chain > *longest) {
+                *longest = chain;
+        }
+}
+
+/**
+ * Copy chains of the old array to the current one, the entries of the old
+ * chains stay in place for the readers that are still walking them. When
+ * the last chain has been copied the old array is retired.
+ *
+ * NB This is called with the caller holding the write lock
+ *
+ * @param table		The hash table
+ * @param nchains	The maximum number of chains to copy
+ */
+static void
+hashtable_migrate(HASHTABLE *table, int nchains)
+{
+HASHBUCKETS	*old = table->old, *buckets = table->buckets;
+HASHENTRIES	*entry, *copy, *copies, *next;
+unsigned int	idx;
+int		i;
+
+	if (old == NULL)
+		return;
+	while (nchains-- > 0 && table->migrated < old->size)
 	{
-		j = 0;
-		entries = ht->entries[i];
-		while (entries)
+		/*< Copy the whole chain before any of it is published */
+		copies = NULL;
+		for (entry = old->chains[table->migrated]; entry; entry = entry->next)
 		{
-			j++;
-			entries = entries->next;
+			if ((copy = (HASHENTRIES *)malloc(sizeof(HASHENTRIES))) == NULL)
+			{
+				hashtable_free_chain(table, copies, 0);
+				return;
+			}
+			copy->key = entry->key;
+			copy->value = entry->value;
+			copy->next = copies;
+			copies = copy;
 		}
-		*nelems += j;
-		if (j > *longest) {
-			*longest = j;
-                }
+		for (copy = copies; copy; copy = next)
+		{
+			next = copy->next;
+			idx = (unsigned int)table->hashfn(copy->key) % buckets->size;
+			copy->next = buckets->chains[idx];
+			HASH_PUBLISH(buckets->chains[idx], copy);
+		}
+		table->migrated++;
 	}
-        *hashsize = ht->hashsize;
-	hashtable_read_unlock(ht);
+	if (table->migrated < old->size)
+		return;
+
+	/*< Every entry is in the current chains, the old ones can go */
+	HASH_PUBLISH(table->old, NULL);
+	hashtable_synchronize(table);
+	for (i = 0; i < old->size; i++)
+		hashtable_free_chain(table, old->chains[i], 0);
+	free(old);
 }
 
+/**
+ * Return the hash of a key for an open table. The hash of the user is
+ * mixed, the slot is chosen by the low bits of the hash and a weak hash
+ * would otherwise fill runs of neighbouring slots.
+ *
+ * @param table		The hash table
+ * @param key		The key
+ * @return		The hash of the key
+ */
+static unsigned int
+hashtable_open_hash(HASHTABLE *table, void *key)
+{
+unsigned int	hash = (unsigned int)table->hashfn(key);
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+	return hash;
+}
 
 /**
- * Take a read lock on the hashtable.
+ * Allocate an array of empty slots
  *
- * The hashtable support multiple readers and a single writer,
- * we have a spinlock to protect the two counts, n_readers and
- * writelock.
+ * @param nslots	The number of slots, a power of two
+ * @return		The slots or NULL if no memory could be allocated
+ */
+static HASHSLOTS *
+hashtable_slots_alloc(unsigned int nslots)
+{
+HASHSLOTS	*rval;
+size_t		size = sizeof(HASHSLOTS) + nslots * sizeof(HASHSLOT);
+
+	if (posix_memalign((void **)&rval, 64, size) != 0)
+		return NULL;
+	memset(rval, 0, size);
+	rval->mask = nslots - 1;
+	return rval;
+}
+
+/**
+ * Create the slots of an open table, enough to hold the requested number
+ * of entries without growing. A table of size 0 has no slots and holds
+ * nothing.
  *
- * We take the hashtable spinlock and then check that writelock
- * is set to zero. If not we release the spinlock and do dirty
- * reads of writelock until it goes to 0. Once it is zero we
- * acquire the spinlock again and test that writelock is still
- * 0.
+ * @param table		The hash table
+ * @param size		The number of entries
+ * @return		0 on success, -1 if no memory could be allocated
+ */
+static int
+hashtable_open_alloc(HASHTABLE *table, int size)
+{
+unsigned int	nslots = HASH_OPEN_MIN_SLOTS;
+
+	table->slots = NULL;
+	table->seq = 0;
+	if (size <= 0)
+		return 0;
+	while (nslots - nslots / 4 < (unsigned int)size)
+		nslots <<= 1;
+	return (table->slots = hashtable_slots_alloc(nslots)) == NULL ? -1 : 0;
+}
+
+/**
+ * Free the entries and the slots of an open table
  *
- * With writelock set to zero we increment n_readers with the
- * spinlock still held.
+ * NB This is called with the caller holding the write lock
  *
- * @param table		The hashtable to lock.
+ * @param table		The hash table
  */
 static void
-hashtable_read_lock(HASHTABLE *table)
+hashtable_open_free(HASHTABLE *table)
 {
-	spinlock_acquire(&table->spin);
-	while (table->writelock)
+HASHSLOT	*slot;
+unsigned int	i;
+
+	if (table->slots == NULL)
+		return;
+	for (i = 0; i <= table->slots->mask; i++)
 	{
-		spinlock_release(&table->spin);
-		while (table->writelock)
-			;
-		spinlock_acquire(&table->spin);
+		slot = &table->slots->slot[i];
+		if (slot->key == NULL)
+			continue;
+		if (slot->key != slot->ikey)
+			table->kfreefn(slot->key);
+		table->vfreefn(slot->value);
 	}
-	table->n_readers++;
-	spinlock_release(&table->spin);
+	free(table->slots);
+}
+
+/**
+ * Move the entry of a slot to an empty slot
+ *
+ * NB This is called with the caller holding the write lock
+ *
+ * @param dst	The empty slot
+ * @param src	The slot to move
+ */
+static void
+hashtable_slot_move(HASHSLOT *dst, HASHSLOT *src)
+{
+	dst->hash = src->hash;
+	memcpy(dst->ikey, src->ikey, HASH_INLINE_KEY);
+	HASH_PUBLISH(dst->value, src->value);
+	HASH_PUBLISH(dst->key, src->key == src->ikey ? dst->ikey : src->key);
+}
+
+/**
+ * Find the slot of a key
+ *
+ * @param table		The hash table
+ * @param slots		The slots to search
+ * @param hash		The hash of the key
+ * @param key		The key
+ * @return		The slot or NULL if the key is not in the table
+ */
+static HASHSLOT *
+hashtable_open_find(HASHTABLE *table, HASHSLOTS *slots, unsigned int hash,
+		    void *key)
+{
+HASHSLOT	*slot;
+unsigned int	idx = hash & slots->mask;
+void		*skey;
+
+	for (;;)
+	{
+		slot = &slots->slot[idx];
+		if ((skey = HASH_LOAD(slot->key)) == NULL)
+			return NULL;
+		if (slot->hash == hash && table->cmpfn(key, skey) == 0)
+			return slot;
+		idx = (idx + 1) & slots->mask;
+	}
+}
+
+/**
+ * Replace the slots of an open table by an array twice the size
+ *
+ * NB This is called with the caller holding the write lock
+ *
+ * @param table		The hash table
+ * @return		0 on success, -1 if no memory could be allocated
+ */
+static int
+hashtable_open_grow(HASHTABLE *table)
+{
+HASHSLOTS	*old = table->slots, *slots;
+unsigned int	i, idx;
+
+	if ((slots = hashtable_slots_alloc((old->mask + 1) * 2)) == NULL)
+		return -1;
+	for (i = 0; i <= old->mask; i++)
+	{
+		if (old->slot[i].key == NULL)
+			continue;
+		idx = old->slot[i].hash & slots->mask;
+		while (slots->slot[idx].key != NULL)
+			idx = (idx + 1) & slots->mask;
+		hashtable_slot_move(&slots->slot[idx], &old->slot[i]);
+	}
+	HASH_PUBLISH(table->slots, slots);
+	table->n_resizes++;
+
+	/*< The old slots are left untouched for the readers still using them */
+	hashtable_synchronize(table);
+	free(old);
+	return 0;
+}
+
+/**
+ * Add an item to an open table
+ *
+ * @param table		The hash table to which to add the item
+ * @param key		The key of the item
+ * @param value		The value for the item
+ * @return	Return the number of items added
+ */
+static int
+hashtable_open_add(HASHTABLE *table, void *key, void *value)
+{
+unsigned int	hash, idx, nslots;
+HASHSLOTS	*slots;
+HASHSLOT	*slot;
+
+	if (table->slots == NULL)
+		return 0;
+	hash = hashtable_open_hash(table, key);
+	hashtable_write_lock(table);
+	nslots = table->slots->mask + 1;
+	if (table->n_entries + 1 > nslots - nslots / 4 &&
+	    hashtable_open_grow(table) != 0 &&
+	    table->n_entries + 1 >= nslots)
+	{
+		/*< The last slot is kept empty, it ends every probe */
+		hashtable_write_unlock(table);
+		return 0;
+	}
+	slots = table->slots;
+	if (hashtable_open_find(table, slots, hash, key) != NULL)
+	{
+		/* Duplicate key value */
+		hashtable_write_unlock(table);
+		return 0;
+	}
+	idx = hash & slots->mask;
+	while (slots->slot[idx].key != NULL)
+		idx = (idx + 1) & slots->mask;
+	slot = &slots->slot[idx];
+	slot->hash = hash;
+	slot->value = table->vcopyfn(value);
+	if ((table->flags & HASHTABLE_STRING_KEYS) &&
+	    strlen((char *)key) < HASH_INLINE_KEY)
+	{
+		memset(slot->ikey, 0, HASH_INLINE_KEY);
+		strcpy(slot->ikey, (char *)key);
+		HASH_PUBLISH(slot->key, slot->ikey);
+	}
+	else
+	{
+		HASH_PUBLISH(slot->key, table->kcopyfn(key));
+	}
+	table->n_entries++;
+	hashtable_write_unlock(table);
+	return 1;
+}
+
+/**
+ * Delete an item from an open table. The entries that follow the slot
+ * that is emptied are moved back, so that no probe ends before it reaches
+ * them.
+ *
+ * @param table		The hash table to delete from
+ * @param key		The key value of the item to remove
+ * @return Return the number of items deleted
+ */
+static int
+hashtable_open_delete(HASHTABLE *table, void *key)
+{
+unsigned int	hash, i, j, home;
+HASHSLOTS	*slots;
+HASHSLOT	*slot;
+void		*skey, *value;
+
+	if (table->slots == NULL)
+		return 0;
+	hash = hashtable_open_hash(table, key);
+	hashtable_write_lock(table);
+	slots = table->slots;
+	if ((slot = hashtable_open_find(table, slots, hash, key)) == NULL)
+	{
+		/* Not found */
+		hashtable_write_unlock(table);
+		return 0;
+	}
+	skey = slot->key == slot->ikey ? NULL : slot->key;
+	value = slot->value;
+
+	/*< The readers search again if they overlap the moves */
+	atomic_store_int(&table->seq, table->seq + 1, ATOMIC_RELAXED);
+	__atomic_thread_fence(ATOMIC_RELEASE);
+	i = j = slot - slots->slot;
+	for (;;)
+	{
+		j = (j + 1) & slots->mask;
+		if (slots->slot[j].key == NULL)
+			break;
+		home = slots->slot[j].hash & slots->mask;
+		if (((j - home) & slots->mask) >= ((j - i) & slots->mask))
+		{
+			hashtable_slot_move(&slots->slot[i], &slots->slot[j]);
+			i = j;
+		}
+	}
+	HASH_PUBLISH(slots->slot[i].key, NULL);
+	atomic_store_int(&table->seq, table->seq + 1, ATOMIC_RELEASE);
+	table->n_entries--;
+
+	/*< Readers may still be comparing with the key */
+	hashtable_synchronize(table);
+	if (skey)
+		table->kfreefn(skey);
+	table->vfreefn(value);
+	hashtable_write_unlock(table);
+	return 1;
+}
+
+/**
+ * Fetch an item with a given key value from an open table
+ *
+ * @param table		The hash table
+ * @param key		The key value
+ * @return The item or NULL if the item was not found
+ */
+static void *
+hashtable_open_fetch(HASHTABLE *table, void *key)
+{
+unsigned int	hash = hashtable_open_hash(table, key);
+HASHSLOTS	*slots;
+HASHSLOT	*slot;
+void		*rval;
+int		epoch, seq;
+
+	epoch = hashtable_read_lock(table);
+	for (;;)
+	{
+		rval = NULL;
+		seq = atomic_load_int(&table->seq, ATOMIC_ACQUIRE);
+		if ((slots = HASH_LOAD(table->slots)) == NULL)
+			break;
+		if ((seq & 1) == 0)
+		{
+			if ((slot = hashtable_open_find(table, slots, hash, key)) != NULL)
+				rval = HASH_LOAD(slot->value);
+			__atomic_thread_fence(ATOMIC_ACQUIRE);
+			if (atomic_load_int(&table->seq, ATOMIC_RELAXED) == seq)
+				break;
+		}
+		/*< A delete moved the slots whilst we searched them */
+		sched_yield();
+	}
+	hashtable_read_unlock(table, epoch);
+	return rval;
+}
+
+/**
+ * Count the entries and the longest probe of an open table
+ *
+ * @param table		The hash table
+ * @param size		Set to the number of slots
+ * @param total		Set to the number of entries
+ * @param longest	Set to the length of the longest probe
+ */
+static void
+hashtable_open_count(HASHTABLE *table, int *size, int *total, int *longest)
+{
+HASHSLOTS	*slots;
+HASHSLOT	*slot;
+unsigned int	i, probe;
+int		epoch;
+
+	*size = 0;
+	*total = 0;
+	*longest = 0;
+	epoch = hashtable_read_lock(table);
+	if ((slots = HASH_LOAD(table->slots)) != NULL)
+	{
+		*size = slots->mask + 1;
+		for (i = 0; i <= slots->mask; i++)
+		{
+			slot = &slots->slot[i];
+			if (HASH_LOAD(slot->key) == NULL)
+				continue;
+			(*total)++;
+			probe = ((i - slot->hash) & slots->mask) + 1;
+			if (probe > (unsigned int)*longest)
+				*longest = probe;
+		}
+	}
+	hashtable_read_unlock(table, epoch);
 }
 
 /**
- * Release a previously obtained readlock.
+ * Return the next key for an iterator on an open table. The string keys
+ * are copied whilst the slots can not be freed, a key held in a slot is
+ * overwritten when a delete moves the slot.
  *
- * Simply decrement the n_readers value for the hash table
+ * @param iter	The hashtable iterator
+ * @return	The next key value or NULL
+ */
+static void *
+hashtable_open_next(HASHITERATOR *iter)
+{
+HASHTABLE	*table = iter->table;
+HASHSLOTS	*slots;
+void		*rval;
+char		*copy;
+int		epoch, seq, chain;
+
+	free(iter->key);
+	iter->key = NULL;
+	epoch = hashtable_read_lock(table);
+	for (;;)
+	{
+		rval = NULL;
+		copy = NULL;
+		chain = iter->chain;
+		seq = atomic_load_int(&table->seq, ATOMIC_ACQUIRE);
+		if ((slots = HASH_LOAD(table->slots)) == NULL)
+			break;
+		if ((seq & 1) == 0)
+		{
+			while (rval == NULL && chain <= (int)slots->mask)
+				rval = HASH_LOAD(slots->slot[chain++].key);
+			if (rval && (table->flags & HASHTABLE_STRING_KEYS))
+				copy = strdup((char *)rval);
+			__atomic_thread_fence(ATOMIC_ACQUIRE);
+			if (atomic_load_int(&table->seq, ATOMIC_RELAXED) == seq)
+				break;
+			free(copy);
+		}
+		/*< A delete moved the slots whilst we read them */
+		sched_yield();
+	}
+	hashtable_read_unlock(table, epoch);
+	iter->chain = chain;
+	if (copy)
+		rval = iter->key = copy;
+	else if (rval && (table->flags & HASHTABLE_STRING_KEYS))
+		rval = NULL;	/*< No memory for the copy */
+	return rval;
+}
+
+/**
+ * Enter a read side critical section of the hashtable, the entries that
+ * can be seen are not freed until the section is left.
+ *
+ * The reader is counted in the reader count of the current epoch. If the
+ * epoch changed before the reader was counted the writer that changed it
+ * may not have seen the reader, so the reader tries again.
+ *
+ * @param table		The hashtable to lock.
+ * @return		The epoch to pass to hashtable_read_unlock
+ */
+static int
+hashtable_read_lock(HASHTABLE *table)
+{
+int	epoch;
+
+	for (;;)
+	{
+		epoch = atomic_load_int(&table->epoch, ATOMIC_RELAXED);
+		counter_inc(table->readers[epoch]);
+		__atomic_thread_fence(ATOMIC_SEQ_CST);
+		if (atomic_load_int(&table->epoch, ATOMIC_RELAXED) == epoch)
+			return epoch;
+		counter_dec(table->readers[epoch]);
+	}
+}
+
+/**
+ * Leave a read side critical section of the hashtable
  *
  * @param table		The hash table to unlock
+ * @param epoch		The epoch returned by hashtable_read_lock
  */
 static void
-hashtable_read_unlock(HASHTABLE *table)
+hashtable_read_unlock(HASHTABLE *table, int epoch)
 {
-	atomic_add(&table->n_readers, -1);
+	__atomic_thread_fence(ATOMIC_RELEASE);
+	counter_dec(table->readers[epoch]);
 }
 
 /**
- * Obtain an exclusive write lock for the hash table.
+ * Wait until no reader can see the entries that have been unlinked. New
+ * readers are sent to the other reader count and the current count is
+ * left to drain.
  *
- * We acquire the hashtable spinlock, check for the number of
- * readers beign zero. If it is not we hold the spinlock and
- * loop waiting for the n_readers to reach zero. This will prevent
- * any new readers beign granted access but will not prevent current
- * readers releasing the read lock.
+ * NB This is called with the caller holding the write lock
  *
- * Once we have no readers we increment writelock and test if we are
- * the only writelock holder, if not we repeat the process. We hold
- * the spinlock throughout the process since both read and write
- * locks do not require the spinlock to be acquired.
+ * @param table		The hash table
+ */
+static void
+hashtable_synchronize(HASHTABLE *table)
+{
+int	epoch = table->epoch;
+
+	atomic_store_int(&table->epoch, epoch ^ 1, ATOMIC_RELAXED);
+	__atomic_thread_fence(ATOMIC_SEQ_CST);
+	while (counter_read(table->readers[epoch]) != 0)
+		sched_yield();
+	__atomic_thread_fence(ATOMIC_ACQUIRE);
+}
+
+/**
+ * Obtain an exclusive write lock for the hash table, the writers exclude
+ * each other but not the readers.
  *
  * @param table	The table to lock for updates
  */
 static void
 hashtable_write_lock(HASHTABLE *table)
 {
-int	available;
-
 	spinlock_acquire(&table->spin);
-	do {
-		while (table->n_readers)
-			;
-		available = atomic_add(&table->writelock, 1);
-		if (available != 0)
-			atomic_add(&table->writelock, -1);
-	} while (available != 0);
-	spinlock_release(&table->spin);
 }
 
 /**
@@ -485,7 +1158,7 @@ int	available;
 static void
 hashtable_write_unlock(HASHTABLE *table)
 {
-	atomic_add(&table->writelock, -1);
+	spinlock_release(&table->spin);
 }
 
 /**
@@ -501,15 +1174,20 @@ HASHITERATOR	*rval;
 
 	if ((rval = (HASHITERATOR *)malloc(sizeof(HASHITERATOR))) != NULL)
 	{
+		/*< The iterator walks the current chains only */
+		hashtable_settle(table);
 		rval->table = table;
 		rval->chain = 0;
 		rval->depth = -1;
+		rval->key = NULL;
 	}
 	return rval;
 }
 
 /**
- * Return the next key for a hashtable iterator
+ * Return the next key for a hashtable iterator. The key is valid until it
+ * is deleted, for an open table with string keys the key is a copy that is
+ * valid until the next call or until the iterator is freed.
  *
  * @param iter	The hashtable iterator
  * @return	The next key value or NULL
@@ -517,29 +1195,37 @@ HASHITERATOR	*rval;
 void *
 hashtable_next(HASHITERATOR *iter)
 {
-int		i;
+int		i, epoch;
+HASHBUCKETS	*buckets;
 HASHENTRIES	*entries;
+void		*rval = NULL;
 
+	if (iter->table->flags & HASHTABLE_OPEN)
+		return hashtable_open_next(iter);
 	iter->depth++;
-	while (iter->chain < iter->table->hashsize)
+	epoch = hashtable_read_lock(iter->table);
+	buckets = HASH_LOAD(iter->table->buckets);
+	while (iter->chain < buckets->size)
 	{
-		if ((entries = iter->table->entries[iter->chain]) != NULL)
+		if ((entries = HASH_LOAD(buckets->chains[iter->chain])) != NULL)
 		{
 			i = 0;
-			hashtable_read_lock(iter->table);
 			while (entries && i < iter->depth)
 			{
-				entries = entries->next;
+				entries = HASH_LOAD(entries->next);
 				i++;
 			}
-			hashtable_read_unlock(iter->table);
 			if (entries)
-				return entries->key;
+			{
+				rval = entries->key;
+				break;
+			}
 		}
 		iter->depth = 0;
 		iter->chain++;
 	}
-	return NULL;
+	hashtable_read_unlock(iter->table, epoch);
+	return rval;
 }
 
 /**
@@ -550,5 +1236,6 @@ HASHENTRIES	*entries;
 void
 hashtable_iterator_free(HASHITERATOR *iter)
 {
+	free(iter->key);
 	free(iter);
 }
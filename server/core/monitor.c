@@ -39,7 +39,8 @@
 extern int lm_enabled_logfiles_bitmask;
 
 static MONITOR	*allMonitors = NULL;
-static SPINLOCK	monLock = SPINLOCK_INIT;
+static SPINLOCK_CLASS monitor_class = SPINLOCK_CLASS_INIT("monLock");
+static SPINLOCK	monLock = SPINLOCK_INIT_CLASS(&monitor_class);
 
 /**
  * Allocate a new monitor, load the associated module for the monitor
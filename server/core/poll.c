@@ -19,17 +19,34 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/poll.h>
+#include <sys/resource.h>
 #include <errno.h>
+#include <signal.h>
+#include <pthread.h>
 #include <poll.h>
 #include <dcb.h>
+#include <session.h>
+#include <config.h>
 #include <atomic.h>
 #include <gwbitmask.h>
+#include <uring.h>
+#include <thread.h>
+#include <timer.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
 
 extern int lm_enabled_logfiles_bitmask;
 
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE	(1u << 28)
+#endif
+
 /**
  * @file poll.c  - Abstraction of the epoll functionality
  *
@@ -44,48 +61,393 @@ extern int lm_enabled_logfiles_bitmask;
  * @endverbatim
  */
 
-static	int		epoll_fd = -1;	  /*< The epoll file descriptor */
+static	int		*epoll_fds = NULL; /*< The epoll file descriptors */
+static	int		n_epoll = 0;	  /*< Number of epoll sets in use */
+static	int		n_threads = 1;	  /*< Number of polling threads */
+static	int		next_thread = 0;  /*< Round robin counter for new DCBs */
 static	int		shutdown = 0;	  /*< Flag the shutdown of the poll subsystem */
 static	GWBITMASK	poll_mask;
 static  simple_mutex_t  epoll_wait_mutex; /*< serializes calls to epoll_wait */
 
 /**
- * The polling statistics
+ * The per thread wakeup mechanism, an eventfd that is registered in the
+ * epoll set or io_uring the thread waits on.
+ *
+ * An eventfd in a shared epoll set may be consumed by any of the threads,
+ * so when the threads share a set they are instead woken by sending the
+ * thread POLL_WAKEUP_SIGNAL. The signal is blocked by the polling threads
+ * except whilst they are in epoll_pwait, a signal sent just before the
+ * thread blocks is therefore held until the wait and ends it at once.
+ */
+#define	POLL_WAKEUP_SIGNAL	SIGUSR2
+
+typedef struct {
+	int		fd;		/*< The eventfd used to wake the thread */
+	pthread_t	thread;		/*< The thread, for signal wakeups */
+	int		sleeping;	/*< The thread is, or is about to be, in epoll_wait */
+	int		pending;	/*< Work has been posted for the thread */
+	POLL_TASK	*tasks;		/*< Tasks posted to the thread, newest first */
+} POLL_WAKEUP;
+
+static	POLL_WAKEUP	*wakeups = NULL; /*< The wakeups, one per thread */
+static	int		signal_wakeups = 0; /*< Wake the threads by signal */
+static	int		acceptor_fd = -1; /*< The epoll set of the acceptor */
+static	__thread int	poll_acceptor = 0; /*< This is the acceptor thread */
+
+/**
+ * The registration of a descriptor with an io_uring, the slots of a ring
+ * are indexed by descriptor. The generation of the slot forms part of the
+ * user data of the poll request, so that completions that are still
+ * delivered for a registration that has been removed can be discarded.
+ */
+typedef struct {
+	DCB		*dcb;		/*< The registered DCB */
+	unsigned int	gen;		/*< The generation of the registration */
+	unsigned int	events;		/*< The poll events registered */
+} POLL_SLOT;
+
+#define	POLL_URING_MAX_FDS	65536	/*< Upper bound of the slots per ring */
+#define	POLL_WAKEUP_DATA	(~0UL)	/*< User data of the wakeup polls */
+#define	POLL_SLOT_DATA(fd, gen)	(((unsigned long)(gen) << 32) | (unsigned int)(fd))
+
+static	URING		*rings = NULL;	  /*< The io_uring per thread, or NULL */
+static	POLL_SLOT	**slots = NULL;	  /*< The registrations of each ring */
+static	int		n_slots = 0;	  /*< Number of slots in each ring */
+
+/**
+ * The epoch last observed by a polling thread at the end of its polling
+ * loop. Each entry is padded to a cache line of its own so that the
+ * threads do not contend when they update them.
+ *
+ * A thread that is waited upon by the retired DCBs of another thread has
+ * its notify flag set, it then wakes the threads that hold retired DCBs
+ * once it has passed its next quiescent point.
+ */
+typedef struct {
+	unsigned long	epoch;	/*< The epoch seen at the last quiescent point */
+	int		notify;	/*< Wake the reclaiming threads when passed */
+	char		pad[64 - sizeof(unsigned long) - sizeof(int)];
+} POLL_EPOCH;
+
+static	POLL_EPOCH	*epochs = NULL;	  /*< The per thread epochs */
+static	unsigned long	global_epoch = 1; /*< The reclamation epoch */
+static	__thread int	poll_thread = -1; /*< Polling thread id of this thread */
+
+/**
+ * The ready queue of a polling thread, the DCBs that used up their read
+ * budget with data left to read. They are read again after the other
+ * events of the batch have been dispatched.
+ */
+static	__thread DCB	*ready_head = NULL;
+static	__thread DCB	*ready_tail = NULL;
+
+static void	poll_wakeup_handler(int);
+static int	poll_is_wakeup(void *);
+static void	poll_clear_wakeup(POLL_WAKEUP *);
+static void	poll_quiescent(int);
+static void	poll_ready_add(DCB *);
+static void	poll_ready_run();
+static void	poll_ready_prune();
+static void	poll_run_tasks(POLL_WAKEUP *);
+static int	poll_uring_init();
+static int	poll_uring_arm(int, DCB *, unsigned int);
+static int	poll_uring_disarm(int, int);
+static void	poll_uring_event(int, URING_EVENT *);
+
+#define	POLL_NFDS_BUCKETS	10	/*< Buckets of events per wait, 1 to 512+ */
+#define	POLL_TIME_BUCKETS	21	/*< Buckets of dispatch time, 1us to 1s+ */
+
+/**
+ * The polling statistics of a thread. Each thread updates its own copy
+ * without atomic operations and the copies are merged when the statistics
+ * are displayed. The copies are aligned to cache lines, so that the
+ * threads do not share a line that they write to.
+ *
+ * The histograms have power of two buckets, the number of events returned
+ * by each wait that found events and the time spent dispatching them,
+ * in microseconds.
+ */
+typedef struct {
+	int		n_read;		/*< Number of read events   */
+	int		n_write;	/*< Number of write events  */
+	int		n_error;	/*< Number of error events  */
+	int		n_hup;		/*< Number of hangup events */
+	int		n_accept;	/*< Number of accept events */
+	int		n_write_idle;	/*< Number of write events with nothing queued */
+	int		n_pollout;	/*< Number of times EPOLLOUT was enabled */
+	int		n_ready;	/*< Number of reads deferred by the budget */
+	int		n_handoff;	/*< Number of tasks posted to the thread */
+	int		n_polls;	/*< Number of poll cycles   */
+	unsigned long	n_events;	/*< Number of events returned */
+	unsigned long	busy_us;	/*< Time spent dispatching, microseconds */
+	int		nfds[POLL_NFDS_BUCKETS]; /*< Events per poll cycle */
+	int		time[POLL_TIME_BUCKETS]; /*< Dispatch time per poll cycle */
+} __attribute__((aligned(64))) POLL_STATS;
+
+/**
+ * The statistics of each polling thread, the extra entry at the end is
+ * shared by the other threads and updated atomically.
+ */
+static	POLL_STATS	*pollStats = NULL;
+
+/**
+ * Count a polling event in the statistics of the calling thread
  */
-static struct {
-	int	n_read;		/*< Number of read events   */
-	int	n_write;	/*< Number of write events  */
-	int	n_error;	/*< Number of error events  */
-	int	n_hup;		/*< Number of hangup events */
-	int	n_accept;	/*< Number of accept events */
-	int	n_polls;	/*< Number of poll cycles   */
-} pollStats;
+#define	POLL_STAT_INC(field)						\
+	do {								\
+		if (poll_thread >= 0)					\
+			pollStats[poll_thread].field++;			\
+		else							\
+			atomic_add_int(&pollStats[n_threads].field, 1,	\
+				       ATOMIC_RELAXED);			\
+	} while (0)
+
+static void	poll_stats_batch(POLL_STATS *, int, struct timespec *);
 
 
 /**
  * Initialise the polling system we are using for the gateway.
  *
- * In this case we are using the Linux epoll mechanism
+ * In this case we are using the Linux epoll mechanism. By default all
+ * the polling threads share a single epoll set. If poll_sharding is set
+ * in the configuration each polling thread is given an epoll set of its
+ * own and every request handler DCB is registered with exactly one of
+ * them, so that all the events for a DCB are delivered to a single thread.
+ *
+ * If the io_uring backend is configured, and supported by the kernel,
+ * each polling thread is instead given an io_uring of its own, the DCBs
+ * are assigned to the threads in the same way as with poll_sharding.
  */
 void
 poll_init()
 {
-	if (epoll_fd != -1)
+int	i;
+
+	if (wakeups != NULL)
 		return;
-	if ((epoll_fd = epoll_create(MAX_EVENTS)) == -1)
+	if ((n_threads = config_threadcount()) < 1)
+		n_threads = 1;
+	if (config_poll_backend() == POLL_BACKEND_IO_URING &&
+	    poll_uring_init() != 0)
+	{
+		LOGIF(LE, (skygw_log_write_flush(
+			LOGFILE_ERROR,
+			"Warning : The io_uring event backend is not supported "
+			"by the kernel, using epoll instead.")));
+	}
+	n_epoll = rings == NULL ? (config_poll_sharding() ? n_threads : 1) : 0;
+	if (n_epoll > 0 &&
+	    (epoll_fds = (int *)calloc(n_epoll, sizeof(int))) == NULL)
+	{
+		perror("calloc");
+		exit(-1);
+	}
+	for (i = 0; i < n_epoll; i++)
+	{
+		if ((epoll_fds[i] = epoll_create(MAX_EVENTS)) == -1)
+		{
+			perror("epoll_create");
+			exit(-1);
+		}
+	}
+	if (config_acceptor_thread() &&
+	    (acceptor_fd = epoll_create(MAX_EVENTS)) == -1)
 	{
 		perror("epoll_create");
 		exit(-1);
 	}
-	memset(&pollStats, 0, sizeof(pollStats));
+	if ((wakeups = (POLL_WAKEUP *)calloc(n_threads,
+					sizeof(POLL_WAKEUP))) == NULL)
+	{
+		perror("calloc");
+		exit(-1);
+	}
+	signal_wakeups = (n_epoll == 1 && n_threads > 1);
+	if (signal_wakeups)
+	{
+		struct sigaction	sa;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = poll_wakeup_handler;
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(POLL_WAKEUP_SIGNAL, &sa, NULL) == -1)
+		{
+			perror("sigaction");
+			exit(-1);
+		}
+	}
+	for (i = 0; i < n_threads; i++)
+	{
+		struct epoll_event ev;
+
+		wakeups[i].fd = -1;
+		if (signal_wakeups)
+			continue;
+		if ((wakeups[i].fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) == -1)
+		{
+			perror("eventfd");
+			exit(-1);
+		}
+		if (rings != NULL)
+		{
+			if (uring_poll_add(&rings[i], wakeups[i].fd, POLLIN,
+					   POLL_WAKEUP_DATA) == -1)
+			{
+				perror("uring_poll_add");
+				exit(-1);
+			}
+			continue;
+		}
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.ptr = &wakeups[i];
+		if (epoll_ctl(epoll_fds[i % n_epoll], EPOLL_CTL_ADD,
+			      wakeups[i].fd, &ev) == -1)
+		{
+			perror("epoll_ctl");
+			exit(-1);
+		}
+	}
+	if ((epochs = (POLL_EPOCH *)calloc(n_threads,
+					  sizeof(POLL_EPOCH))) == NULL)
+	{
+		perror("calloc");
+		exit(-1);
+	}
+	dcb_reclaim_init(n_threads);
+	timer_init(n_threads);
+	if (posix_memalign((void **)&pollStats, 64,
+			   (n_threads + 1) * sizeof(POLL_STATS)) != 0)
+	{
+		perror("posix_memalign");
+		exit(-1);
+	}
+	memset(pollStats, 0, (n_threads + 1) * sizeof(POLL_STATS));
 	bitmask_init(&poll_mask);
         simple_mutex_init(&epoll_wait_mutex, "epoll_wait_mutex");        
 }
 
+/**
+ * Select the polling thread that will own a request handler DCB.
+ *
+ * A backend DCB is always owned by the thread that owns the client DCB
+ * of its session, this keeps all the descriptors of a session pinned to
+ * the same polling thread. Other DCBs are distributed round robin.
+ *
+ * @param dcb	The DCB that is being added to the poll set
+ * @return	The polling thread that owns the DCB
+ */
+static int
+poll_select_owner(DCB *dcb)
+{
+SESSION	*session = dcb->session;
+
+	if (dcb->owner != -1)
+		return dcb->owner;
+	if (session != NULL &&
+	    session->client != NULL &&
+	    session->client != dcb &&
+	    session->client->owner != -1)
+	{
+		return session->client->owner;
+	}
+	return (atomic_add(&next_thread, 1) & 0x7fffffff) % n_threads;
+}
+
+/**
+ * Register a DCB with the epoll set(s) it belongs to
+ *
+ * Listener DCBs are added to every epoll set, with EPOLLEXCLUSIVE when there
+ * is more than one set so that only one thread is woken per new connection.
+ * If there is an acceptor thread the listeners are only added to its epoll
+ * set instead. Request handler DCBs are added to the epoll set of the
+ * owning thread.
+ *
+ * @param dcb	The DCB to register
+ * @param ev	The epoll event to register
+ * @return	0 on success, -1 on error
+ */
+static int
+poll_register_dcb(DCB *dcb, struct epoll_event *ev)
+{
+int	i, rc = 0;
+
+	if (dcb->dcb_role == DCB_ROLE_SERVICE_LISTENER)
+	{
+		if (acceptor_fd != -1)
+			return epoll_ctl(acceptor_fd, EPOLL_CTL_ADD, dcb->fd, ev);
+		if (rings != NULL)
+		{
+			for (i = 0; i < n_threads && rc == 0; i++)
+				rc = poll_uring_arm(i, dcb, ev->events);
+			return rc;
+		}
+		if (n_epoll > 1)
+			ev->events |= EPOLLEXCLUSIVE;
+		for (i = 0; i < n_epoll && rc == 0; i++)
+			rc = epoll_ctl(epoll_fds[i], EPOLL_CTL_ADD, dcb->fd, ev);
+		return rc;
+	}
+	dcb->owner = poll_select_owner(dcb);
+	if (rings != NULL)
+		return poll_uring_arm(dcb->owner, dcb, ev->events);
+	return epoll_ctl(epoll_fds[dcb->owner % n_epoll],
+			 EPOLL_CTL_ADD,
+			 dcb->fd,
+			 ev);
+}
+
+/**
+ * Remove a DCB from the epoll set(s) it was registered with
+ *
+ * @param dcb	The DCB to remove
+ * @return	0 on success, -1 on error
+ */
+static int
+poll_unregister_dcb(DCB *dcb)
+{
+struct	epoll_event ev;
+int	i, rc = 0;
+
+	if (dcb->dcb_role == DCB_ROLE_SERVICE_LISTENER && acceptor_fd != -1)
+		return epoll_ctl(acceptor_fd, EPOLL_CTL_DEL, dcb->fd, &ev);
+	if (rings != NULL)
+	{
+		if (dcb->dcb_role != DCB_ROLE_SERVICE_LISTENER && dcb->owner != -1)
+			return poll_uring_disarm(dcb->owner, dcb->fd);
+		for (i = 0; i < n_threads; i++)
+		{
+			if (poll_uring_disarm(i, dcb->fd) != 0)
+				rc = -1;
+		}
+		return rc;
+	}
+	if (dcb->dcb_role == DCB_ROLE_SERVICE_LISTENER || dcb->owner == -1)
+	{
+		for (i = 0; i < n_epoll; i++)
+		{
+			if (epoll_ctl(epoll_fds[i], EPOLL_CTL_DEL, dcb->fd, &ev) != 0
+			    && errno != ENOENT)
+			{
+				rc = -1;
+			}
+		}
+		return rc;
+	}
+	return epoll_ctl(epoll_fds[dcb->owner % n_epoll],
+			 EPOLL_CTL_DEL,
+			 dcb->fd,
+			 &ev);
+}
+
 /**
  * Add a DCB to the set of descriptors within the polling
  * environment.
  *
+ * DCBs are polled for EPOLLIN only, EPOLLOUT is added whilst the DCB has
+ * data queued for writing. A caller that needs the EPOLLOUT event for some
+ * other reason, such as the completion of a non-blocking connect, sets it
+ * in the events of the DCB before adding it.
+ *
  * @param dcb	The descriptor to add to the poll
  * @return	-1 on error or 0 on success
  */
@@ -99,7 +461,9 @@ poll_add_dcb(DCB *dcb)
 
         CHK_DCB(dcb);
         
-	ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+	ev.events = EPOLLIN | EPOLLET | (dcb->events & EPOLLOUT);
+	if (!GWBUF_QUEUE_EMPTY(&dcb->writeq))
+		ev.events |= EPOLLOUT;
 	ev.data.ptr = dcb;
 
         /*<
@@ -116,7 +480,8 @@ poll_add_dcb(DCB *dcb)
          * is not polling anymore.
          */
         if (dcb_set_state(dcb, new_state, &old_state)) {
-                rc = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, dcb->fd, &ev);
+                dcb->events = ev.events;
+                rc = poll_register_dcb(dcb, &ev);
 
                 if (rc != 0) {
                         int eno = errno;
@@ -134,10 +499,14 @@ poll_add_dcb(DCB *dcb)
                         LOGIF(LD, (skygw_log_write(
                                 LOGFILE_DEBUG,
                                 "%lu [poll_add_dcb] Added dcb %p in state %s to "
-                                "poll set.",
+                                "poll set of thread %d.",
                                 pthread_self(),
                                 dcb,
-                                STRDCBSTATE(dcb->state))));
+                                STRDCBSTATE(dcb->state),
+                                dcb->owner)));
+                        /*< Only client DCBs have a service */
+                        if (new_state == DCB_STATE_POLLING)
+                                dcb_idle_start(dcb);
                 }
                 ss_dassert(rc == 0); /*< trap in debug */
         } else {
@@ -152,6 +521,70 @@ poll_add_dcb(DCB *dcb)
 	return rc; 
 }
 
+/**
+ * Change the set of events a request handler DCB is polled for, for
+ * example to stop reading from a DCB whilst its peer drains a write queue.
+ *
+ * Since the DCB is registered edge triggered, adding an event that is
+ * already pending will cause it to be delivered. Passing no events to
+ * add or remove re-arms the DCB, which delivers any pending events again.
+ *
+ * @param dcb		The DCB to modify
+ * @param add		The events to add
+ * @param remove	The events to remove
+ * @return		-1 on error or 0 on success
+ */
+int
+poll_update_dcb(DCB *dcb, unsigned int add, unsigned int remove)
+{
+struct	epoll_event	ev;
+int			rc = 0;
+
+        CHK_DCB(dcb);
+        ss_dassert(dcb->dcb_role == DCB_ROLE_REQUEST_HANDLER);
+
+        spinlock_acquire(&dcb->dcb_initlock);
+        ev.events = (dcb->events | add) & ~remove;
+        ev.data.ptr = dcb;
+
+        if (dcb->state == DCB_STATE_POLLING &&
+            (ev.events != dcb->events || (add == 0 && remove == 0)))
+        {
+                if (rings != NULL)
+                {
+                        /*< A new poll request reports the current state */
+                        poll_uring_disarm(dcb->owner, dcb->fd);
+                        rc = poll_uring_arm(dcb->owner, dcb, ev.events);
+                }
+                else
+                        rc = epoll_ctl(epoll_fds[dcb->owner % n_epoll],
+                                       EPOLL_CTL_MOD,
+                                       dcb->fd,
+                                       &ev);
+                if (rc == 0)
+                {
+                        if ((ev.events & ~dcb->events) & EPOLLOUT)
+                                POLL_STAT_INC(n_pollout);
+                        dcb->events = ev.events;
+                }
+                else
+                {
+                        int eno = errno;
+                        errno = 0;
+                        LOGIF(LE, (skygw_log_write_flush(
+                                LOGFILE_ERROR,
+                                "Error : Modifying the events of dcb %p fd %d "
+                                "failed. epoll_ctl failed due %d, %s.",
+                                dcb,
+                                dcb->fd,
+                                eno,
+                                strerror(eno))));
+                }
+        }
+        spinlock_release(&dcb->dcb_initlock);
+        return rc;
+}
+
 /**
  * Remove a descriptor from the set of descriptors within the
  * polling environment.
@@ -164,7 +597,6 @@ poll_add_dcb(DCB *dcb)
 int
 poll_remove_dcb(DCB *dcb)
 {
-        struct	epoll_event ev;
         int                 rc = -1;
         dcb_state_t         old_state = DCB_STATE_UNDEFINED;
         dcb_state_t         new_state = DCB_STATE_NOPOLLING;
@@ -185,7 +617,7 @@ poll_remove_dcb(DCB *dcb)
          * Set state to NOPOLLING and remove dcb from poll set.
          */
         if (dcb_set_state(dcb, new_state, &old_state)) {
-                rc = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, dcb->fd, &ev);
+                rc = poll_unregister_dcb(dcb);
 
                 if (rc != 0) {
                         int eno = errno;
@@ -206,17 +638,185 @@ poll_remove_dcb(DCB *dcb)
                 rc = 0;
                 goto return_rc;
         }
-        
-        /*< Set bit for each maxscale thread */
-        bitmask_copy(&dcb->memdata.bitmask, poll_bitmask()); 
         rc = 0;
 return_rc:
         return rc;
 }
 
-#define	BLOCKINGPOLL	0	/*< Set BLOCKING POLL to 1 if using a single thread and to make
-				 *  debugging easier.
-				 */
+/**
+ * Despatch the events of a descriptor to the handlers of its DCB
+ *
+ * The events are the epoll event bits, which share their values with the
+ * poll event bits returned by the io_uring backend.
+ *
+ * @param dcb	The DCB the events are for
+ * @param ev	The events
+ */
+static void
+poll_dispatch(DCB *dcb, __uint32_t ev)
+{
+	CHK_DCB(dcb);
+
+#if defined(SS_DEBUG)
+	if (dcb_fake_write_ev[dcb->fd] != 0) {
+		LOGIF(LD, (skygw_log_write(
+			LOGFILE_DEBUG,
+			"%lu [poll_waitevents] "
+			"Added fake events %d to ev %d.",
+			pthread_self(),
+			dcb_fake_write_ev[dcb->fd],
+			ev)));
+		ev |= dcb_fake_write_ev[dcb->fd];
+		dcb_fake_write_ev[dcb->fd] = 0;
+	}
+#endif
+	ss_debug(spinlock_acquire(&dcb->dcb_initlock);)
+	ss_dassert(dcb->state != DCB_STATE_ALLOC);
+	ss_dassert(dcb->state != DCB_STATE_DISCONNECTED);
+	ss_dassert(dcb->state != DCB_STATE_FREED);
+	ss_debug(spinlock_release(&dcb->dcb_initlock);)
+
+	LOGIF(LT, (skygw_log_write(
+		LOGFILE_TRACE,
+		"%lu [poll_waitevents] event %d dcb %p "
+		"role %s",
+		pthread_self(),
+		ev,
+		dcb,
+		STRDCBROLE(dcb->dcb_role))));
+
+	if (ev & EPOLLERR)
+	{
+		int eno = gw_getsockerrno(dcb->fd);
+#if defined(SS_DEBUG)
+		if (eno == 0) {
+			eno = dcb_fake_write_errno[dcb->fd];
+			LOGIF(LD, (skygw_log_write(
+				LOGFILE_DEBUG,
+				"%lu [poll_waitevents] "
+				"Added fake errno %d. "
+				"%s",
+				pthread_self(),
+				eno,
+				strerror(eno))));
+		}
+		dcb_fake_write_errno[dcb->fd] = 0;
+#endif
+		if (eno != 0) {
+			LOGIF(LD, (skygw_log_write(
+				LOGFILE_DEBUG,
+				"%lu [poll_waitevents] "
+				"EPOLLERR due %d, %s.",
+				pthread_self(),
+				eno,
+				strerror(eno))));
+		}
+		POLL_STAT_INC(n_error);
+		dcb->func.error(dcb);
+	}
+	if (ev & EPOLLHUP)
+	{
+		int eno = 0;
+		eno = gw_getsockerrno(dcb->fd);
+
+		LOGIF(LD, (skygw_log_write(
+			LOGFILE_DEBUG,
+			"%lu [poll_waitevents] "
+			"EPOLLHUP on dcb %p, fd %d. "
+			"Errno %d, %s.",
+			pthread_self(),
+			dcb,
+			dcb->fd,
+			eno,
+			strerror(eno))));
+		POLL_STAT_INC(n_hup);
+		dcb->func.hangup(dcb);
+	}
+	if (ev & EPOLLOUT)
+	{
+		int eno = 0;
+		eno = gw_getsockerrno(dcb->fd);
+
+		if (GWBUF_QUEUE_EMPTY(&dcb->writeq))
+			POLL_STAT_INC(n_write_idle);
+
+		if (eno == 0)  {
+#if 1
+			simple_mutex_lock(
+				&dcb->dcb_write_lock,
+				true);
+			ss_info_dassert(
+				!dcb->dcb_write_active,
+				"Write already active");
+			dcb->dcb_write_active = TRUE;
+#endif
+			POLL_STAT_INC(n_write);
+			dcb->func.write_ready(dcb);
+#if 1
+			dcb->dcb_write_active = FALSE;
+			simple_mutex_unlock(
+				&dcb->dcb_write_lock);
+#endif
+		} else {
+			LOGIF(LD, (skygw_log_write(
+				LOGFILE_DEBUG,
+				"%lu [poll_waitevents] "
+				"EPOLLOUT due %d, %s. "
+				"dcb %p, fd %i",
+				pthread_self(),
+				eno,
+				strerror(eno),
+				dcb,
+				dcb->fd)));
+		}
+	}
+	if (ev & EPOLLIN)
+	{
+#if 1
+		simple_mutex_lock(&dcb->dcb_read_lock,
+				  true);
+		ss_info_dassert(!dcb->dcb_read_active,
+				"Read already active");
+		dcb->dcb_read_active = TRUE;
+#endif
+		/*< The idle timer of the DCB checks the time of the last read */
+		if (TIMER_PENDING(&dcb->timer))
+			dcb->last_read = timer_now();
+		if (dcb->state == DCB_STATE_LISTENING)
+		{
+			LOGIF(LD, (skygw_log_write(
+				LOGFILE_DEBUG,
+				"%lu [poll_waitevents] "
+				"Accept in fd %d",
+				pthread_self(),
+				dcb->fd)));
+			POLL_STAT_INC(n_accept);
+			dcb->func.accept(dcb);
+		}
+		else
+		{
+			LOGIF(LD, (skygw_log_write(
+				LOGFILE_DEBUG,
+				"%lu [poll_waitevents] "
+				"Read in dcb %p fd %d",
+				pthread_self(),
+				dcb,
+				dcb->fd)));
+			POLL_STAT_INC(n_read);
+			/*< Set by dcb_read if it leaves data in the socket */
+			dcb->readable = 0;
+			dcb->func.read(dcb);
+		}
+#if 1
+		dcb->dcb_read_active = FALSE;
+		simple_mutex_unlock(
+			&dcb->dcb_read_lock);
+#endif
+		/*< The rest of the data is read after the other events */
+		if (dcb->readable && dcb->state == DCB_STATE_POLLING)
+			poll_ready_add(dcb);
+	}
+}
 
 /**
  * The main polling loop
@@ -228,16 +828,25 @@ return_rc:
  * The routine will loop as long as the variable "shutdown" is set to zero,
  * setting this to a non-zero value will cause the polling loop to return.
  *
- * There are two options for the polling, a debug option that is only useful if
- * you have a single thread. This blocks in epoll_wait until an event occurs.
+ * The thread blocks in epoll_wait until either an event occurs on one of
+ * the descriptors or another thread wakes it by means of poll_wakeup, as is
+ * done when zombies are queued or the gateway is shutting down. The
+ * EPOLL_TIMEOUT is only an upper bound on the time the thread sleeps.
+ *
+ * When poll sharding is enabled each thread waits on its own epoll set,
+ * otherwise all the threads share the same epoll set and are woken by
+ * signal rather than by eventfd. With the io_uring
+ * backend each thread waits on its own ring, the wait also submits the
+ * poll requests queued since the previous wait in a single system call.
+ *
+ * A DCB that uses up its read budget is put on the ready queue of the
+ * thread and read again once the other events of the batch have been
+ * dispatched. The thread does not block whilst its ready queue is not
+ * empty, so new events are interleaved with the remaining reads.
  *
- * The non-debug option does an epoll with a time out. This allows the checking of
- * shutdown value to be checked in all threads. The algorithm for polling in this
- * mode is to do a poll with no-wait, if no events are detected then the poll is
- * repeated with a time out. This allows for a quick check before making the call 
- * with timeout. The call with the timeout differs in that the Linux scheduler may
- * deschedule a process if a timeout is included, but will not do this if a 0 timeout
- * value is given. this improves performance when the gateway is under heavy load.
+ * The end of each pass of the loop is a quiescent point for the thread, it
+ * holds no references to DCBs that have been removed from the poll set and
+ * it records the current epoch so that retired DCBs can be freed.
  *
  * @param arg	The thread ID passed as a void * to satisfy the threading package
  */
@@ -245,34 +854,76 @@ void
 poll_waitevents(void *arg)
 {
         struct epoll_event events[MAX_EVENTS];
-        int		   i, nfds;
-        int		   thread_id = (int)arg;
-        bool               no_op = false;
-        static bool        process_zombies_only = false; /*< flag for all threads */
-        DCB                *zombies = NULL;
+        URING_EVENT	   uevents[MAX_EVENTS];
+        struct timespec	   start;
+        int		   i, nfds, timeout;
+        int		   thread_id = (int)(intptr_t)arg;
+        int		   epoll_fd = -1;
+        POLL_WAKEUP	   *self = &wakeups[thread_id % n_threads];
+        sigset_t	   waitmask;
+
+        if (n_epoll > 0)
+                epoll_fd = epoll_fds[thread_id % n_epoll];
 
 	/* Add this thread to the bitmask of running polling threads */
 	bitmask_set(&poll_mask, thread_id);
+	poll_thread = thread_id % n_threads;
+	/*< The polling threads take the counter shards in turn */
+	counter_shard = poll_thread & (COUNTER_SHARDS - 1);
+
+	/*<
+	 * Bind the thread before it allocates anything, so that its memory
+	 * is first touched on the right node.
+	 */
+	if (config_thread_affinity() != NULL)
+		thread_bind(config_thread_affinity(),
+			    poll_thread,
+			    config_numa_local());
+	/*<
+	 * Hold back the wakeup signal other than in epoll_pwait, the thread
+	 * must be recorded before it can be seen sleeping.
+	 */
+	if (signal_wakeups)
+	{
+		sigset_t	block;
+
+		sigemptyset(&block);
+		sigaddset(&block, POLL_WAKEUP_SIGNAL);
+		pthread_sigmask(SIG_BLOCK, &block, &waitmask);
+		sigdelset(&waitmask, POLL_WAKEUP_SIGNAL);
+		self->thread = pthread_self();
+		__sync_synchronize();
+	}
+	poll_quiescent(poll_thread);
 
 	while (1)
 	{
-#if BLOCKINGPOLL
-		nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
-#else /* BLOCKINGPOLL */
-                if (!no_op) {
-                        LOGIF(LD, (skygw_log_write(
-                                           LOGFILE_DEBUG,
-                                           "%lu [poll_waitevents] MaxScale thread "
-                                           "%d > epoll_wait <",
-                                           pthread_self(),
-                                           thread_id)));                        
-                        no_op = TRUE;
-                }
-#if 0
-                simple_mutex_lock(&epoll_wait_mutex, TRUE);
-#endif
-                
-		if ((nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, 0)) == -1)
+                /*<
+                 * Announce that we are about to sleep before checking for
+                 * posted work, poll_wakeup does the reverse, so either we see
+                 * the work or the poster sees us sleeping and signals the
+                 * eventfd, or the thread itself if the epoll set is shared.
+                 */
+                self->sleeping = 1;
+                __sync_synchronize();
+                if (self->pending || shutdown || ready_head != NULL)
+                        timeout = 0;
+                else
+                        timeout = timer_next(poll_thread, EPOLL_TIMEOUT);
+
+                if (rings != NULL)
+                        nfds = uring_wait(&rings[poll_thread],
+                                          uevents,
+                                          MAX_EVENTS,
+                                          timeout);
+                else if (signal_wakeups)
+                        nfds = epoll_pwait(epoll_fd, events, MAX_EVENTS,
+                                           timeout, &waitmask);
+                else
+                        nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+                self->sleeping = 0;
+
+		if (nfds == -1 && errno != EINTR)
 		{
                         int eno = errno;
                         errno = 0;
@@ -283,36 +934,7 @@ poll_waitevents(void *arg)
                                 pthread_self(),
                                 nfds,
                                 eno)));
-                        no_op = FALSE;
 		}
-		else if (nfds == 0)
-		{
-                        if (process_zombies_only) {
-#if 0
-                                simple_mutex_unlock(&epoll_wait_mutex);
-#endif
-                                goto process_zombies;
-                        } else {
-                                nfds = epoll_wait(epoll_fd,
-                                                  events,
-                                                  MAX_EVENTS,
-                                                  EPOLL_TIMEOUT);
-                                /*<
-                                 * When there are zombies to be cleaned up but
-                                 * no client requests, allow all threads to call
-                                 * dcb_process_zombies without having to wait
-                                 * for the timeout.
-                                 */
-                                if (nfds == 0 && dcb_get_zombies() != NULL)
-                                {
-                                        process_zombies_only = true;
-                                }
-                        }
-		}
-#if 0
-                simple_mutex_unlock(&epoll_wait_mutex);
-#endif
-#endif /* BLOCKINGPOLL */
 		if (nfds > 0)
 		{
                         LOGIF(LD, (skygw_log_write(
@@ -320,175 +942,38 @@ poll_waitevents(void *arg)
                                 "%lu [poll_waitevents] epoll_wait found %d fds",
                                 pthread_self(),
                                 nfds)));
-			atomic_add(&pollStats.n_polls, 1);
+			clock_gettime(CLOCK_MONOTONIC, &start);
 
 			for (i = 0; i < nfds; i++)
 			{
-				DCB 		*dcb = (DCB *)events[i].data.ptr;
-				__uint32_t	ev = events[i].events;
-
-                                CHK_DCB(dcb);
+				DCB 		*dcb;
+				__uint32_t	ev;
 
-#if defined(SS_DEBUG)
-                                if (dcb_fake_write_ev[dcb->fd] != 0) {
-                                        LOGIF(LD, (skygw_log_write(
-                                                LOGFILE_DEBUG,
-                                                "%lu [poll_waitevents] "
-                                                "Added fake events %d to ev %d.",
-                                                pthread_self(),
-                                                dcb_fake_write_ev[dcb->fd],
-                                                ev)));
-                                        ev |= dcb_fake_write_ev[dcb->fd];
-                                        dcb_fake_write_ev[dcb->fd] = 0;
-                                }
-#endif
-                                ss_debug(spinlock_acquire(&dcb->dcb_initlock);)
-                                ss_dassert(dcb->state != DCB_STATE_ALLOC);
-                                ss_dassert(dcb->state != DCB_STATE_DISCONNECTED);
-                                ss_dassert(dcb->state != DCB_STATE_FREED);
-                                ss_debug(spinlock_release(&dcb->dcb_initlock);)
-
-                                LOGIF(LT, (skygw_log_write(
-                                        LOGFILE_TRACE,
-                                        "%lu [poll_waitevents] event %d dcb %p "
-                                        "role %s",
-                                        pthread_self(),
-                                        ev,
-                                        dcb,
-                                        STRDCBROLE(dcb->dcb_role))));
-
-				if (ev & EPOLLERR)
-				{
-                                        int eno = gw_getsockerrno(dcb->fd);
-#if defined(SS_DEBUG)
-                                        if (eno == 0) {
-                                                eno = dcb_fake_write_errno[dcb->fd];
-                                                LOGIF(LD, (skygw_log_write(
-                                                        LOGFILE_DEBUG,
-                                                        "%lu [poll_waitevents] "
-                                                        "Added fake errno %d. "
-                                                        "%s",
-                                                        pthread_self(),
-                                                        eno,
-                                                        strerror(eno))));
-                                        }
-                                        dcb_fake_write_errno[dcb->fd] = 0;
-#endif
-                                        if (eno != 0) {
-                                                LOGIF(LD, (skygw_log_write(
-                                                        LOGFILE_DEBUG,
-                                                        "%lu [poll_waitevents] "
-                                                        "EPOLLERR due %d, %s.",
-                                                        pthread_self(),
-                                                        eno,
-                                                        strerror(eno))));
-                                        }
-                                        atomic_add(&pollStats.n_error, 1);
-                                        dcb->func.error(dcb);
-                                }
-				if (ev & EPOLLHUP)
-				{
-                                        int eno = 0;
-                                        eno = gw_getsockerrno(dcb->fd);
-                                        
-                                        LOGIF(LD, (skygw_log_write(
-                                                LOGFILE_DEBUG,
-                                                "%lu [poll_waitevents] "
-                                                "EPOLLHUP on dcb %p, fd %d. "
-                                                "Errno %d, %s.",
-                                                pthread_self(),
-                                                dcb,
-                                                dcb->fd,
-                                                eno,
-                                                strerror(eno))));
-                                        atomic_add(&pollStats.n_hup, 1);
-					dcb->func.hangup(dcb);
-				}
-				if (ev & EPOLLOUT)
-				{
-                                        int eno = 0;
-                                        eno = gw_getsockerrno(dcb->fd);
-
-                                        if (eno == 0)  {
-#if 1
-                                                simple_mutex_lock(
-                                                        &dcb->dcb_write_lock,
-                                                        true);
-                                                ss_info_dassert(
-                                                        !dcb->dcb_write_active,
-                                                        "Write already active");
-                                                dcb->dcb_write_active = TRUE;
-#endif
-                                                atomic_add(
-                                                &pollStats.n_write,
-                                                        1);
-                                                dcb->func.write_ready(dcb);
-#if 1
-                                                dcb->dcb_write_active = FALSE;
-                                                simple_mutex_unlock(
-                                                        &dcb->dcb_write_lock);
-#endif
-                                        } else {
-                                                LOGIF(LD, (skygw_log_write(
-                                                        LOGFILE_DEBUG,
-                                                        "%lu [poll_waitevents] "
-                                                        "EPOLLOUT due %d, %s. "
-                                                        "dcb %p, fd %i",
-                                                        pthread_self(),
-                                                        eno,
-                                                        strerror(eno),
-                                                        dcb,
-                                                        dcb->fd)));
-                                        }
+                                if (rings != NULL)
+                                {
+                                        poll_uring_event(poll_thread,
+                                                         &uevents[i]);
+                                        continue;
                                 }
-                                if (ev & EPOLLIN)
+                                dcb = (DCB *)events[i].data.ptr;
+                                ev = events[i].events;
+
+                                if (poll_is_wakeup(events[i].data.ptr))
                                 {
-#if 1
-                                        simple_mutex_lock(&dcb->dcb_read_lock,
-                                                          true);
-                                        ss_info_dassert(!dcb->dcb_read_active,
-                                                        "Read already active");
-                                        dcb->dcb_read_active = TRUE;
-#endif
-					if (dcb->state == DCB_STATE_LISTENING)
-					{
-                                                LOGIF(LD, (skygw_log_write(
-                                                        LOGFILE_DEBUG,
-                                                        "%lu [poll_waitevents] "
-                                                        "Accept in fd %d",
-                                                        pthread_self(),
-                                                        dcb->fd)));
-                                                atomic_add(
-                                                        &pollStats.n_accept, 1);
-                                                dcb->func.accept(dcb);
-                                        }
-					else
-					{
-                                                LOGIF(LD, (skygw_log_write(
-                                                        LOGFILE_DEBUG,
-                                                        "%lu [poll_waitevents] "
-                                                        "Read in dcb %p fd %d",
-                                                        pthread_self(),
-                                                        dcb,
-                                                        dcb->fd)));
-						atomic_add(&pollStats.n_read, 1);
-						dcb->func.read(dcb);
-					}
-#if 1
-                                        dcb->dcb_read_active = FALSE;
-                                        simple_mutex_unlock(
-                                                &dcb->dcb_read_lock);
-#endif
-				}
+                                        poll_clear_wakeup(
+                                                (POLL_WAKEUP *)events[i].data.ptr);
+                                        continue;
+                                }
+                                poll_dispatch(dcb, ev);
 			} /*< for */
-                        no_op = FALSE;
+			poll_stats_batch(&pollStats[poll_thread], nfds, &start);
 		}
-        process_zombies:
-		zombies = dcb_process_zombies(thread_id);
-                
-                if (zombies == NULL) {
-                        process_zombies_only = false;
-                }
+                self->pending = 0;
+                poll_run_tasks(self);
+                poll_ready_run();
+                timer_run(poll_thread);
+                poll_quiescent(poll_thread);
+		dcb_process_zombies(poll_thread);
 
 		if (shutdown)
 		{
@@ -497,6 +982,9 @@ poll_waitevents(void *arg)
                          * polling threads.
                          */
 			bitmask_clear(&poll_mask, thread_id);
+			/*< An exited thread must not hold back reclamation */
+			epochs[poll_thread].epoch = ~0UL;
+			poll_thread = -1;
 			return;
 		}
 	} /*< while(1) */
@@ -509,6 +997,578 @@ void
 poll_shutdown()
 {
 	shutdown = 1;
+	poll_wakeup_all();
+}
+
+/**
+ * Wake a polling thread that may be blocked in epoll_wait
+ *
+ * The thread is marked as having pending work, which it will act upon
+ * before it next blocks. The eventfd is only written, or the thread
+ * signalled, if the thread is currently sleeping, so waking a busy thread
+ * costs no system call.
+ *
+ * @param thread_id	The polling thread to wake
+ */
+void
+poll_wakeup(int thread_id)
+{
+POLL_WAKEUP	*w;
+uint64_t	val = 1;
+
+	if (wakeups == NULL)
+		return;
+	w = &wakeups[thread_id % n_threads];
+	w->pending = 1;
+	__sync_synchronize();
+	if (w->sleeping && signal_wakeups)
+	{
+		pthread_kill(w->thread, POLL_WAKEUP_SIGNAL);
+	}
+	else if (w->sleeping)
+	{
+		if (write(w->fd, &val, sizeof(val)) != sizeof(val) && errno != EAGAIN)
+		{
+			LOGIF(LE, (skygw_log_write_flush(
+				LOGFILE_ERROR,
+				"Error : Failed to wake polling thread %d, "
+				"%d, %s.",
+				thread_id,
+				errno,
+				strerror(errno))));
+		}
+	}
+}
+
+/**
+ * Wake all of the polling threads
+ */
+void
+poll_wakeup_all()
+{
+int	i;
+
+	for (i = 0; i < n_threads; i++)
+		poll_wakeup(i);
+}
+
+/**
+ * Post a task to a polling thread, the task function is called by the
+ * thread at the end of its next pass of the polling loop. The tasks are
+ * pushed onto a lock free stack, so posting never blocks.
+ *
+ * @param thread_id	The polling thread to run the task
+ * @param task		The task, the function and data must be set
+ */
+void
+poll_post(int thread_id, POLL_TASK *task)
+{
+POLL_WAKEUP	*w = &wakeups[thread_id % n_threads];
+
+	do {
+		task->next = w->tasks;
+	} while (!__sync_bool_compare_and_swap(&w->tasks, task->next, task));
+	POLL_STAT_INC(n_handoff);
+	poll_wakeup(thread_id);
+}
+
+/**
+ * Run the tasks posted to a polling thread, in the order they were posted
+ *
+ * @param self	The wakeup of the calling polling thread
+ */
+static void
+poll_run_tasks(POLL_WAKEUP *self)
+{
+POLL_TASK	*task, *next, *list = NULL;
+
+	if (self->tasks == NULL)
+		return;
+	/*< The whole stack is taken at once, so there is no ABA problem */
+	task = __sync_lock_test_and_set(&self->tasks, NULL);
+	for (; task != NULL; task = next)
+	{
+		next = task->next;
+		task->next = list;
+		list = task;
+	}
+	for (task = list; task != NULL; task = next)
+	{
+		next = task->next;
+		task->fn(task->data);
+	}
+}
+
+/**
+ * Return the polling thread an accepted connection should be handed to.
+ * Connections accepted by a polling thread are set up by that thread,
+ * those accepted by the acceptor thread are handed to the polling threads
+ * in turn.
+ *
+ * @return The polling thread or -1 if the caller sets up the connection
+ */
+int
+poll_handoff_thread()
+{
+	if (!poll_acceptor)
+		return -1;
+	return (atomic_add(&next_thread, 1) & 0x7fffffff) % n_threads;
+}
+
+/**
+ * The loop of the acceptor thread. The thread waits for new connections on
+ * the listeners only and leaves the polling threads to serve the clients.
+ * A connection storm is then absorbed by one thread, instead of stalling
+ * the processing of queries by every polling thread.
+ *
+ * @param arg	Unused
+ */
+void
+poll_accept_loop(void *arg)
+{
+struct epoll_event	events[MAX_EVENTS];
+int			i, nfds;
+DCB			*dcb;
+
+	poll_acceptor = 1;
+	while (!shutdown)
+	{
+		nfds = epoll_wait(acceptor_fd, events, MAX_EVENTS, EPOLL_TIMEOUT);
+		for (i = 0; i < nfds; i++)
+		{
+			dcb = (DCB *)events[i].data.ptr;
+			if (dcb->state != DCB_STATE_LISTENING)
+				continue;
+			POLL_STAT_INC(n_accept);
+			dcb->func.accept(dcb);
+		}
+	}
+}
+
+/**
+ * Return the polling thread id of the calling thread
+ *
+ * @return The polling thread id or -1 if not called from a polling thread
+ */
+int
+poll_thread_id()
+{
+	return poll_thread;
+}
+
+/**
+ * Return the number of polling threads
+ *
+ * @return The number of polling threads
+ */
+int
+poll_nthreads()
+{
+	return n_threads;
+}
+
+/**
+ * Advance the reclamation epoch. This is called when an object that may
+ * still be referenced by the polling threads is retired, the object may be
+ * freed once every polling thread has observed the returned epoch.
+ *
+ * @return The new epoch
+ */
+unsigned long
+poll_epoch_advance()
+{
+	return __sync_add_and_fetch(&global_epoch, 1);
+}
+
+/**
+ * Return the oldest epoch observed by any of the polling threads. All
+ * objects retired in this epoch or before it may be freed.
+ *
+ * @return The minimum epoch of the polling threads
+ */
+unsigned long
+poll_epoch_min()
+{
+unsigned long	min = ~0UL, epoch;
+int		i;
+
+	for (i = 0; i < n_threads; i++)
+	{
+		epoch = epochs[i].epoch;
+		if (epoch < min)
+			min = epoch;
+	}
+	return min;
+}
+
+/**
+ * Wake the polling threads that have not yet observed an epoch, so that
+ * a retired object does not wait on a thread that is blocked in epoll_wait.
+ *
+ * Each of the threads is asked to wake the reclaiming threads once it has
+ * passed its next quiescent point, so the caller may sleep until then
+ * rather than poll for the epoch to be reached. A thread that has reached
+ * the epoch since the caller last looked may have missed the request, in
+ * which case the caller is woken to look again.
+ *
+ * @param epoch	The epoch the threads must reach
+ */
+void
+poll_epoch_wake(unsigned long epoch)
+{
+int	i, self;
+
+	for (i = 0; i < n_threads; i++)
+	{
+		if (epochs[i].epoch >= epoch)
+			continue;
+		epochs[i].notify = 1;
+		__sync_synchronize();
+		if (epochs[i].epoch < epoch)
+			poll_wakeup(i);
+		else if ((self = poll_thread_id()) >= 0)
+			poll_wakeup(self);
+		else
+			poll_wakeup(0);
+	}
+}
+
+/**
+ * Record a quiescent point for a polling thread, the thread holds no
+ * references to retired objects at this point.
+ *
+ * @param thread_id	The polling thread
+ */
+static void
+poll_quiescent(int thread_id)
+{
+unsigned long	epoch;
+
+	__sync_synchronize();
+	epoch = global_epoch;
+	__sync_synchronize();
+	/*<
+	 * The ready queue is kept across the quiescent point, it must not
+	 * hold DCBs that may be retired in the epoch observed. A DCB that is
+	 * still polling now can only be retired in a later epoch.
+	 */
+	poll_ready_prune();
+	epochs[thread_id].epoch = epoch;
+	__sync_synchronize();
+	if (epochs[thread_id].notify)
+	{
+		int	i;
+
+		epochs[thread_id].notify = 0;
+		for (i = 0; i < n_threads; i++)
+		{
+			if (i != thread_id && dcb_has_zombies(i))
+				poll_wakeup(i);
+		}
+	}
+}
+
+/**
+ * Add a DCB to the ready queue of the calling polling thread. A DCB is
+ * only queued once, by whichever thread gets to it first.
+ *
+ * @param dcb	The DCB with data left to read
+ */
+static void
+poll_ready_add(DCB *dcb)
+{
+	if (poll_thread < 0 ||
+	    !__sync_bool_compare_and_swap(&dcb->ready, 0, 1))
+		return;
+	dcb->ready_next = NULL;
+	if (ready_tail == NULL)
+		ready_head = dcb;
+	else
+		ready_tail->ready_next = dcb;
+	ready_tail = dcb;
+	POLL_STAT_INC(n_ready);
+}
+
+/**
+ * Read from the DCBs on the ready queue of the calling polling thread.
+ * A DCB that uses up its budget again is added to the end of the queue
+ * for the next pass of the polling loop.
+ */
+static void
+poll_ready_run()
+{
+DCB	*dcb, *next;
+
+	dcb = ready_head;
+	ready_head = ready_tail = NULL;
+	for (; dcb != NULL; dcb = next)
+	{
+		next = dcb->ready_next;
+		dcb->ready_next = NULL;
+		dcb->ready = 0;
+		/*< A throttled DCB is re-armed when its peer has drained */
+		if (dcb->state == DCB_STATE_POLLING && dcb->throttled_by == NULL)
+			poll_dispatch(dcb, EPOLLIN);
+	}
+}
+
+/**
+ * Remove the DCBs that are no longer polling from the ready queue of the
+ * calling polling thread.
+ */
+static void
+poll_ready_prune()
+{
+DCB	*dcb, *next, *last = NULL;
+
+	for (dcb = ready_head; dcb != NULL; dcb = next)
+	{
+		next = dcb->ready_next;
+		if (dcb->state == DCB_STATE_POLLING)
+		{
+			last = dcb;
+			continue;
+		}
+		if (last == NULL)
+			ready_head = next;
+		else
+			last->ready_next = next;
+		dcb->ready_next = NULL;
+		dcb->ready = 0;
+	}
+	ready_tail = last;
+}
+
+/**
+ * The handler of POLL_WAKEUP_SIGNAL, the signal only serves to end the
+ * epoll_pwait of the thread.
+ *
+ * @param sig	The signal
+ */
+static void
+poll_wakeup_handler(int sig)
+{
+}
+
+/**
+ * Check if the user data of an epoll event refers to a wakeup eventfd
+ * rather than a DCB
+ *
+ * @param ptr	The data pointer of the epoll event
+ * @return	Non-zero if the event is a wakeup event
+ */
+static int
+poll_is_wakeup(void *ptr)
+{
+	return (POLL_WAKEUP *)ptr >= wakeups &&
+		(POLL_WAKEUP *)ptr < wakeups + n_threads;
+}
+
+/**
+ * Reset the counter of a wakeup eventfd that has fired.
+ *
+ * The eventfd is only ever in the epoll set or io_uring of the thread it
+ * belongs to, the posted tasks, retired DCBs and epoch of a thread are
+ * its own and no other thread could act upon the wakeup.
+ *
+ * @param w	The wakeup that fired
+ */
+static void
+poll_clear_wakeup(POLL_WAKEUP *w)
+{
+uint64_t	val;
+
+	while (read(w->fd, &val, sizeof(val)) == sizeof(val))
+		;
+}
+
+/**
+ * Create the io_uring of each polling thread and the slot tables of the
+ * rings. The slot tables are sized by the limit of open descriptors.
+ *
+ * @return	0 on success, -1 if io_uring can not be used
+ */
+static int
+poll_uring_init()
+{
+struct rlimit	rl;
+int		i;
+
+	if (!uring_available())
+		return -1;
+	if (getrlimit(RLIMIT_NOFILE, &rl) != 0 ||
+	    rl.rlim_cur == RLIM_INFINITY ||
+	    rl.rlim_cur > POLL_URING_MAX_FDS)
+		n_slots = POLL_URING_MAX_FDS;
+	else
+		n_slots = (int)rl.rlim_cur;
+
+	if ((rings = (URING *)calloc(n_threads, sizeof(URING))) == NULL ||
+	    (slots = (POLL_SLOT **)calloc(n_threads,
+					  sizeof(POLL_SLOT *))) == NULL)
+	{
+		perror("calloc");
+		exit(-1);
+	}
+	for (i = 0; i < n_threads; i++)
+	{
+		if (uring_init(&rings[i], URING_ENTRIES) != 0)
+		{
+			while (--i >= 0)
+			{
+				uring_close(&rings[i]);
+				free(slots[i]);
+			}
+			free(slots);
+			free(rings);
+			slots = NULL;
+			rings = NULL;
+			return -1;
+		}
+		if ((slots[i] = (POLL_SLOT *)calloc(n_slots,
+						    sizeof(POLL_SLOT))) == NULL)
+		{
+			perror("calloc");
+			exit(-1);
+		}
+	}
+	LOGIF(LM, (skygw_log_write(
+		LOGFILE_MESSAGE,
+		"Using the io_uring event backend with %d rings.",
+		n_threads)));
+	return 0;
+}
+
+/**
+ * Register a DCB with the io_uring of a polling thread. The poll request
+ * is queued and submitted by the next wait of the thread, which is woken
+ * if it is not the caller.
+ *
+ * @param ring		The polling thread of the ring
+ * @param dcb		The DCB to register
+ * @param events	The epoll events to poll for
+ * @return		0 on success, -1 on error
+ */
+static int
+poll_uring_arm(int ring, DCB *dcb, unsigned int events)
+{
+POLL_SLOT	*slot;
+
+	if (dcb->fd < 0 || dcb->fd >= n_slots)
+	{
+		errno = EMFILE;
+		return -1;
+	}
+	slot = &slots[ring][dcb->fd];
+	slot->dcb = dcb;
+	slot->events = events & ~(EPOLLET | EPOLLEXCLUSIVE);
+	if (++slot->gen == 0)
+		slot->gen = 1;
+	__sync_synchronize();
+	if (uring_poll_add(&rings[ring], dcb->fd, slot->events,
+			   POLL_SLOT_DATA(dcb->fd, slot->gen)) != 0)
+	{
+		slot->dcb = NULL;
+		return -1;
+	}
+	if (ring != poll_thread)
+		poll_wakeup(ring);
+	return 0;
+}
+
+/**
+ * Remove the registration of a descriptor from the io_uring of a polling
+ * thread. The removal is submitted promptly, as the poll request holds a
+ * reference to the socket and would keep it open.
+ *
+ * @param ring	The polling thread of the ring
+ * @param fd	The descriptor to remove
+ * @return	0 on success, -1 on error
+ */
+static int
+poll_uring_disarm(int ring, int fd)
+{
+POLL_SLOT	*slot;
+unsigned long	data;
+
+	if (fd < 0 || fd >= n_slots)
+		return 0;
+	slot = &slots[ring][fd];
+	if (slot->dcb == NULL)
+		return 0;
+	data = POLL_SLOT_DATA(fd, slot->gen);
+	slot->dcb = NULL;
+	if (++slot->gen == 0)
+		slot->gen = 1;
+	__sync_synchronize();
+	if (uring_poll_remove(&rings[ring], data) != 0)
+		return -1;
+	if (ring != poll_thread)
+		poll_wakeup(ring);
+	return 0;
+}
+
+/**
+ * Handle a completion collected from the io_uring of a polling thread
+ *
+ * Completions for registrations that have since been removed or replaced
+ * are discarded. If the kernel ended a multishot poll, as it may when the
+ * completion queue overflows, the DCB is registered again.
+ *
+ * @param ring	The polling thread of the ring
+ * @param ue	The completion
+ */
+static void
+poll_uring_event(int ring, URING_EVENT *ue)
+{
+POLL_SLOT	*slot;
+DCB		*dcb;
+unsigned int	fd, gen;
+
+	if (ue->user_data == URING_INTERNAL)
+		return;
+	if (ue->user_data == POLL_WAKEUP_DATA)
+	{
+		poll_clear_wakeup(&wakeups[ring]);
+		if ((ue->flags & URING_MORE) == 0)
+			uring_poll_add(&rings[ring], wakeups[ring].fd, POLLIN,
+				       POLL_WAKEUP_DATA);
+		return;
+	}
+	fd = (unsigned int)(ue->user_data & 0xffffffffUL);
+	gen = (unsigned int)(ue->user_data >> 32);
+	if (fd >= (unsigned int)n_slots)
+		return;
+	slot = &slots[ring][fd];
+	if (slot->gen != gen || (dcb = slot->dcb) == NULL)
+		return;
+
+	if (ue->res > 0)
+		poll_dispatch(dcb, (__uint32_t)ue->res);
+	else if (ue->res < 0)
+	{
+		LOGIF(LD, (skygw_log_write(
+			LOGFILE_DEBUG,
+			"%lu [poll_uring_event] Poll of dcb %p fd %d failed "
+			"due %d, %s.",
+			pthread_self(),
+			dcb,
+			fd,
+			-ue->res,
+			strerror(-ue->res))));
+	}
+
+	if ((ue->flags & URING_MORE) == 0)
+	{
+		spinlock_acquire(&dcb->dcb_initlock);
+		if (slot->gen == gen && slot->dcb == dcb &&
+		    (dcb->state == DCB_STATE_POLLING ||
+		     dcb->state == DCB_STATE_LISTENING))
+		{
+			poll_uring_arm(ring, dcb, slot->events);
+		}
+		spinlock_release(&dcb->dcb_initlock);
+	}
 }
 
 /**
@@ -523,17 +1583,136 @@ poll_bitmask()
 }
 
 /**
- * Debug routine to print the polling statistics
+ * Return the power of two bucket of a histogram a value falls in, bucket
+ * n holds the values from 2^n up to 2^(n+1) - 1, the first bucket also
+ * holds zero and the last bucket all of the larger values.
+ *
+ * @param value		The value
+ * @param nbuckets	The number of buckets of the histogram
+ * @return		The bucket
+ */
+static int
+poll_stats_bucket(unsigned long value, int nbuckets)
+{
+int	bucket = 0;
+
+	while (value > 1 && bucket < nbuckets - 1)
+	{
+		value >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+/**
+ * Record a poll cycle that returned events in the statistics of a thread
+ *
+ * @param stats	The statistics of the polling thread
+ * @param nfds	The number of events returned by the wait
+ * @param start	The time the dispatch of the events started
+ */
+static void
+poll_stats_batch(POLL_STATS *stats, int nfds, struct timespec *start)
+{
+struct timespec	end;
+unsigned long	us;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	us = (end.tv_sec - start->tv_sec) * 1000000UL +
+		(end.tv_nsec - start->tv_nsec) / 1000;
+	stats->n_polls++;
+	stats->n_events += nfds;
+	stats->busy_us += us;
+	stats->nfds[poll_stats_bucket(nfds, POLL_NFDS_BUCKETS)]++;
+	stats->time[poll_stats_bucket(us, POLL_TIME_BUCKETS)]++;
+}
+
+/**
+ * Print a power of two histogram of the polling statistics
+ *
+ * @param dcb		DCB to print to
+ * @param title		The title of the histogram
+ * @param unit		The unit of the values
+ * @param offset	Offset of the histogram in the statistics
+ * @param nbuckets	The number of buckets of the histogram
+ */
+static void
+dprintPollHistogram(DCB *dcb, char *title, char *unit, size_t offset,
+		    int nbuckets)
+{
+int	i, j, total;
+
+	dcb_printf(dcb, "%s\n", title);
+	for (i = 0; i < nbuckets; i++)
+	{
+		for (j = 0, total = 0; j <= n_threads; j++)
+			total += ((int *)((char *)&pollStats[j] + offset))[i];
+		if (i == nbuckets - 1)
+			dcb_printf(dcb, "	>= %-10lu %-3s	%d\n",
+				   1UL << i, unit, total);
+		else
+			dcb_printf(dcb, "	%4lu - %-7lu %-3s	%d\n",
+				   i == 0 ? 0UL : 1UL << i,
+				   (2UL << i) - 1,
+				   unit,
+				   total);
+	}
+}
+
+/**
+ * Debug routine to print the polling statistics. The statistics of the
+ * threads are merged for the totals and the histograms, the busy time of
+ * each thread shows how close it is to being saturated.
  *
  * @param dcb	DCB to print to
  */
 void
 dprintPollStats(DCB *dcb)
 {
-	dcb_printf(dcb, "Number of epoll cycles: 	%d\n", pollStats.n_polls);
-	dcb_printf(dcb, "Number of read events:   	%d\n", pollStats.n_read);
-	dcb_printf(dcb, "Number of write events: 	%d\n", pollStats.n_write);
-	dcb_printf(dcb, "Number of error events: 	%d\n", pollStats.n_error);
-	dcb_printf(dcb, "Number of hangup events:	%d\n", pollStats.n_hup);
-	dcb_printf(dcb, "Number of accept events:	%d\n", pollStats.n_accept);
+POLL_STATS	total;
+int		i;
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i <= n_threads; i++)
+	{
+		total.n_polls += pollStats[i].n_polls;
+		total.n_read += pollStats[i].n_read;
+		total.n_write += pollStats[i].n_write;
+		total.n_write_idle += pollStats[i].n_write_idle;
+		total.n_pollout += pollStats[i].n_pollout;
+		total.n_ready += pollStats[i].n_ready;
+		total.n_handoff += pollStats[i].n_handoff;
+		total.n_error += pollStats[i].n_error;
+		total.n_hup += pollStats[i].n_hup;
+		total.n_accept += pollStats[i].n_accept;
+		total.n_events += pollStats[i].n_events;
+	}
+	dcb_printf(dcb, "Event backend:          	%s\n",
+		rings != NULL ? "io_uring" : "epoll");
+	dcb_printf(dcb, "Number of epoll cycles: 	%d\n", total.n_polls);
+	dcb_printf(dcb, "Number of events:       	%lu\n", total.n_events);
+	dcb_printf(dcb, "Number of read events:   	%d\n", total.n_read);
+	dcb_printf(dcb, "Number of write events: 	%d\n", total.n_write);
+	dcb_printf(dcb, "Number of idle write events:	%d\n",
+		total.n_write_idle);
+	dcb_printf(dcb, "Number of EPOLLOUT enables:	%d\n", total.n_pollout);
+	dcb_printf(dcb, "Number of deferred reads:	%d\n", total.n_ready);
+	dcb_printf(dcb, "Number of error events: 	%d\n", total.n_error);
+	dcb_printf(dcb, "Number of hangup events:	%d\n", total.n_hup);
+	dcb_printf(dcb, "Number of accept events:	%d\n", total.n_accept);
+	dcb_printf(dcb, "Number of accept hand-offs:	%d\n", total.n_handoff);
+	dprintPollHistogram(dcb, "Events per epoll cycle:", "",
+			    offsetof(POLL_STATS, nfds), POLL_NFDS_BUCKETS);
+	dprintPollHistogram(dcb, "Dispatch time per epoll cycle:", "us",
+			    offsetof(POLL_STATS, time), POLL_TIME_BUCKETS);
+	dcb_printf(dcb, "Polling threads:\n");
+	dcb_printf(dcb, "	Thread	Cycles		Events		Busy (ms)\n");
+	for (i = 0; i < n_threads; i++)
+	{
+		dcb_printf(dcb, "	%d	%-10d	%-10lu	%lu\n",
+			   i,
+			   pollStats[i].n_polls,
+			   pollStats[i].n_events,
+			   pollStats[i].busy_us / 1000);
+	}
 }
@@ -30,17 +30,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <netdb.h>
+#include <arpa/inet.h>
 #include <session.h>
 #include <server.h>
 #include <spinlock.h>
 #include <dcb.h>
+#include <config.h>
+#include <thread.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
 
 extern int lm_enabled_logfiles_bitmask;
 
-static SPINLOCK	server_spin = SPINLOCK_INIT;
+static SPINLOCK_CLASS server_class = SPINLOCK_CLASS_INIT("server_spin");
+static SPINLOCK_CLASS addrlock_class = SPINLOCK_CLASS_INIT("server_addrlock");
+static SPINLOCK	server_spin = SPINLOCK_INIT_CLASS(&server_class);
 static SERVER	*allServers = NULL;
+static void	*resolver = NULL;	/**< The resolver thread */
+static int	resolver_shutdown = 0;	/**< Stop the resolver thread */
+
+static int	server_resolve(SERVER *server);
 
 /**
  * Allocate a new server withn the gateway
@@ -62,11 +72,22 @@ SERVER 	*server;
 	server->name = strdup(servname);
 	server->protocol = strdup(protocol);
 	server->port = port;
-	memset(&server->stats, 0, sizeof(SERVER_STATS));
+	server->stats.n_connections = counter_alloc();
+	server->stats.n_current = counter_alloc();
 	server->status = SERVER_RUNNING;
 	server->nextdb = NULL;
 	server->monuser = NULL;
 	server->monpw = NULL;
+	spinlock_init(&server->addrlock);
+	spinlock_set_class(&server->addrlock, &addrlock_class);
+	memset(&server->addr, 0, sizeof(server->addr));
+	server->addr_valid = 0;
+	server->addr_numeric = inet_aton(servname, &server->addr.sin_addr) != 0;
+	/*<
+	 * The name is resolved here, when the configuration is loaded, so
+	 * that connecting to the server never waits for the resolver.
+	 */
+	server_resolve(server);
 
 	spinlock_acquire(&server_spin);
 	server->next = allServers;
@@ -109,6 +130,8 @@ SERVER *ptr;
 	/* Clean up session and free the memory */
 	free(server->name);
 	free(server->protocol);
+	counter_free(server->stats.n_connections);
+	counter_free(server->stats.n_current);
 	free(server);
 	return 1;
 }
@@ -149,8 +172,10 @@ printServer(SERVER *server)
 	printf("\tServer:			%s\n", server->name);
 	printf("\tProtocol:		%s\n", server->protocol);
 	printf("\tPort:			%d\n", server->port);
-	printf("\tTotal connections:	%d\n", server->stats.n_connections);
-	printf("\tCurrent connections:	%d\n", server->stats.n_current);
+	printf("\tTotal connections:	%ld\n",
+		counter_read(server->stats.n_connections));
+	printf("\tCurrent connections:	%ld\n",
+		counter_read(server->stats.n_current));
 }
 
 /**
@@ -197,8 +222,10 @@ char	*stat;
 		free(stat);
 		dcb_printf(dcb, "\tProtocol:		%s\n", ptr->protocol);
 		dcb_printf(dcb, "\tPort:			%d\n", ptr->port);
-		dcb_printf(dcb, "\tNumber of connections:	%d\n", ptr->stats.n_connections);
-		dcb_printf(dcb, "\tCurrent no. of connections:	%d\n", ptr->stats.n_current);
+		dcb_printf(dcb, "\tNumber of connections:	%ld\n",
+			counter_read(ptr->stats.n_connections));
+		dcb_printf(dcb, "\tCurrent no. of connections:	%ld\n",
+			counter_read(ptr->stats.n_current));
 		ptr = ptr->next;
 	}
 	spinlock_release(&server_spin);
@@ -222,8 +249,21 @@ char	*stat;
 	free(stat);
 	dcb_printf(dcb, "\tProtocol:		%s\n", server->protocol);
 	dcb_printf(dcb, "\tPort:			%d\n", server->port);
-	dcb_printf(dcb, "\tNumber of connections:	%d\n", server->stats.n_connections);
-	dcb_printf(dcb, "\tCurrent No. of connections:	%d\n", server->stats.n_current);
+	if (server->addr_valid)
+	{
+		char	addr[INET_ADDRSTRLEN];
+
+		spinlock_acquire(&server->addrlock);
+		inet_ntop(AF_INET, &server->addr.sin_addr, addr, sizeof(addr));
+		spinlock_release(&server->addrlock);
+		dcb_printf(dcb, "\tResolved address:	%s\n", addr);
+	}
+	else
+		dcb_printf(dcb, "\tResolved address:	unresolved\n");
+	dcb_printf(dcb, "\tNumber of connections:	%ld\n",
+		counter_read(server->stats.n_connections));
+	dcb_printf(dcb, "\tCurrent No. of connections:	%ld\n",
+		counter_read(server->stats.n_current));
 }
 
 /**
@@ -335,3 +375,130 @@ server_update(SERVER *server, char *protocol, char *user, char *passwd)
 	}
 }
 
+/**
+ * Resolve the name of a server and store the address in the server. If
+ * the name does not resolve the previous address, if any, is kept.
+ *
+ * @param server	The server to resolve
+ * @return		0 if the name was resolved, -1 otherwise
+ */
+static int
+server_resolve(SERVER *server)
+{
+struct addrinfo		hint, *ai = NULL;
+struct sockaddr_in	addr;
+int			rc, ttl = config_resolve_ttl();
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(server->port);
+	if (server->addr_numeric)
+	{
+		inet_aton(server->name, &addr.sin_addr);
+	}
+	else
+	{
+		memset(&hint, 0, sizeof(hint));
+		hint.ai_family = AF_INET;
+		hint.ai_socktype = SOCK_STREAM;
+		if ((rc = getaddrinfo(server->name, NULL, &hint, &ai)) != 0 ||
+		    ai == NULL)
+		{
+			LOGIF(LE, (skygw_log_write_flush(
+				LOGFILE_ERROR,
+				"Error : Failed to resolve the address of server "
+				"%s, %s.",
+				server->name,
+				gai_strerror(rc))));
+			server->addr_refresh = time(NULL) + SERVER_RESOLVE_RETRY;
+			return -1;
+		}
+		/* take the first one */
+		addr.sin_addr = ((struct sockaddr_in *)ai->ai_addr)->sin_addr;
+		freeaddrinfo(ai);
+	}
+	spinlock_acquire(&server->addrlock);
+	memcpy(&server->addr, &addr, sizeof(addr));
+	server->addr_valid = 1;
+	spinlock_release(&server->addrlock);
+	server->addr_refresh = ttl > 0 ? time(NULL) + ttl : 0;
+	return 0;
+}
+
+/**
+ * Return the address to connect to a server at. The address is the one
+ * cached by the resolver, so this never blocks on a name lookup.
+ *
+ * @param server	The server
+ * @param addr		Where to copy the address to
+ * @return		0 on success, -1 if the name has not been resolved
+ */
+int
+server_get_address(SERVER *server, struct sockaddr_in *addr)
+{
+	if (!server->addr_valid)
+		return -1;
+	spinlock_acquire(&server->addrlock);
+	memcpy(addr, &server->addr, sizeof(struct sockaddr_in));
+	spinlock_release(&server->addrlock);
+	return 0;
+}
+
+/**
+ * The resolver thread, refreshes the addresses of the servers when their
+ * time to live expires and retries the names that failed to resolve.
+ *
+ * @param arg	Unused
+ */
+static void
+server_resolver(void *arg)
+{
+SERVER	*server;
+time_t	now;
+
+	while (!resolver_shutdown)
+	{
+		thread_millisleep(1000);
+		now = time(NULL);
+		/*< Servers are never removed from the list, only added */
+		spinlock_acquire(&server_spin);
+		server = allServers;
+		spinlock_release(&server_spin);
+		for (; server != NULL && !resolver_shutdown; server = server->next)
+		{
+			if (server->addr_numeric && server->addr_valid)
+				continue;
+			if (server->addr_valid && server->addr_refresh == 0)
+				continue;
+			if (server->addr_refresh <= now)
+				server_resolve(server);
+		}
+	}
+}
+
+/**
+ * Start the thread that keeps the addresses of the servers up to date
+ */
+void
+server_resolver_start()
+{
+	if (resolver == NULL)
+	{
+		resolver_shutdown = 0;
+		resolver = thread_start(server_resolver, NULL);
+	}
+}
+
+/**
+ * Stop the resolver thread
+ */
+void
+server_resolver_stop()
+{
+	if (resolver != NULL)
+	{
+		resolver_shutdown = 1;
+		thread_wait(resolver);
+		resolver = NULL;
+	}
+}
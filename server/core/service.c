@@ -45,7 +45,9 @@
 
 extern int lm_enabled_logfiles_bitmask;
 
-static SPINLOCK	service_spin = SPINLOCK_INIT;
+static SPINLOCK_CLASS service_class = SPINLOCK_CLASS_INIT("service_spin");
+static SPINLOCK_CLASS service_lock_class = SPINLOCK_CLASS_INIT("service");
+static SPINLOCK	service_spin = SPINLOCK_INIT_CLASS(&service_class);
 static SERVICE	*allServices = NULL;
 
 /**
@@ -80,7 +82,12 @@ SERVICE 	*service;
 	service->users = users_alloc();
 	service->routerOptions = NULL;
 	service->databases = NULL;
+	service->writeq_high_water = 0;
+	service->writeq_low_water = 0;
+	service->conn_timeout = 0;
+	service->connect_timeout = 0;
 	spinlock_init(&service->spin);
+	spinlock_set_class(&service->spin, &service_lock_class);
 
 	spinlock_acquire(&service_spin);
 	service->next = allServices;
@@ -508,6 +515,58 @@ serviceGetUser(SERVICE *service, char **user, char **auth)
 	return 1;
 }
 
+/**
+ * Set the write queue watermarks for the client connections of a service.
+ *
+ * When the data queued to be written to a client exceeds the high water
+ * mark no more data is read from the backend connections of the session
+ * until the queue has drained below the low water mark. A high water mark
+ * of zero disables the throttling. If no valid low water mark is given
+ * half of the high water mark is used.
+ *
+ * @param service	The service
+ * @param high		The high water mark in bytes
+ * @param low		The low water mark in bytes
+ */
+void
+serviceSetWriteQueueLimits(SERVICE *service, unsigned int high, unsigned int low)
+{
+	if (high && low >= high)
+	{
+		LOGIF(LE, (skygw_log_write_flush(
+			LOGFILE_ERROR,
+			"Error : Service '%s' has a writeq_low_water of %u which "
+			"is not below the writeq_high_water of %u, using %u.",
+			service->name,
+			low,
+			high,
+			high / 2)));
+		low = 0;
+	}
+	if (high && low == 0)
+		low = high / 2;
+	service->writeq_high_water = high;
+	service->writeq_low_water = high ? low : 0;
+}
+
+/**
+ * Set the timeouts of the connections of a service
+ *
+ * Client connections that send nothing for the idle timeout are closed,
+ * backend connections that have not been established within the connect
+ * timeout are treated as failed. A timeout of zero disables it.
+ *
+ * @param service	The service
+ * @param idle		The client idle timeout in seconds
+ * @param connect	The backend connect timeout in seconds
+ */
+void
+serviceSetTimeouts(SERVICE *service, int idle, int connect)
+{
+	service->conn_timeout = idle > 0 ? idle : 0;
+	service->connect_timeout = connect > 0 ? connect : 0;
+}
+
 /**
  * Return a named service
  *
@@ -609,6 +668,15 @@ SERVICE	*ptr;
 		dcb_printf(dcb, "\tUsers data:        	%p\n", ptr->users);
 		dcb_printf(dcb, "\tTotal connections:	%d\n", ptr->stats.n_sessions);
 		dcb_printf(dcb, "\tCurrently connected:	%d\n", ptr->stats.n_current);
+		if (ptr->writeq_high_water)
+			dcb_printf(dcb, "\tWrite queue watermarks:	%u/%u\n",
+					ptr->writeq_high_water, ptr->writeq_low_water);
+		if (ptr->conn_timeout)
+			dcb_printf(dcb, "\tIdle timeout:		%d seconds\n",
+					ptr->conn_timeout);
+		if (ptr->connect_timeout)
+			dcb_printf(dcb, "\tConnect timeout:	%d seconds\n",
+					ptr->connect_timeout);
 		ptr = ptr->next;
 	}
 	spinlock_release(&service_spin);
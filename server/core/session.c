@@ -44,7 +44,9 @@
 
 extern int lm_enabled_logfiles_bitmask;
 
-static SPINLOCK	session_spin = SPINLOCK_INIT;
+static SPINLOCK_CLASS session_class = SPINLOCK_CLASS_INIT("session_spin");
+static SPINLOCK_CLASS ses_lock_class = SPINLOCK_CLASS_INIT("ses_lock");
+static SPINLOCK	session_spin = SPINLOCK_TICKET_INIT_CLASS(&session_class);
 static SESSION	*allSessions = NULL;
 
 /**
@@ -83,6 +85,7 @@ session_alloc(SERVICE *service, DCB *client_dcb)
         session->ses_chk_tail = CHK_NUM_SESSION;
 #endif
         spinlock_init(&session->ses_lock);
+        spinlock_set_class(&session->ses_lock, &ses_lock_class);
         /*<
          * Prevent backend threads from accessing before session is completely
          * initialized.
@@ -24,13 +24,106 @@
  *
  * Date		Who		Description
  * 10/06/13	Mark Riddoch	Initial implementation
+ * 16/10/26	agent		Test-and-test-and-set with backoff, ticket locks
+ * 16/10/26	agent		Named lock classes and lock profiling
  *
  * @endverbatim
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
 #include <spinlock.h>
 #include <atomic.h>
 
+/*< Rounds of pause after the first and after the last failed attempt */
+#define	SPINLOCK_BACKOFF_MIN	4
+#define	SPINLOCK_BACKOFF_MAX	1024
+
+/*<
+ * Rounds of pause after which a waiter gives up the processor, the holder
+ * of the lock, or with a ticket lock the waiter whose turn it is, may not
+ * be running.
+ */
+#define	SPINLOCK_YIELD		256
+
+/*< Tell the processor that this is a spin wait loop */
+#if defined(__i386__) || defined(__x86_64__)
+#define	spinlock_pause()	asm volatile("pause" ::: "memory")
+#else
+#define	spinlock_pause()	asm volatile("" ::: "memory")
+#endif
+
+/*<
+ * Read the lock word afresh on every pass of a spin loop. The read that
+ * finds a ticket lock free is what acquires it, so it has acquire order.
+ */
+#define	SPINLOCK_READ(x)	__atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+
+int			spinlock_profiling = 0;
+static SPINLOCK_CLASS	*lock_classes = NULL;	/*< The registered classes */
+static SPINLOCK		lock_classes_lock = SPINLOCK_INIT;
+
+/**
+ * Return a timestamp in cycles, used to measure the time spent waiting
+ *
+ * @return The timestamp
+ */
+static unsigned long long
+spinlock_cycles()
+{
+#if defined(__i386__) || defined(__x86_64__)
+unsigned int	lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long long)hi << 32) | lo;
+#else
+struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Add a lock class to the list of classes shown in the profile, the list
+ * is only ever added to.
+ *
+ * @param cls	The lock class
+ */
+static void
+spinlock_class_register(SPINLOCK_CLASS *cls)
+{
+	if (!__sync_bool_compare_and_swap(&cls->registered, 0, 1))
+		return;
+	do {
+		cls->next = lock_classes;
+	} while (!__sync_bool_compare_and_swap(&lock_classes, cls->next, cls));
+}
+
+/**
+ * Count an acquisition of a lock in the profile of its class
+ *
+ * @param cls		The lock class
+ * @param spins		The number of failed attempts, 0 if uncontended
+ * @param cycles	The cycles spent waiting
+ */
+static void
+spinlock_profile(SPINLOCK_CLASS *cls, int spins, unsigned long long cycles)
+{
+	if (!cls->registered)
+		spinlock_class_register(cls);
+	/*< A plain increment, an exact count would cost a locked operation */
+	cls->acquired++;
+	if (spins > 0)
+	{
+		__sync_fetch_and_add(&cls->contended, 1);
+		__sync_fetch_and_add(&cls->spins, spins);
+		__sync_fetch_and_add(&cls->cycles, cycles);
+	}
+}
+
 /**
  * Initialise a spinlock.
  *
@@ -40,6 +133,9 @@ void
 spinlock_init(SPINLOCK *lock)
 {
 	lock->lock = 0;
+	lock->next = 0;
+	lock->type = SPINLOCK_TTAS;
+	lock->cls = NULL;
 #ifdef DEBUG
 	lock->spins = 0;
 	lock->acquired = 0;
@@ -47,20 +143,127 @@ spinlock_init(SPINLOCK *lock)
 }
 
 /**
- * Acquire a spinlock.
+ * Initialise a spinlock as a ticket lock, the waiters acquire the lock
+ * in the order they asked for it.
  *
- * @param lock The spinlock to acquire
+ * @param lock The spinlock to initialise.
  */
 void
-spinlock_acquire(SPINLOCK *lock)
+spinlock_init_ticket(SPINLOCK *lock)
+{
+	spinlock_init(lock);
+	lock->type = SPINLOCK_TICKET;
+}
+
+/**
+ * Set the class of a spinlock, the class is used to profile the lock
+ *
+ * @param lock	The spinlock
+ * @param cls	The lock class
+ */
+void
+spinlock_set_class(SPINLOCK *lock, SPINLOCK_CLASS *cls)
 {
-	while (atomic_add(&(lock->lock), 1) != 0)
+	lock->cls = cls;
+}
+
+/**
+ * Wait for the turn of a ticket. A waiter pauses for longer the more
+ * waiters there are ahead of it.
+ *
+ * @param lock		The ticket lock
+ * @param ticket	The ticket of the caller
+ * @return		The number of times the caller had to wait
+ */
+static int
+spinlock_wait_ticket(SPINLOCK *lock, int ticket)
+{
+int	ahead, i, spins = 0, rounds = 0;
+
+	while ((ahead = ticket - SPINLOCK_READ(lock->lock)) != 0)
 	{
-		atomic_add(&(lock->lock), -1);
+		for (i = 0; i < ahead * SPINLOCK_BACKOFF_MIN; i++)
+			spinlock_pause();
+		if ((rounds += i) >= SPINLOCK_YIELD)
+		{
+			sched_yield();
+			rounds = 0;
+		}
+		spins++;
+#ifdef DEBUG
+		atomic_add(&(lock->spins), 1);
+#endif
+	}
+	return spins;
+}
+
+/**
+ * Wait for a test-and-test-and-set lock after a failed attempt to take it
+ *
+ * @param lock	The spinlock
+ * @return	The number of failed attempts
+ */
+static int
+spinlock_wait(SPINLOCK *lock)
+{
+int	backoff = SPINLOCK_BACKOFF_MIN;
+int	i, spins = 0, rounds = 0;
+
+	do {
+		/*< Wait without writing to the lock until it looks free */
+		while (SPINLOCK_READ(lock->lock) != 0)
+		{
+			spinlock_pause();
+			if (++rounds >= SPINLOCK_YIELD)
+			{
+				sched_yield();
+				rounds = 0;
+			}
+		}
+		for (i = 0; i < backoff; i++)
+			spinlock_pause();
+		rounds += backoff;
+		if (backoff < SPINLOCK_BACKOFF_MAX)
+			backoff <<= 1;
+		spins++;
 #ifdef DEBUG
 		atomic_add(&(lock->spins), 1);
 #endif
+	} while (__sync_lock_test_and_set(&(lock->lock), 1) != 0);
+	return spins;
+}
+
+/**
+ * Acquire a spinlock.
+ *
+ * @param lock The spinlock to acquire
+ */
+void
+spinlock_acquire(SPINLOCK *lock)
+{
+unsigned long long	start = 0;
+int			ticket, spins = 0;
+
+	if (lock->type == SPINLOCK_TICKET)
+	{
+		ticket = atomic_add(&(lock->next), 1);
+		if (SPINLOCK_READ(lock->lock) != ticket)
+		{
+			if (spinlock_profiling)
+				start = spinlock_cycles();
+			spins = spinlock_wait_ticket(lock, ticket);
+		}
+	}
+	else if (__sync_lock_test_and_set(&(lock->lock), 1) != 0)
+	{
+		if (spinlock_profiling)
+			start = spinlock_cycles();
+		spins = spinlock_wait(lock);
 	}
+	/*< Profiling may have been enabled whilst the caller waited */
+	if (spinlock_profiling && lock->cls != NULL)
+		spinlock_profile(lock->cls, spins,
+				 start != 0 ? spinlock_cycles() - start : 0);
 #ifdef DEBUG
 	lock->acquired++;
 	lock->owner = THREAD_SHELF();
@@ -76,11 +279,21 @@ spinlock_acquire(SPINLOCK *lock)
 int
 spinlock_acquire_nowait(SPINLOCK *lock)
 {
-	if (atomic_add(&(lock->lock), 1) != 0)
+int	serving;
+
+	if (lock->type == SPINLOCK_TICKET)
+	{
+		serving = SPINLOCK_READ(lock->lock);
+		if (!__sync_bool_compare_and_swap(&(lock->next), serving, serving + 1))
+			return FALSE;
+	}
+	else if (SPINLOCK_READ(lock->lock) != 0 ||
+		 __sync_lock_test_and_set(&(lock->lock), 1) != 0)
 	{
-		atomic_add(&(lock->lock), -1);
 		return FALSE;
 	}
+	if (spinlock_profiling && lock->cls != NULL)
+		spinlock_profile(lock->cls, 0, 0);
 #ifdef DEBUG
 	lock->acquired++;
 	lock->owner = THREAD_SHELF();
@@ -96,5 +309,95 @@ spinlock_acquire_nowait(SPINLOCK *lock)
 void
 spinlock_release(SPINLOCK *lock)
 {
-	atomic_add(&(lock->lock), -1);
+	if (lock->type == SPINLOCK_TICKET)
+	{
+		/*< Only the holder writes the ticket being served */
+		__atomic_store_n(&(lock->lock), lock->lock + 1, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		__sync_lock_release(&(lock->lock));
+	}
+}
+
+/**
+ * Return the lock class with a given name, the class is created if there
+ * is none. This is used for the locks that are named at run time.
+ *
+ * @param name	The name of the class
+ * @return	The lock class or NULL if no memory could be allocated
+ */
+SPINLOCK_CLASS *
+spinlock_class(const char *name)
+{
+SPINLOCK_CLASS	*cls;
+
+	spinlock_acquire(&lock_classes_lock);
+	for (cls = lock_classes; cls != NULL; cls = cls->next)
+	{
+		if (strcmp(cls->name, name) == 0)
+			break;
+	}
+	if (cls == NULL &&
+	    (cls = (SPINLOCK_CLASS *)calloc(1, sizeof(SPINLOCK_CLASS))) != NULL)
+	{
+		if ((cls->name = strdup(name)) == NULL)
+		{
+			free(cls);
+			cls = NULL;
+		}
+		else
+		{
+			spinlock_class_register(cls);
+		}
+	}
+	spinlock_release(&lock_classes_lock);
+	return cls;
+}
+
+/**
+ * Return the registered lock classes, the most contended first
+ *
+ * @param classes	The array to fill
+ * @param max		The size of the array
+ * @return		The number of classes returned
+ */
+int
+spinlock_class_list(SPINLOCK_CLASS **classes, int max)
+{
+SPINLOCK_CLASS	*cls;
+int		i, j, n = 0;
+
+	for (cls = lock_classes; cls != NULL; cls = cls->next)
+	{
+		/*< Insertion sort, keeping the most contended classes */
+		for (i = n; i > 0 && classes[i - 1]->contended < cls->contended; i--)
+			;
+		if (i >= max)
+			continue;
+		if (n < max)
+			n++;
+		for (j = n - 1; j > i; j--)
+			classes[j] = classes[j - 1];
+		classes[i] = cls;
+	}
+	return n;
+}
+
+/**
+ * Clear the profiles of all the lock classes
+ */
+void
+spinlock_profile_reset()
+{
+SPINLOCK_CLASS	*cls;
+
+	for (cls = lock_classes; cls != NULL; cls = cls->next)
+	{
+		cls->acquired = 0;
+		cls->contended = 0;
+		cls->spins = 0;
+		cls->cycles = 0;
+	}
 }
+
@@ -0,0 +1,401 @@
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2013
+ */
+
+/**
+ * @file splice.c  - Zero copy byte pump between the DCBs of a session
+ *
+ * The pump is shared by the client and the backend DCB of a session and
+ * has one pipe for each direction. When a DCB becomes readable the data is
+ * spliced from its socket into the pipe and from the pipe to the socket of
+ * the peer DCB. If the peer can not take all of the data it is left in the
+ * pipe, no more data is read from the DCB until the EPOLLOUT event of the
+ * peer has flushed the pipe.
+ *
+ * The data sent by the client is passed through a filter one packet at a
+ * time, this allows the protocol module to take over for packets that
+ * change the state of the session. Once it has done so the pump is disabled
+ * and the data flows through the normal buffer based path.
+ *
+ * To preserve the order of the data the pump is only used whilst the write
+ * queue of the peer is empty, otherwise the caller reads the data itself.
+ * The buffer based path does not read the client data a packet at a time,
+ * so once it has read any of it the pump is disabled for good.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <splice.h>
+#include <dcb.h>
+#include <poll.h>
+#include <atomic.h>
+#include <skygw_utils.h>
+#include <log_manager.h>
+
+extern int lm_enabled_logfiles_bitmask;
+
+/**
+ * Create the pipe for one direction of the pump
+ *
+ * @param p	The pipe to initialise
+ * @return	0 on success, -1 on error
+ */
+static int
+splice_pipe_init(SPLICE_PIPE *p)
+{
+	spinlock_init(&p->lock);
+	p->pending = 0;
+	p->packet_left = 0;
+	p->bytes = 0;
+	if (pipe2(p->fds, O_NONBLOCK|O_CLOEXEC) != 0)
+	{
+		p->fds[0] = p->fds[1] = -1;
+		return -1;
+	}
+	/*< A larger pipe means fewer round trips, but it is only a request */
+	fcntl(p->fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+	return 0;
+}
+
+/**
+ * Close the pipe of one direction of the pump
+ *
+ * @param p	The pipe to close
+ */
+static void
+splice_pipe_close(SPLICE_PIPE *p)
+{
+	if (p->fds[0] != -1)
+		close(p->fds[0]);
+	if (p->fds[1] != -1)
+		close(p->fds[1]);
+	p->fds[0] = p->fds[1] = -1;
+}
+
+/**
+ * Move the data held in a pipe to a socket
+ *
+ * NB This is called with the caller holding the pipe spinlock
+ *
+ * @param p	The pipe
+ * @param fd	The socket to write to
+ * @return	0 if the pipe is empty, 1 if the socket is full or -1 on error
+ */
+static int
+splice_flush(SPLICE_PIPE *p, int fd)
+{
+ssize_t	n;
+
+	while (p->pending > 0)
+	{
+		n = splice(p->fds[0], NULL, fd, NULL, p->pending,
+			   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if (n <= 0)
+		{
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				return 1;
+			return -1;
+		}
+		p->pending -= n;
+		p->bytes += n;
+	}
+	return 0;
+}
+
+/**
+ * Start moving the data of a session with the byte pump. This is called
+ * once the session is authenticated and the data no longer needs to be
+ * examined by the protocol modules.
+ *
+ * @param client	The client DCB of the session
+ * @param backend	The backend DCB of the session
+ * @param filter	The filter for the packets sent by the client
+ * @return		0 on success, -1 if the pump could not be created
+ */
+int
+splice_enable(DCB *client, DCB *backend, SPLICE_FILTER filter)
+{
+SPLICE	*sp;
+
+	if (client->splice != NULL || backend->splice != NULL)
+		return -1;
+	if ((sp = (SPLICE *)calloc(1, sizeof(SPLICE))) == NULL)
+		return -1;
+	if (splice_pipe_init(&sp->upstream) != 0 ||
+	    splice_pipe_init(&sp->downstream) != 0)
+	{
+		int eno = errno;
+
+		LOGIF(LE, (skygw_log_write_flush(
+			LOGFILE_ERROR,
+			"Error : Failed to create the pipes to splice dcb %p "
+			"and dcb %p, due %d, %s.",
+			client,
+			backend,
+			eno,
+			strerror(eno))));
+		splice_pipe_close(&sp->upstream);
+		splice_pipe_close(&sp->downstream);
+		free(sp);
+		return -1;
+	}
+	sp->client = client;
+	sp->backend = backend;
+	sp->filter = filter;
+	sp->refcount = 2;
+
+	/*< The pump must be complete before the DCBs can see it */
+	__sync_synchronize();
+	client->splice = sp;
+	backend->splice = sp;
+
+	LOGIF(LD, (skygw_log_write(
+		LOGFILE_DEBUG,
+		"%lu [splice_enable] Splicing client dcb %p fd %d and backend "
+		"dcb %p fd %d.",
+		pthread_self(),
+		client,
+		client->fd,
+		backend,
+		backend->fd)));
+	return 0;
+}
+
+/**
+ * Move the data that is available on a DCB to its peer. This is called
+ * from the EPOLLIN handling of a DCB that is part of a pump.
+ *
+ * @param dcb	The DCB that is readable
+ * @return	SPLICE_DONE if the data has been dealt with or SPLICE_FALLBACK
+ *		if the caller must read the data through the normal path
+ */
+int
+splice_read(DCB *dcb)
+{
+SPLICE		*sp = dcb->splice;
+SPLICE_PIPE	*p;
+DCB		*peer;
+unsigned char	hdr[SPLICE_PEEK_SIZE];
+ssize_t		n;
+size_t		len;
+int		plen, pending, rc = SPLICE_DONE;
+
+	if (sp == NULL || sp->closed)
+		return SPLICE_FALLBACK;
+	if (dcb == sp->client)
+	{
+		p = &sp->upstream;
+		peer = sp->backend;
+	}
+	else
+	{
+		p = &sp->downstream;
+		peer = sp->client;
+	}
+
+	spinlock_acquire(&p->lock);
+	/*<
+	 * Data that is left in the pipe must reach the peer first, until
+	 * then the data is left in the socket.
+	 */
+	if (p->pending > 0 && splice_flush(p, peer->fd) != 0)
+		goto return_rc;
+
+	if (sp->disabled || !GWBUF_QUEUE_EMPTY(&peer->writeq))
+	{
+		rc = SPLICE_FALLBACK;
+		goto return_rc;
+	}
+
+	while (true)
+	{
+		if (p == &sp->upstream && sp->filter != NULL)
+		{
+			if (p->packet_left == 0)
+			{
+				n = recv(dcb->fd, hdr, SPLICE_PEEK_SIZE, MSG_PEEK);
+				if (n <= 0)
+				{
+					if (n == 0 ||
+					    (errno != EAGAIN && errno != EWOULDBLOCK))
+						rc = SPLICE_FALLBACK;
+					break;
+				}
+				if ((plen = sp->filter(hdr, n)) == 0)
+					break;
+				if (plen < 0)
+				{
+					/*< The protocol module takes over */
+					sp->disabled = 1;
+					rc = SPLICE_FALLBACK;
+					break;
+				}
+				p->packet_left = plen;
+			}
+			len = p->packet_left;
+		}
+		else
+		{
+			len = SPLICE_PIPE_SIZE;
+		}
+		n = splice(dcb->fd, NULL, p->fds[1], NULL, len,
+			   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if (n <= 0)
+		{
+			/*<
+			 * The protocol module deals with the connection being
+			 * closed or failing.
+			 */
+			if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+				rc = SPLICE_FALLBACK;
+			break;
+		}
+		dcb->stats.n_reads++;
+		p->pending += n;
+		if (p == &sp->upstream)
+			p->packet_left -= n;
+		if (splice_flush(p, peer->fd) != 0)
+			break;
+	}
+return_rc:
+	if (rc == SPLICE_FALLBACK && p == &sp->upstream)
+	{
+		sp->disabled = 1;
+		p->packet_left = 0;
+	}
+	pending = p->pending;
+	spinlock_release(&p->lock);
+
+	/*< The peer flushes the pipe when it signals EPOLLOUT */
+	if (pending > 0)
+		poll_update_dcb(peer, EPOLLOUT, 0);
+	return rc;
+}
+
+/**
+ * Flush the data that is waiting in the pump for a DCB that has become
+ * writable. This is called from the EPOLLOUT handling of the DCB.
+ *
+ * No data is read from the source DCB whilst the pipe is not empty, so
+ * once it has been flushed the source is re-armed, so that any data that
+ * is still waiting in its socket causes a new EPOLLIN event.
+ *
+ * @param dcb	The DCB that is writable
+ */
+void
+splice_write_ready(DCB *dcb)
+{
+SPLICE		*sp = dcb->splice;
+SPLICE_PIPE	*p;
+DCB		*source;
+int		rc;
+
+	if (sp == NULL || sp->closed)
+		return;
+	if (dcb == sp->client)
+	{
+		p = &sp->downstream;
+		source = sp->backend;
+	}
+	else
+	{
+		p = &sp->upstream;
+		source = sp->client;
+	}
+	spinlock_acquire(&p->lock);
+	if (p->pending == 0)
+	{
+		spinlock_release(&p->lock);
+		return;
+	}
+	rc = splice_flush(p, dcb->fd);
+	spinlock_release(&p->lock);
+
+	if (rc == 0)
+		poll_update_dcb(source, 0, 0);
+}
+
+/**
+ * Stop the pump because data has been, or is about to be, moved through
+ * the buffer based path at a point the pump can not carry on from.
+ *
+ * @param dcb	Either of the DCBs of the pump
+ */
+void
+splice_disable(DCB *dcb)
+{
+	if (dcb->splice != NULL)
+		dcb->splice->disabled = 1;
+}
+
+/**
+ * Return the number of bytes the pump holds for a DCB, that is the data
+ * that has been read from its peer but not yet written to it.
+ *
+ * @param dcb	The DCB data is written to
+ * @return	The number of bytes waiting in the pipe
+ */
+int
+splice_pending(DCB *dcb)
+{
+SPLICE	*sp = dcb->splice;
+
+	if (sp == NULL || sp->closed)
+		return 0;
+	return dcb == sp->client ? sp->downstream.pending : sp->upstream.pending;
+}
+
+/**
+ * Stop the pump because one of its DCBs is being closed. Any data that
+ * is still held in the pipes is discarded along with the session.
+ *
+ * @param dcb	The DCB that is closing
+ */
+void
+splice_close(DCB *dcb)
+{
+	if (dcb->splice != NULL)
+		dcb->splice->closed = 1;
+}
+
+/**
+ * Release the reference a DCB holds on a pump, the pipes are closed when
+ * the last reference is released. This is called when the DCB is freed.
+ *
+ * @param dcb	The DCB being freed
+ */
+void
+splice_release(DCB *dcb)
+{
+SPLICE	*sp = dcb->splice;
+
+	if (sp == NULL)
+		return;
+	dcb->splice = NULL;
+	if (atomic_add(&sp->refcount, -1) == 1)
+	{
+		splice_pipe_close(&sp->upstream);
+		splice_pipe_close(&sp->downstream);
+		free(sp);
+	}
+}
@@ -1,12 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "../../include/hashtable.h"
 
 static int hfun(void* key);
 static int cmpfun (void *, void *);
 
+static const int bench_sizes[] = { 1000, 100000, 1000000 };
+
+#define ITERATE_NAMES   512     /** Names added and deleted by the writer */
+#define ITERATE_OPS     200000  /** Adds and deletes made by the writer */
+
+static volatile int iterate_done;
+
 static int hfun(
         void* key)
 {
@@ -30,9 +39,221 @@ static int cmpfun(
 
 
 
+/**
+ * @node Return the time since an earlier time in milliseconds
+ */
+static double elapsed(
+        struct timespec* start)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec - start->tv_sec) * 1000.0 +
+                (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/** 
+ * @node Fill a table of the given layout and time the adds, the fetches of
+ * present and missing keys and the deletes.
+ *
+ * Parameters:
+ * @param flags - in, use
+ *          the flags of hashtable_alloc
+ *
+ * @param nelems - in, use
+ *          number of elements to add
+ *
+ * @return 0 on success, 1 if a fetch returned the wrong value
+ *
+ */
+static int bench(
+        int flags,
+        int nelems)
+{
+        HASHTABLE*      h;
+        struct timespec start;
+        int*            val_arr;
+        int*            order;
+        int             i;
+        int             j;
+        int             tmp;
+        int             miss;
+        unsigned int    seed = 1;
+        int             rc = 0;
+        double          add_ms, hit_ms, miss_ms, del_ms;
+
+        val_arr = (int *)malloc(sizeof(int) * nelems * 2);
+        order = (int *)malloc(sizeof(int) * nelems * 2);
+
+        for (i = 0; i < nelems * 2; i++) {
+            val_arr[i] = i;
+            order[i] = i;
+        }
+        /** The keys are looked up in a random order, as connections do */
+        for (i = nelems - 1; i > 0; i--) {
+            j = rand_r(&seed) % (i + 1);
+            tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+        }
+        /** Start small, so the time of the adds includes the growth */
+        h = hashtable_alloc(16, hfun, cmpfun, flags);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < nelems; i++) {
+            hashtable_add(h, (void *)&val_arr[i], (void *)&val_arr[i]);
+        }
+        add_ms = elapsed(&start);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < nelems; i++) {
+            j = order[i];
+            if (hashtable_fetch(h, (void *)&val_arr[j]) != &val_arr[j]) {
+                rc = 1;
+            }
+        }
+        hit_ms = elapsed(&start);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = nelems, miss = 0; i < nelems * 2; i++) {
+            if (hashtable_fetch(h, (void *)&val_arr[i]) == NULL) {
+                miss++;
+            }
+        }
+        miss_ms = elapsed(&start);
+
+        if (miss != nelems) {
+            rc = 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < nelems; i++) {
+            hashtable_delete(h, (void *)&val_arr[order[i]]);
+        }
+        del_ms = elapsed(&start);
+
+        fprintf(stderr, "%-8s %8d %10.1f %10.1f %10.1f %10.1f\n",
+                (flags & HASHTABLE_OPEN) ? "open" : "chained",
+                nelems,
+                add_ms * 1000000.0 / nelems,
+                hit_ms * 1000000.0 / nelems,
+                miss_ms * 1000000.0 / nelems,
+                del_ms * 1000000.0 / nelems);
+
+        hashtable_free(h);
+        free(order);
+        free(val_arr);
+        return rc;
+}
+
+/**
+ * @node Return the hash of a string key
+ */
+static int shfun(
+        void* key)
+{
+        unsigned int  hash = 5381;
+        char*         ptr = (char *)key;
+
+        while (*ptr) {
+            hash = hash * 33 + (unsigned char)*ptr++;
+        }
+        return (int)hash;
+}
+
+/**
+ * @node Make the name of an entry of the iterate test, the odd entries
+ * have names too long to be held in a slot.
+ */
+static void iterate_name(
+        char* buf,
+        int   i)
+{
+        sprintf(buf, (i & 1) ? "a_long_user_name_%d" : "u%d", i);
+}
+
+/**
+ * @node The writer of the iterate test, adds and deletes entries at random
+ */
+static void* iterate_writer(
+        void* arg)
+{
+        HASHTABLE*   h = (HASHTABLE *)arg;
+        unsigned int seed = 1;
+        char         name[40];
+        int          i;
+
+        for (i = 0; i < ITERATE_OPS; i++) {
+            iterate_name(name, rand_r(&seed) % ITERATE_NAMES);
+            if (rand_r(&seed) & 1) {
+                hashtable_add(h, name, name);
+            } else {
+                hashtable_delete(h, name);
+            }
+        }
+        iterate_done = 1;
+        return NULL;
+}
+
+/**
+ * @node Iterate over an open table with string keys whilst another thread
+ * adds and deletes entries, the keys returned must remain valid names.
+ *
+ * @return 0 on success, 1 if an invalid key was returned
+ */
+static int iterate(void)
+{
+        HASHTABLE*    h;
+        HASHITERATOR* iter;
+        pthread_t     writer;
+        char*         key;
+        char          name[40];
+        int           i;
+        int           n;
+        int           passes = 0;
+        int           rc = 0;
+
+        h = hashtable_alloc(16, shfun, strcmp, HASHTABLE_OPEN|HASHTABLE_STRING_KEYS);
+        hashtable_memory_fns(h, (HASHMEMORYFN)strdup, (HASHMEMORYFN)strdup,
+                             (HASHMEMORYFN)free, (HASHMEMORYFN)free);
+        for (i = 0; i < ITERATE_NAMES; i += 2) {
+            iterate_name(name, i);
+            hashtable_add(h, name, name);
+        }
+        iterate_done = 0;
+        pthread_create(&writer, NULL, iterate_writer, h);
+
+        while (!iterate_done) {
+            if ((iter = hashtable_iterator(h)) == NULL) {
+                continue;
+            }
+            while ((key = hashtable_next(iter)) != NULL) {
+                if (sscanf(key, (key[0] == 'u') ? "u%d" : "a_long_user_name_%d", &n) != 1 ||
+                    n < 0 || n >= ITERATE_NAMES) {
+                    fprintf(stderr, "Invalid key \"%s\" returned.\n", key);
+                    rc = 1;
+                    continue;
+                }
+                iterate_name(name, n);
+                if (strcmp(key, name) != 0) {
+                    fprintf(stderr, "Invalid key \"%s\" returned.\n", key);
+                    rc = 1;
+                }
+            }
+            hashtable_iterator_free(iter);
+            passes++;
+        }
+        pthread_join(writer, NULL);
+        fprintf(stderr, "Iterated %d times whilst the table changed.\n", passes);
+        hashtable_free(h);
+        return rc;
+}
+
 /** 
  * @node Simple test which creates hashtable and frees it. Size and number of entries
- * sre specified by user and passed as arguments.
+ * sre specified by user and passed as arguments. Both the chained and the
+ * open addressing layouts are tested. With the single argument "bench" the
+ * layouts are compared at 1k, 100k and 1M entries instead, with "iterate"
+ * a table is iterated whilst it changes.
  *
  * Parameters:
  * @param argc - <usage>
@@ -52,57 +273,86 @@ int main(int argc, char** argv)
         HASHTABLE* h;
         int        nelems;
         int        i;
+        int        j;
         int*       val_arr;
         int        argsize;
         int        hsize;
         int        argelems;
         int        longest;
+        int        layouts[] = { 0, HASHTABLE_OPEN };
+
+        if (argc == 2 && strcmp(argv[1], "bench") == 0) {
+            int rc = 0;
+
+            fprintf(stderr, "%-8s %8s %10s %10s %10s %10s\n",
+                    "layout", "entries", "add ns", "hit ns", "miss ns",
+                    "delete ns");
+            for (i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+                for (j = 0; j < 2; j++) {
+                    rc |= bench(layouts[j], bench_sizes[i]);
+                }
+            }
+            return rc;
+        }
+
+        if (argc == 2 && strcmp(argv[1], "iterate") == 0) {
+            return iterate();
+        }
 
         if (argc != 3) {
             fprintf(stderr, "\nWrong number of arguments. Usage "
                     ":\n\n\ttesthash <# of elements> <# hash size> "
-                    "<hash function> <compare function>\n\n");
+                    "<hash function> <compare function>\n"
+                    "\ttesthash bench\n"
+                    "\ttesthash iterate\n\n");
             return 1;
         }
 
         argelems = strtol(argv[1], NULL, 10);
         argsize  = strtol(argv[2], NULL, 10);
 
-        ss_dfprintf(stderr,
-                    "testhash : creating hash table of size %d, including %d "
-                    "elements in total.",
-                    argsize,
-                    argelems); 
-        
         val_arr = (int *)malloc(sizeof(void *)*argelems);
-        
-        h = hashtable_alloc(argsize, hfun, cmpfun);
 
-        ss_dfprintf(stderr, "\t..done\nAdd %d elements to hash table.", argelems);
+        for (j = 0; j < 2; j++) {
+            ss_dfprintf(stderr,
+                        "testhash : creating %s hash table of size %d, "
+                        "including %d elements in total.",
+                        layouts[j] ? "open" : "chained",
+                        argsize,
+                        argelems); 
+
+            h = hashtable_alloc(argsize, hfun, cmpfun, layouts[j]);
+
+            ss_dfprintf(stderr, "\t..done\nAdd %d elements to hash table.", argelems);
         
-        for (i=0; i<argelems; i++) {
-            val_arr[i] = i;
-            hashtable_add(h, (void *)&val_arr[i], (void *)&val_arr[i]);
-        }
+            for (i=0; i<argelems; i++) {
+                val_arr[i] = i;
+                hashtable_add(h, (void *)&val_arr[i], (void *)&val_arr[i]);
+            }
 
-        ss_dfprintf(stderr, "\t..done\nRead hash table statistics.");
+            ss_dfprintf(stderr, "\t..done\nRead hash table statistics.");
         
-        hashtable_get_stats((void *)h, &hsize, &nelems, &longest);
+            nelems = 0;
+            longest = 0;
+            hashtable_get_stats((void *)h, &hsize, &nelems, &longest);
 
-        ss_dfprintf(stderr, "\t..done\nValidate read values.");
+            ss_dfprintf(stderr, "\t..done\nValidate read values.");
         
-        ss_info_dassert(hsize == argsize, "Invalid hash size");
-        ss_info_dassert((nelems == argelems) || (nelems == 0 && argsize == 0),
-                        "Invalid element count");
-        ss_info_dassert(longest <= nelems, "Too large longest list value");
+            ss_info_dassert(hsize >= argsize, "Invalid hash size");
+            ss_info_dassert((nelems == argelems) || (nelems == 0 && argsize == 0),
+                            "Invalid element count");
+            ss_info_dassert(longest <= nelems, "Too large longest list value");
 
-        ss_dfprintf(stderr, "\t\t..done\n\nTest completed successfully.\n\n");
+            for (i=0; i<argelems && argsize > 0; i++) {
+                ss_info_dassert(hashtable_fetch(h, (void *)&val_arr[i]) == &val_arr[i],
+                                "Invalid fetched value");
+            }
+
+            ss_dfprintf(stderr, "\t\t..done\n\nTest completed successfully.\n\n");
         
-        CHK_HASHTABLE(h);
-        hashtable_free(h);
+            CHK_HASHTABLE(h);
+            hashtable_free(h);
+        }
+        free(val_arr);
         return 0;
 }
-
-
-
-
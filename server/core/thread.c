@@ -15,8 +15,26 @@
  *
  * Copyright SkySQL Ab 2013
  */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include <thread.h>
 #include <pthread.h>
+#include <skygw_utils.h>
+#include <log_manager.h>
+
+extern int lm_enabled_logfiles_bitmask;
+
+static int	thread_cpu_node(int);
+
+__thread int	thread_node = -1;
 /**
  * @file thread.c  - Implementation of thread related operations
  *
@@ -62,6 +80,160 @@ void	*rval;
 	pthread_join((pthread_t)thd, &rval);
 }
 
+/**
+ * Bind the calling thread to the CPUs given for it in an affinity
+ * specification and, optionally, make its memory allocations prefer the
+ * NUMA node of those CPUs.
+ *
+ * The specification is a list of CPUs, such as "0-3,8-11", each thread is
+ * then bound to a single CPU of the list in turn. Groups of CPUs may be
+ * separated by colons, such as "0-7:8-15", each thread is then bound to a
+ * whole group in turn.
+ *
+ * @param spec		The affinity specification
+ * @param thread_id	The index of the calling thread
+ * @param numa_local	Prefer the memory of the node of the CPUs, the node
+ *			is then recorded in thread_node
+ * @return		0 on success, -1 on error
+ */
+int
+thread_bind(const char *spec, int thread_id, int numa_local)
+{
+cpu_set_t	group_set, set;
+char		*copy, *group, *item, *gsave, *isave;
+int		groups, count, n, cpu, first, last, node, rc;
+unsigned long	nodemask = 0;
+
+	if ((copy = strdup(spec)) == NULL)
+		return -1;
+	groups = 1;
+	for (item = copy; *item; item++)
+		if (*item == ':')
+			groups++;
+
+	/*< Select the group of CPUs for the thread */
+	group = strtok_r(copy, ":", &gsave);
+	for (n = 0; group != NULL && n < thread_id % groups; n++)
+		group = strtok_r(NULL, ":", &gsave);
+
+	CPU_ZERO(&group_set);
+	item = group != NULL ? strtok_r(group, ",", &isave) : NULL;
+	for (; item != NULL; item = strtok_r(NULL, ",", &isave))
+	{
+		if (sscanf(item, "%d-%d", &first, &last) != 2)
+		{
+			if (sscanf(item, "%d", &first) != 1)
+				continue;
+			last = first;
+		}
+		for (cpu = first; cpu >= 0 && cpu <= last && cpu < CPU_SETSIZE; cpu++)
+			CPU_SET(cpu, &group_set);
+	}
+	free(copy);
+
+	if ((count = CPU_COUNT(&group_set)) == 0)
+	{
+		LOGIF(LE, (skygw_log_write_flush(
+			LOGFILE_ERROR,
+			"Error : Invalid thread affinity \"%s\" for thread %d.",
+			spec,
+			thread_id)));
+		return -1;
+	}
+
+	/*< A single group is shared out one CPU per thread */
+	if (groups == 1)
+	{
+		CPU_ZERO(&set);
+		for (cpu = 0, n = thread_id % count; cpu < CPU_SETSIZE; cpu++)
+		{
+			if (CPU_ISSET(cpu, &group_set) && n-- == 0)
+			{
+				CPU_SET(cpu, &set);
+				break;
+			}
+		}
+	}
+	else
+	{
+		set = group_set;
+	}
+
+	if ((rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+	{
+		LOGIF(LE, (skygw_log_write_flush(
+			LOGFILE_ERROR,
+			"Error : Failed to bind thread %d to its CPUs, %d, %s.",
+			thread_id,
+			rc,
+			strerror(rc))));
+		return -1;
+	}
+
+	if (!numa_local)
+		return 0;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (CPU_ISSET(cpu, &set) &&
+		    (node = thread_cpu_node(cpu)) >= 0 &&
+		    node < (int)(sizeof(nodemask) * 8))
+		{
+			nodemask |= 1UL << node;
+		}
+	}
+	/*< CPUs that span several nodes have no single local node */
+	if (nodemask == 0 || (nodemask & (nodemask - 1)) != 0)
+		return 0;
+	/*<
+	 * Memory the thread touches first, its buffers and the DCBs it
+	 * allocates, then comes from the node of its CPUs when possible.
+	 */
+	if (syscall(SYS_set_mempolicy,
+		    MPOL_PREFERRED,
+		    &nodemask,
+		    sizeof(nodemask) * 8) != 0)
+	{
+		LOGIF(LE, (skygw_log_write_flush(
+			LOGFILE_ERROR,
+			"Error : Failed to set the memory policy of thread %d, "
+			"%d, %s.",
+			thread_id,
+			errno,
+			strerror(errno))));
+		return -1;
+	}
+	thread_node = __builtin_ctzl(nodemask);
+	return 0;
+}
+
+/**
+ * Find the NUMA node of a CPU
+ *
+ * @param cpu	The CPU
+ * @return	The node of the CPU or -1 if it is not known
+ */
+static int
+thread_cpu_node(int cpu)
+{
+char		path[80];
+DIR		*dir;
+struct dirent	*entry;
+int		node = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	if ((dir = opendir(path)) == NULL)
+		return -1;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (strncmp(entry->d_name, "node", 4) == 0 &&
+		    sscanf(entry->d_name + 4, "%d", &node) == 1)
+			break;
+		node = -1;
+	}
+	closedir(dir);
+	return node;
+}
+
 /**
  * Put the thread to sleep for a number of milliseconds
  *
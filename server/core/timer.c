@@ -0,0 +1,345 @@
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2013
+ */
+
+/**
+ * @file timer.c  - The timer wheels of the polling threads
+ *
+ * The first level of a wheel has a slot for each of the next 256 ticks.
+ * Timers that are due later are held in the coarser slots of the higher
+ * levels, each slot of a level covers a whole turn of the level below.
+ * When the first level completes a turn the next slot of the level above
+ * is cascaded, its timers are redistributed to the lower levels.
+ *
+ * A timer expires on the wheel of the polling thread it was added to, so
+ * the timers of a DCB are normally added to the wheel of the thread that
+ * owns the DCB. The expired timers are called without the wheel lock held
+ * and at a point at which the thread holds no other locks, so a timer
+ * function may add or cancel timers.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <timer.h>
+#include <spinlock.h>
+#include <poll.h>
+
+/**
+ * The timer wheel of a polling thread
+ */
+typedef struct {
+	SPINLOCK	lock;			/*< Protects the wheel */
+	unsigned long	now;			/*< The next tick to run */
+	int		count;			/*< Number of timers on the wheel */
+	TIMER		*l0[TIMER_L0_SIZE];	/*< The slots of each tick */
+	TIMER		*ln[TIMER_LEVELS][TIMER_LN_SIZE]; /*< The coarser slots */
+} TIMER_WHEEL;
+
+static	TIMER_WHEEL	*wheels = NULL;	/*< The wheels, one per polling thread */
+static	int		n_wheels = 0;	/*< Number of wheels */
+static	SPINLOCK_CLASS	wheel_class = SPINLOCK_CLASS_INIT("timer_wheel");
+
+/**
+ * Create the timer wheels of the polling threads
+ *
+ * @param nthreads	Number of polling threads
+ */
+void
+timer_init(int nthreads)
+{
+int	i;
+
+	if (wheels != NULL)
+		return;
+	if ((wheels = (TIMER_WHEEL *)calloc(nthreads,
+					    sizeof(TIMER_WHEEL))) == NULL)
+	{
+		perror("calloc");
+		exit(-1);
+	}
+	n_wheels = nthreads;
+	for (i = 0; i < nthreads; i++)
+	{
+		spinlock_init(&wheels[i].lock);
+		spinlock_set_class(&wheels[i].lock, &wheel_class);
+		wheels[i].now = timer_now();
+	}
+}
+
+/**
+ * Return the current time in ticks, one tick is a millisecond
+ *
+ * @return The current tick
+ */
+unsigned long
+timer_now()
+{
+struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Place a timer in the slot of a wheel that is due to run it
+ *
+ * NB This is called with the caller holding the wheel spinlock
+ *
+ * @param w	The wheel
+ * @param t	The timer
+ */
+static void
+timer_link(TIMER_WHEEL *w, TIMER *t)
+{
+unsigned long	delta = t->expires - w->now;
+TIMER		**slot;
+int		level, shift;
+
+	if ((long)delta < 0)
+	{
+		slot = &w->l0[w->now & (TIMER_L0_SIZE - 1)];
+	}
+	else if (delta < TIMER_L0_SIZE)
+	{
+		slot = &w->l0[t->expires & (TIMER_L0_SIZE - 1)];
+	}
+	else
+	{
+		if (delta > TIMER_MAX_DELAY)
+		{
+			t->expires = w->now + TIMER_MAX_DELAY;
+			delta = TIMER_MAX_DELAY;
+		}
+		for (level = 0, shift = TIMER_L0_BITS;
+		     level < TIMER_LEVELS - 1 &&
+		     delta >= 1UL << (shift + TIMER_LN_BITS);
+		     level++, shift += TIMER_LN_BITS)
+			;
+		slot = &w->ln[level][(t->expires >> shift) & (TIMER_LN_SIZE - 1)];
+	}
+	if ((t->next = *slot) != NULL)
+		t->next->pprev = &t->next;
+	t->pprev = slot;
+	*slot = t;
+}
+
+/**
+ * Remove a timer from the slot it is in
+ *
+ * NB This is called with the caller holding the wheel spinlock
+ *
+ * @param t	The timer
+ */
+static void
+timer_unlink(TIMER *t)
+{
+	if ((*t->pprev = t->next) != NULL)
+		t->next->pprev = t->pprev;
+	t->next = NULL;
+	t->pprev = NULL;
+}
+
+/**
+ * Add a timer to the wheel of a polling thread, a timer that is already
+ * pending is moved.
+ *
+ * @param t		The timer
+ * @param thread	The polling thread to run the timer, or -1 for any
+ * @param ms		The delay in milliseconds
+ * @param fn		The function to call when the timer expires
+ * @param data		The argument to pass to the function
+ */
+void
+timer_add(TIMER *t, int thread, unsigned long ms, TIMER_FN fn, void *data)
+{
+TIMER_WHEEL	*w;
+
+	timer_cancel(t);
+	if (thread < 0 || thread >= n_wheels)
+		thread = 0;
+	w = &wheels[thread];
+	t->fn = fn;
+	t->data = data;
+	t->expires = timer_now() + ms;
+
+	spinlock_acquire(&w->lock);
+	timer_link(w, t);
+	t->wheel = thread;
+	w->count++;
+	spinlock_release(&w->lock);
+
+	/*< The thread may be sleeping past the time the timer is due */
+	if (thread != poll_thread_id())
+		poll_wakeup(thread);
+}
+
+/**
+ * Cancel a timer, it is not an error to cancel a timer that is not pending.
+ *
+ * NB A timer that has just expired may still be running on its polling
+ * thread when it is cancelled by another thread. The function of such a
+ * timer must serialise with whatever cancels it and check the state of
+ * its object, as the DCB timers do under the read lock of the DCB.
+ *
+ * @param t	The timer
+ */
+void
+timer_cancel(TIMER *t)
+{
+TIMER_WHEEL	*w;
+int		thread;
+
+	while ((thread = t->wheel) != -1)
+	{
+		w = &wheels[thread];
+		spinlock_acquire(&w->lock);
+		if (t->wheel == thread)
+		{
+			timer_unlink(t);
+			t->wheel = -1;
+			w->count--;
+			spinlock_release(&w->lock);
+			return;
+		}
+		/*< The timer moved to another wheel whilst we waited */
+		spinlock_release(&w->lock);
+	}
+}
+
+/**
+ * Return the time until the next timer of a polling thread is due. This
+ * is exact for the timers due within the current turn of the first
+ * level, other timers are reported at the end of that turn, when they
+ * are cascaded.
+ *
+ * @param thread	The polling thread
+ * @param max		The maximum time to return
+ * @return		The time in milliseconds until the next timer is due
+ */
+int
+timer_next(int thread, int max)
+{
+TIMER_WHEEL	*w;
+unsigned long	now = timer_now();
+long		ahead;
+int		i, idx, n = max;
+
+	if (wheels == NULL || thread < 0 || thread >= n_wheels)
+		return max;
+	w = &wheels[thread];
+	if (w->count == 0)
+		return max;
+	spinlock_acquire(&w->lock);
+	/*< The ticks between the last run and now are run immediately */
+	ahead = (long)(w->now - now);
+	for (i = 0, idx = w->now & (TIMER_L0_SIZE - 1);
+	     i < TIMER_L0_SIZE - (int)(w->now & (TIMER_L0_SIZE - 1));
+	     i++, idx++)
+	{
+		if (w->l0[idx] != NULL)
+			break;
+	}
+	spinlock_release(&w->lock);
+	ahead += i;
+	if (ahead < 0)
+		ahead = 0;
+	if (ahead < n)
+		n = (int)ahead;
+	return n;
+}
+
+/**
+ * Move the timers of a slot of a higher level to the lower levels
+ *
+ * NB This is called with the caller holding the wheel spinlock
+ *
+ * @param w	The wheel
+ * @param level	The level of the slot
+ * @param idx	The slot
+ */
+static void
+timer_cascade(TIMER_WHEEL *w, int level, int idx)
+{
+TIMER	*t, *next;
+
+	t = w->ln[level][idx];
+	w->ln[level][idx] = NULL;
+	for (; t != NULL; t = next)
+	{
+		next = t->next;
+		timer_link(w, t);
+	}
+}
+
+/**
+ * Run the timers of a polling thread that have expired
+ *
+ * The wheel lock is not held whilst the function of a timer is called, so
+ * the function may add or cancel timers. The object of the timer is not
+ * freed whilst it runs, the thread has not yet passed its quiescent point.
+ *
+ * @param thread	The polling thread
+ */
+void
+timer_run(int thread)
+{
+TIMER_WHEEL	*w;
+TIMER		*t;
+unsigned long	now = timer_now();
+int		idx, level, shift;
+
+	if (wheels == NULL || thread < 0 || thread >= n_wheels)
+		return;
+	w = &wheels[thread];
+	spinlock_acquire(&w->lock);
+	if (w->count == 0)
+	{
+		/*< An empty wheel can skip the ticks that have passed */
+		w->now = now + 1;
+		spinlock_release(&w->lock);
+		return;
+	}
+	while ((long)(now - w->now) >= 0)
+	{
+		idx = w->now & (TIMER_L0_SIZE - 1);
+		if (idx == 0)
+		{
+			for (level = 0, shift = TIMER_L0_BITS;
+			     level < TIMER_LEVELS;
+			     level++, shift += TIMER_LN_BITS)
+			{
+				int i = (w->now >> shift) & (TIMER_LN_SIZE - 1);
+
+				timer_cascade(w, level, i);
+				if (i != 0)
+					break;
+			}
+		}
+		while ((t = w->l0[idx]) != NULL)
+		{
+			timer_unlink(t);
+			t->wheel = -1;
+			w->count--;
+			spinlock_release(&w->lock);
+			t->fn(t->data);
+			spinlock_acquire(&w->lock);
+		}
+		w->now++;
+	}
+	spinlock_release(&w->lock);
+}
@@ -0,0 +1,436 @@
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2013
+ */
+
+/**
+ * @file uring.c  - A minimal io_uring wrapper for the polling loop
+ *
+ * The rings are used for readiness notification, each descriptor has a
+ * multishot poll request that posts a completion whenever the descriptor
+ * is woken, much as an edge triggered epoll registration does. Requests
+ * are only queued in the submission ring, they are passed to the kernel
+ * in a single batch by the next uring_wait of the thread that owns the
+ * ring, along with the wait for completions.
+ *
+ * The wrapper requires the extended argument of io_uring_enter, for the
+ * timeout, and multishot poll requests, so a kernel of 5.13 or later.
+ * uring_available tests for these at run time.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <uring.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(IORING_FEAT_EXT_ARG) && defined(IORING_POLL_ADD_MULTI)
+#define URING_SUPPORTED	1
+#endif
+
+#if defined(URING_SUPPORTED)
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/poll.h>
+
+static int
+sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		   unsigned int flags, void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			    flags, arg, argsz);
+}
+
+/**
+ * Return the number of entries that have been queued but not yet
+ * passed to the kernel
+ *
+ * @param ring	The ring
+ * @return	The number of unsubmitted entries
+ */
+static unsigned int
+uring_unsubmitted(URING *ring)
+{
+	return __atomic_load_n(ring->sq_tail, __ATOMIC_ACQUIRE) -
+		__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Return a free submission queue entry. If the queue is full the queued
+ * entries are submitted first.
+ *
+ * NB This is called with the caller holding the ring spinlock
+ *
+ * @param ring	The ring
+ * @return	The entry or NULL if the queue is full
+ */
+static struct io_uring_sqe *
+uring_get_sqe(URING *ring)
+{
+struct io_uring_sqe	*sqe;
+unsigned int		tail = *ring->sq_tail;
+
+	if (uring_unsubmitted(ring) >= ring->sq_entries)
+	{
+		if (sys_io_uring_enter(ring->fd, ring->sq_entries, 0, 0,
+				       NULL, 0) < 0 ||
+		    uring_unsubmitted(ring) >= ring->sq_entries)
+		{
+			return NULL;
+		}
+	}
+	sqe = &((struct io_uring_sqe *)ring->sqes)[tail & ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[tail & ring->sq_mask] = tail & ring->sq_mask;
+	return sqe;
+}
+
+/**
+ * Make the entry returned by uring_get_sqe visible to the kernel
+ *
+ * NB This is called with the caller holding the ring spinlock
+ *
+ * @param ring	The ring
+ */
+static void
+uring_commit(URING *ring)
+{
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Create an io_uring instance and map its queues
+ *
+ * @param ring		The ring to initialise
+ * @param entries	The number of submission queue entries
+ * @return		0 on success, -1 on error with errno set
+ */
+int
+uring_init(URING *ring, unsigned int entries)
+{
+struct io_uring_params	p;
+void			*ptr;
+
+	memset(ring, 0, sizeof(URING));
+	memset(&p, 0, sizeof(p));
+	spinlock_init(&ring->lock);
+	if ((ring->fd = sys_io_uring_setup(entries, &p)) < 0)
+		return -1;
+	if ((p.features & IORING_FEAT_EXT_ARG) == 0 ||
+	    (p.features & IORING_FEAT_NODROP) == 0)
+	{
+		close(ring->fd);
+		errno = ENOSYS;
+		return -1;
+	}
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = p.cq_off.cqes +
+				p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = 0;
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ|PROT_WRITE,
+			     MAP_SHARED|MAP_POPULATE, ring->fd,
+			     IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED)
+		goto failed;
+	if (ring->cq_ring_size == 0)
+	{
+		ring->cq_ring = ring->sq_ring;
+	}
+	else
+	{
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size,
+				     PROT_READ|PROT_WRITE,
+				     MAP_SHARED|MAP_POPULATE, ring->fd,
+				     IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED)
+		{
+			munmap(ring->sq_ring, ring->sq_ring_size);
+			goto failed;
+		}
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ|PROT_WRITE,
+			  MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+	{
+		if (ring->cq_ring_size)
+			munmap(ring->cq_ring, ring->cq_ring_size);
+		munmap(ring->sq_ring, ring->sq_ring_size);
+		goto failed;
+	}
+
+	ptr = ring->sq_ring;
+	ring->sq_head = (unsigned int *)((char *)ptr + p.sq_off.head);
+	ring->sq_tail = (unsigned int *)((char *)ptr + p.sq_off.tail);
+	ring->sq_mask = *(unsigned int *)((char *)ptr + p.sq_off.ring_mask);
+	ring->sq_entries = *(unsigned int *)((char *)ptr + p.sq_off.ring_entries);
+	ring->sq_array = (unsigned int *)((char *)ptr + p.sq_off.array);
+	ptr = ring->cq_ring;
+	ring->cq_head = (unsigned int *)((char *)ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned int *)((char *)ptr + p.cq_off.tail);
+	ring->cq_mask = *(unsigned int *)((char *)ptr + p.cq_off.ring_mask);
+	ring->cqes = (char *)ptr + p.cq_off.cqes;
+	return 0;
+
+failed:
+	{
+		int eno = errno;
+		close(ring->fd);
+		ring->fd = -1;
+		errno = eno;
+	}
+	return -1;
+}
+
+/**
+ * Release an io_uring instance, any armed polls are cancelled
+ *
+ * @param ring	The ring
+ */
+void
+uring_close(URING *ring)
+{
+	if (ring->fd < 0)
+		return;
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring_size)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	ring->fd = -1;
+}
+
+/**
+ * Queue a multishot poll request for a descriptor
+ *
+ * @param ring		The ring
+ * @param fd		The descriptor to poll
+ * @param events	The poll events of interest
+ * @param user_data	The user data of the completions
+ * @return		0 on success, -1 if the submission queue is full
+ */
+int
+uring_poll_add(URING *ring, int fd, unsigned int events, unsigned long user_data)
+{
+struct io_uring_sqe	*sqe;
+
+	spinlock_acquire(&ring->lock);
+	if ((sqe = uring_get_sqe(ring)) == NULL)
+	{
+		spinlock_release(&ring->lock);
+		errno = EBUSY;
+		return -1;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = user_data;
+	uring_commit(ring);
+	spinlock_release(&ring->lock);
+	return 0;
+}
+
+/**
+ * Queue the removal of a poll request, the completion of the removal
+ * itself carries URING_INTERNAL as the user data.
+ *
+ * @param ring		The ring
+ * @param user_data	The user data of the poll request to remove
+ * @return		0 on success, -1 if the submission queue is full
+ */
+int
+uring_poll_remove(URING *ring, unsigned long user_data)
+{
+struct io_uring_sqe	*sqe;
+
+	spinlock_acquire(&ring->lock);
+	if ((sqe = uring_get_sqe(ring)) == NULL)
+	{
+		spinlock_release(&ring->lock);
+		errno = EBUSY;
+		return -1;
+	}
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = user_data;
+	sqe->user_data = URING_INTERNAL;
+	uring_commit(ring);
+	spinlock_release(&ring->lock);
+	return 0;
+}
+
+/**
+ * Submit the queued requests and collect the completions of a ring,
+ * waiting for at least one if none are ready.
+ *
+ * NB Only the thread that owns the ring may call this routine
+ *
+ * @param ring		The ring
+ * @param events	Array to return the completions in
+ * @param max		The size of the events array
+ * @param timeout	The maximum time to wait in milliseconds, -1 for ever
+ * @return		The number of completions or -1 on error
+ */
+int
+uring_wait(URING *ring, URING_EVENT *events, int max, int timeout)
+{
+struct io_uring_getevents_arg	arg;
+struct __kernel_timespec	ts;
+struct io_uring_cqe		*cqe;
+unsigned int			head, tail, to_submit, min_complete = 0;
+unsigned int			flags = IORING_ENTER_EXT_ARG;
+int				n = 0;
+
+	head = *ring->cq_head;
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	to_submit = uring_unsubmitted(ring);
+	if (head == tail && timeout != 0)
+	{
+		flags |= IORING_ENTER_GETEVENTS;
+		min_complete = 1;
+	}
+	if (to_submit > 0 || min_complete > 0)
+	{
+		memset(&arg, 0, sizeof(arg));
+		if (timeout >= 0)
+		{
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000L;
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+		}
+		if (sys_io_uring_enter(ring->fd, to_submit, min_complete, flags,
+				       &arg, sizeof(arg)) < 0 &&
+		    errno != ETIME && errno != EINTR && errno != EBUSY)
+		{
+			return -1;
+		}
+	}
+
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail && n < max)
+	{
+		cqe = &((struct io_uring_cqe *)ring->cqes)[head & ring->cq_mask];
+		events[n].user_data = cqe->user_data;
+		events[n].res = cqe->res;
+		events[n].flags = (cqe->flags & IORING_CQE_F_MORE) ? URING_MORE : 0;
+		n++;
+		head++;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+/**
+ * Check whether the running kernel supports the io_uring features the
+ * event backend relies upon. A ring is created and a multishot poll is
+ * armed on an eventfd, which must then report the eventfd as readable
+ * and remain armed.
+ *
+ * @return	Non-zero if io_uring may be used
+ */
+int
+uring_available()
+{
+static int	available = -1;
+URING		ring;
+URING_EVENT	ev;
+uint64_t	val = 1;
+int		efd;
+
+	if (available != -1)
+		return available;
+	available = 0;
+	if (uring_init(&ring, 4) != 0)
+		return available;
+	if ((efd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) != -1)
+	{
+		if (uring_poll_add(&ring, efd, POLLIN, 1) == 0 &&
+		    write(efd, &val, sizeof(val)) == sizeof(val) &&
+		    uring_wait(&ring, &ev, 1, 100) == 1 &&
+		    ev.user_data == 1 && ev.res > 0 && (ev.res & POLLIN) &&
+		    (ev.flags & URING_MORE))
+		{
+			available = 1;
+		}
+		close(efd);
+	}
+	uring_close(&ring);
+	return available;
+}
+
+#else
+
+int
+uring_available()
+{
+	return 0;
+}
+
+int
+uring_init(URING *ring, unsigned int entries)
+{
+	memset(ring, 0, sizeof(URING));
+	ring->fd = -1;
+	errno = ENOSYS;
+	return -1;
+}
+
+void
+uring_close(URING *ring)
+{
+}
+
+int
+uring_poll_add(URING *ring, int fd, unsigned int events, unsigned long user_data)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+uring_poll_remove(URING *ring, unsigned long user_data)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+uring_wait(URING *ring, URING_EVENT *events, int max, int timeout)
+{
+	errno = ENOSYS;
+	return -1;
+}
+#endif
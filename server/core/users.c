@@ -32,12 +32,15 @@
  * 08/01/2014	Massimiliano Pinto	In user_alloc now we can pass function pointers for
  *					copying/freeing keys and values	independently via
  *					hashtable_memory_fns() routine
+ * 16/10/2026	agent			Use an open addressing table and hash the whole
+ *					user name
  *
  * @endverbatim
  */
 
 /**
- * The hash function we user for storing users.
+ * The hash function we user for storing users. All of the name is hashed,
+ * names that share their first two characters are common.
  *
  * @param key	The key value, i.e. username
  * @return The hash key
@@ -45,7 +48,11 @@
 static int
 user_hash(char *key)
 {
-	return (*key + *(key + 1));
+unsigned int	hash = 5381;
+
+	while (*key)
+		hash = hash * 33 + (unsigned char)*key++;
+	return (int)hash;
 }
 
 /**
@@ -61,12 +68,14 @@ USERS 	*rval;
         if ((rval = calloc(1, sizeof(USERS))) == NULL)
 		return NULL;
 
-	if ((rval->data = hashtable_alloc(52, user_hash, strcmp)) == NULL)
+	if ((rval->data = hashtable_alloc(52, user_hash, strcmp,
+					  HASHTABLE_OPEN|HASHTABLE_STRING_KEYS)) == NULL)
 	{
 		free(rval);
 		return NULL;
 	}
 
+	hashtable_set_name(rval->data, "users");
 	hashtable_memory_fns(rval->data, (HASHMEMORYFN)strdup, (HASHMEMORYFN)strdup, (HASHMEMORYFN)free, (HASHMEMORYFN)free);
 
 	return rval;
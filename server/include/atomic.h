@@ -21,14 +21,146 @@
 /**
  * @file atomic.h The atomic operations used within the gateway
  *
+ * The atomic operations are inline wrappers of the compiler builtins, the
+ * memory order of each operation is explicit. atomic_add is a full barrier,
+ * as it always has been, the statistics use relaxed operations.
+ *
+ * Statistics that are updated on the hot paths are sharded counters, each
+ * thread adds to a shard of its own, on a cache line of its own, and the
+ * shards are summed when the counter is read. The value read is exact
+ * once the updates have stopped, a sum taken whilst the counter is being
+ * updated may miss the most recent additions.
+ *
  * @verbatim
  * Revision History
  *
  * Date		Who		Description
  * 10/06/13	Mark Riddoch	Initial implementation
+ * 16/10/26	agent		Inline typed atomics, sharded counters
  *
  * @endverbatim
  */
 
+#define	ATOMIC_RELAXED	__ATOMIC_RELAXED
+#define	ATOMIC_ACQUIRE	__ATOMIC_ACQUIRE
+#define	ATOMIC_RELEASE	__ATOMIC_RELEASE
+#define	ATOMIC_ACQ_REL	__ATOMIC_ACQ_REL
+#define	ATOMIC_SEQ_CST	__ATOMIC_SEQ_CST
+
+static inline int
+atomic_load_int(int *variable, int order)
+{
+	return __atomic_load_n(variable, order);
+}
+
+static inline void
+atomic_store_int(int *variable, int value, int order)
+{
+	__atomic_store_n(variable, value, order);
+}
+
+static inline int
+atomic_add_int(int *variable, int value, int order)
+{
+	return __atomic_fetch_add(variable, value, order);
+}
+
+static inline long
+atomic_add_long(long *variable, long value, int order)
+{
+	return __atomic_fetch_add(variable, value, order);
+}
+
+static inline int
+atomic_cas_int(int *variable, int expected, int value)
+{
+	return __atomic_compare_exchange_n(variable, &expected, value, 0,
+					   ATOMIC_SEQ_CST, ATOMIC_RELAXED);
+}
+
+static inline void *
+atomic_load_ptr(void **variable, int order)
+{
+	return __atomic_load_n(variable, order);
+}
+
+static inline void
+atomic_store_ptr(void **variable, void *value, int order)
+{
+	__atomic_store_n(variable, value, order);
+}
+
+static inline int
+atomic_cas_ptr(void **variable, void *expected, void *value)
+{
+	return __atomic_compare_exchange_n(variable, &expected, value, 0,
+					   ATOMIC_SEQ_CST, ATOMIC_RELAXED);
+}
+
+/**
+ * Add a value to a variable and return the value it had before, the
+ * value may be negative. This is a full barrier.
+ *
+ * The function is inlined where it is called, atomic.c provides the out
+ * of line copy for the callers that are not optimised and for the other
+ * libraries, which declare it themselves.
+ *
+ * @param variable	Pointer the the variable to add to
+ * @param value		Value to be added
+ * @return		The value of variable before the add occured
+ */
 extern int atomic_add(int *variable, int value);
+#ifndef ATOMIC_OUT_OF_LINE
+extern inline __attribute__((gnu_inline)) int
+atomic_add(int *variable, int value)
+{
+	return __atomic_fetch_add(variable, value, ATOMIC_SEQ_CST);
+}
+#endif
+
+#define	COUNTER_SHARDS	16	/*< Shards of a counter, a power of two */
+
+/**
+ * A shard of a counter, each shard is on a cache line of its own
+ */
+typedef struct {
+	long	value;
+	char	pad[64 - sizeof(long)];
+} COUNTER_SHARD;
+
+/**
+ * A sharded counter, allocated by counter_alloc. A NULL counter, one that
+ * could not be allocated, ignores the updates and reads as zero.
+ */
+typedef COUNTER_SHARD *COUNTER;
+
+extern __thread int	counter_shard;		/*< The shard of the thread, -1 until set */
+
+extern COUNTER	counter_alloc();
+extern void	counter_free(COUNTER counter);
+extern long	counter_read(COUNTER counter);
+extern void	counter_reset(COUNTER counter);
+extern int	counter_shard_init();
+
+/**
+ * Add a value to a sharded counter, the value may be negative
+ *
+ * @param counter	The counter
+ * @param value		The value to add
+ */
+static inline void
+counter_add(COUNTER counter, long value)
+{
+int	shard = counter_shard;
+
+	if (counter == NULL)
+		return;
+	if (shard < 0)
+		shard = counter_shard_init();
+	/*< Threads only share a shard when there are more than COUNTER_SHARDS */
+	atomic_add_long(&counter[shard].value, value, ATOMIC_RELAXED);
+}
+
+#define	counter_inc(c)	counter_add((c), 1)
+#define	counter_dec(c)	counter_add((c), -1)
 #endif
@@ -38,18 +38,59 @@
  * 10/06/2013	Mark Riddoch		Initial implementation
  * 11/07/2013	Mark Riddoch		Addition of reference count in the gwbuf
  * 16/07/2013	Massimiliano Pinto	Added command type for the queue
+ * 16/10/2026	agent			Added the packet metadata
  *
  * @endverbatim
  */
 
+/**
+ * The buffer pool, buffers of up to GWBUF_MAX_CLASS bytes are allocated
+ * from power of two size classes, each with arenas of its own. The threads
+ * that prefer the memory of a NUMA node have a pool for the node, all other
+ * threads share a pool.
+ */
+#define	GWBUF_MIN_CLASS		256		/*< Smallest size class */
+#define	GWBUF_MAX_CLASS		65536		/*< Largest size class */
+#define	GWBUF_NCLASSES		9		/*< 256 bytes to 64KB */
+#define	GWBUF_ARENA_SIZE	(4 * 1024 * 1024) /*< Size of an arena */
+#define	GWBUF_MAX_NODES		8		/*< Nodes with a pool of their own */
+
+/**
+ * The metadata of a MySQL packet held in a shared buffer, so that the
+ * protocol module, the router and the query classifier parse the packet
+ * only once. The metadata is keyed by the offset of the packet in the
+ * shared buffer, each of the pipelined packets of a buffer has its own.
+ * It is shared by the clones of the buffer and released with the data.
+ */
+typedef struct gwbuf_info {
+	struct gwbuf_info *next;	/*< The next packet of the shared buffer */
+	unsigned int	offset;		/*< Offset of the packet in the data */
+	unsigned int	flags;		/*< GWBUF_INFO_* */
+	unsigned int	packet_len;	/*< Packet length including the header */
+	int		command;	/*< The command byte, -1 if none */
+	char		*sql;		/*< The text of a COM_QUERY, not NUL terminated */
+	unsigned int	sql_len;	/*< The length of the text */
+	char		*sql_copy;	/*< Copy of a text that spans buffers */
+	int		qtype;		/*< The query type once classified */
+} GWBUF_INFO;
+
+#define	GWBUF_INFO_CLASSIFIED	0x0001	/*< The qtype has been set */
+
 /**
  * A structure to encapsualte the data in a form that the data itself can be
  * shared between multiple GWBUF's without the need to make multiple copies
  * but still maintain separate data pointers.
+ *
+ * The SHARED_BUF is allocated together with the data and the GWBUF that is
+ * returned by gwbuf_alloc, the memory is released when the last GWBUF that
+ * refers to the data is freed. The size is that of the size class the
+ * block was taken from, which may be larger than the size asked for.
  */
 typedef struct  {
 	unsigned char	*data;			/*< Physical memory that was allocated */
 	int		refcount;		/*< Reference count on the buffer */
+	unsigned int	size;			/*< Size of the data area */
+	GWBUF_INFO	*info;			/*< The packets described so far */
 } SHARED_BUF;
 
 /**
@@ -68,6 +109,17 @@ typedef struct gwbuf {
 	int		command;/*< The command type for the queue */
 } GWBUF;
 
+/**
+ * A queue of buffers that tracks the tail of the chain and the total number
+ * of bytes held, so that appending to the queue and finding the amount of
+ * queued data does not require the chain to be walked.
+ */
+typedef struct {
+	GWBUF		*head;	/*< The first buffer in the queue */
+	GWBUF		*tail;	/*< The last buffer in the queue */
+	unsigned int	length;	/*< Total number of bytes in the queue */
+} GWBUF_QUEUE;
+
 /*<
  * Macros to access the data in the buffers
  */
@@ -77,12 +129,24 @@ typedef struct gwbuf {
 /*< Number of bytes in the individual buffer */
 #define GWBUF_LENGTH(b)		((b)->end - (b)->start)
 
+/*< True if there are no buffers in the queue */
+#define GWBUF_QUEUE_EMPTY(q)	((q)->head == NULL)
+
+/*< Number of bytes held in the queue */
+#define GWBUF_QUEUE_LENGTH(q)	((q)->length)
+
 /*< True if all bytes in the buffer have been consumed */
 #define GWBUF_EMPTY(b)		((b)->start == (b)->end)
 
 /*< Consume a number of bytes in the buffer */
 #define GWBUF_CONSUME(b, bytes)	(b)->start += bytes
 
+/*< The length of the header of a MySQL packet */
+#define	GWBUF_MYSQL_HEADER_LEN	4
+
+/*< The MySQL command that carries the text of a query */
+#define	GWBUF_MYSQL_COM_QUERY	0x03
+
 /*<
  * Function prototypes for the API to maniplate the buffers
  */
@@ -92,6 +156,19 @@ extern GWBUF		*gwbuf_clone(GWBUF *buf);
 extern GWBUF		*gwbuf_append(GWBUF *head, GWBUF *tail);
 extern GWBUF		*gwbuf_consume(GWBUF *head, unsigned int length);
 extern unsigned int	gwbuf_length(GWBUF *head);
+extern void		gwbuf_queue_init(GWBUF_QUEUE *queue);
+extern void		gwbuf_queue_append(GWBUF_QUEUE *queue, GWBUF *buf);
+extern void		gwbuf_queue_consume(GWBUF_QUEUE *queue, unsigned int length);
+extern GWBUF		*gwbuf_queue_take(GWBUF_QUEUE *queue);
+extern GWBUF		*gwbuf_make_contiguous(GWBUF *head);
+extern unsigned int	gwbuf_copy_data(GWBUF *head, unsigned int offset,
+					unsigned int len, unsigned char *dest);
+extern GWBUF		*gwbuf_split(GWBUF **head, unsigned int len);
+extern unsigned int	gwbuf_mysql_packet_length(GWBUF *head);
+extern GWBUF		*gwbuf_mysql_next_packet(GWBUF **head);
+extern GWBUF_INFO	*gwbuf_mysql_info(GWBUF *head);
+struct dcb;
+extern void		dprintBufferPool(struct dcb *dcb);
 
 
 #endif
@@ -55,9 +55,43 @@ typedef struct	config_context {
  */
 typedef struct {
 	int			n_threads;	/**< Number of polling threads */
+	int			poll_sharding;	/**< Use an epoll set per thread */
+	int			poll_backend;	/**< The event notification backend */
+	char			*thread_affinity; /**< CPUs to bind the polling threads to */
+	int			numa_local;	/**< Allocate from the node of the thread */
+	int			read_budget;	/**< Bytes read from a DCB per event */
+	int			acceptor_thread; /**< Accept in a thread of its own */
+	int			resolve_ttl;	/**< Seconds to keep a server address */
+	int			buffer_hugepages; /**< Huge pages for the buffer pool */
+	int			lock_profiling;	/**< Profile the spinlock classes */
 } GATEWAY_CONF;
 
+/**
+ * The event notification backends of the polling threads
+ */
+#define	POLL_BACKEND_EPOLL	0	/**< epoll, the default */
+#define	POLL_BACKEND_IO_URING	1	/**< io_uring, not yet selectable */
+
+/**
+ * The use of huge pages by the arenas of the buffer pool
+ */
+#define	BUFFER_HUGEPAGES_NONE		0	/**< Normal pages, the default */
+#define	BUFFER_HUGEPAGES_TRANSPARENT	1	/**< Advise transparent huge pages */
+#define	BUFFER_HUGEPAGES_HUGETLB	2	/**< Reserved huge pages */
+
+#define	DEFAULT_READ_BUDGET	262144	/**< Bytes read from a DCB per event */
+#define	DEFAULT_RESOLVE_TTL	300	/**< Seconds to keep a server address */
+
 extern int	config_load(char *);
 extern int	config_reload();
 extern int	config_threadcount();
+extern int	config_poll_sharding();
+extern int	config_poll_backend();
+extern char	*config_thread_affinity();
+extern int	config_numa_local();
+extern int	config_read_budget();
+extern int	config_acceptor_thread();
+extern int	config_resolve_ttl();
+extern int	config_buffer_hugepages();
+extern int	config_lock_profiling();
 #endif
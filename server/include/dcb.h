@@ -17,14 +17,17 @@
  *
  * Copyright SkySQL Ab 2013
  */
+#include <sys/uio.h>
 #include <spinlock.h>
 #include <buffer.h>
 #include <gwbitmask.h>
+#include <timer.h>
 #include <skygw_utils.h>
 
 struct session;
 struct server;
 struct service;
+struct splice;
 
 /**
  * @file dcb.h	The Descriptor Control Block
@@ -111,15 +114,16 @@ typedef struct dcbstats {
  * processing an event that will access the DCB.
  *
  * We solve this issue by making the dcb_free routine merely mark a DCB as a zombie and
- * place it on a special zombie list. Before placing the DCB on the zombie list we create
- * a bitmask with a bit set in it for each active polling thread. Each thread will call
- * a routine to process the zombie list at the end of the polling loop. This routine
- * will clear the bit value that corresponds to the calling thread. Once the bitmask
- * is completely cleared the DCB can finally be freed and removed from the zombie list.
+ * place it on the retired list of the calling thread, tagged with a new epoch. Each
+ * polling thread records the current epoch at the end of its polling loop, at which
+ * point it can hold no reference to a DCB that was removed from the poll set before
+ * the epoch was advanced. Once every polling thread has recorded an epoch at least
+ * as recent as that of a retired DCB the DCB can finally be freed and removed from
+ * the retired list.
  */
 typedef struct {
-	GWBITMASK	bitmask;	/*< The bitmask of threads */
-	struct dcb	*next;		/*< Next pointer for the zombie list */
+	unsigned long	epoch;		/*< The epoch in which the DCB was retired */
+	struct dcb	*next;		/*< Next pointer for the retired list */
 } DCBMM;
 
 /* DCB states */
@@ -164,15 +168,16 @@ typedef struct dcb {
 #endif
 	int	 	fd;		/**< The descriptor */
 	dcb_state_t	state;		/**< Current descriptor state */
+	int		owner;		/**< The polling thread that owns the DCB */
 	char		*remote;	/**< Address of remote end */
 	void		*protocol;	/**< The protocol specific state */
 	struct session	*session;	/**< The owning session */
 	GWPROTOCOL	func;		/**< The functions for this descriptor */
 
 	SPINLOCK	writeqlock;	/**< Write Queue spinlock */
-	GWBUF		*writeq;	/**< Write Data Queue */
+	GWBUF_QUEUE	writeq;		/**< Write Data Queue */
 	SPINLOCK	delayqlock;	/**< Delay Backend Write Queue spinlock */
-	GWBUF		*delayq;	/**< Delay Backend Write Data Queue */
+	GWBUF_QUEUE	delayq;		/**< Delay Backend Write Data Queue */
 	SPINLOCK	authlock;	/**< Generic Authorization spinlock */
 
 	DCBSTATS	stats;		/**< DCB related statistics */
@@ -182,6 +187,18 @@ typedef struct dcb {
 	void		*data;		/**< Specific client data */
 	DCBMM		memdata;	/**< The data related to DCB memory management */
 	int		command;	/**< Specific client command type */
+	unsigned int	events;		/**< The epoll events the DCB is registered for */
+	struct dcb	*throttled;	/**< DCBs whose reads are paused until the
+					 *   write queue of this DCB drains */
+	struct dcb	*throttled_by;	/**< The DCB this DCB's reads are paused for */
+	struct dcb	*throttle_next;	/**< Next DCB paused for the same DCB */
+	struct splice	*splice;	/**< The byte pump the DCB is part of */
+	TIMER		timer;		/**< Idle timer of a client, connect
+					 *   timer of a backend */
+	unsigned long	last_read;	/**< Tick of the last read event */
+	int		readable;	/**< The read budget left data unread */
+	int		ready;		/**< The DCB is on a ready queue */
+	struct dcb	*ready_next;	/**< Next DCB on the ready queue */
 #if defined(SS_DEBUG)
         skygw_chk_t     dcb_chk_tail;
 #endif
@@ -201,8 +218,10 @@ int           fail_accept_errno;
 #define DCB_PROTOCOL(x, type)		(type *)((x)->protocol)
 #define	DCB_ISZOMBIE(x)			((x)->state == DCB_STATE_ZOMBIE)
 
-DCB             *dcb_get_zombies(void);
+int             dcb_has_zombies(int);
+void            dcb_reclaim_init(int);
 int             gw_write(int fd, const void* buf, size_t nbytes);
+int             gw_writev(int fd, const struct iovec* iov, int iovcnt);
 int             dcb_write(DCB *, GWBUF *);
 DCB             *dcb_alloc(dcb_role_t);
 void            dcb_free(DCB *);
@@ -220,6 +239,8 @@ void		dcb_printf(DCB *, const char *, ...);	/* DCB version of printf */
 int		dcb_isclient(DCB *);			/* the DCB is the client of the session */
 void		dcb_hashtable_stats(DCB *, void *);	/**< Print statisitics */
 void            dcb_add_to_zombieslist(DCB* dcb);
+void            dcb_throttle_check(DCB *, DCB *);
+void            dcb_idle_start(DCB *);
 
 bool dcb_set_state(
         DCB*         dcb,
@@ -30,6 +30,8 @@
  * 23/07/2013	Mark Riddoch		Addition of iterator mechanism
  * 08/01/2014	Massimiliano Pinto	Added function pointers for key/value copy and free
  *					the routine hashtable_memory_fns() changed accordingly
+ * 16/10/2026	agent			Lock free readers and incremental resizing
+ * 16/10/2026	agent			Open addressing tables, selected by hashtable_alloc flags
  *
  * @endverbatim
  */
@@ -50,6 +52,43 @@ typedef struct hashentry {
 	struct	hashentry	*next;	/**< The overflow chain */
 } HASHENTRIES;
 
+/**
+ * An array of hash chains, the table replaces its array as it grows.
+ */
+typedef struct hashbuckets {
+	int		size;		/**< The number of chains */
+	HASHENTRIES	*chains[];	/**< The chains themselves */
+} HASHBUCKETS;
+
+/**
+ * The flags of hashtable_alloc
+ */
+#define	HASHTABLE_OPEN		0x0001	/**< Open addressing, for tables that are read often */
+#define	HASHTABLE_STRING_KEYS	0x0002	/**< The keys are strings, short keys are held inline */
+
+#define	HASH_INLINE_KEY		12	/**< Space for a key held in a slot, with its NUL */
+
+/**
+ * A slot of an open addressing table. The key points to ikey when the key
+ * is short enough to be held in the slot, an empty slot has a NULL key.
+ */
+typedef struct hashslot {
+	unsigned int	hash;			/**< The hash of the key */
+	char		ikey[HASH_INLINE_KEY];	/**< A key held in the slot */
+	void		*key;			/**< The key or NULL if the slot is empty */
+	void		*value;			/**< The value associated with key */
+} HASHSLOT;
+
+/**
+ * The slots of an open addressing table, the number of slots is a power of
+ * two and the slots are aligned so that none of them spans two cache lines.
+ */
+typedef struct hashslots {
+	unsigned int	mask;			/**< The number of slots less one */
+	char		pad[sizeof(HASHSLOT) - sizeof(unsigned int)];
+	HASHSLOT	slot[];			/**< The slots themselves */
+} HASHSLOTS;
+
 /**
  * HASHTABLE iterator - used to walk the hashtable in a thread safe
  * way
@@ -57,8 +96,9 @@ typedef struct hashentry {
 typedef struct hashiterator {
 	struct hashtable
 			*table;		/**< The hashtable the iterator refers to */
-	int		chain;		/**< The current chain we are walking */
+	int		chain;		/**< The current chain, or slot, we are walking */
 	int		depth;		/**< The current depth down the chain */
+	char		*key;		/**< Copy of the last string key returned */
 } HASHITERATOR;
 
 /**
@@ -73,28 +113,35 @@ typedef struct hashtable {
 #if defined(SS_DEBUG)
         skygw_chk_t     ht_chk_top;
 #endif
-	int		hashsize;			/**< The number of HASHENTRIES */
-	HASHENTRIES	**entries;			/**< The entries themselves */
+	int		flags;				/**< The flags of hashtable_alloc */
+	HASHBUCKETS	*buckets;			/**< The current chains */
+	HASHBUCKETS	*old;				/**< The chains being resized from */
+	int		migrated;			/**< Chains of old that have been copied */
+	int		n_entries;			/**< Number of entries in the table */
+	int		n_resizes;			/**< Number of times the table has grown */
+	HASHSLOTS	*slots;				/**< The slots of an open table */
+	int		seq;				/**< Odd whilst slots of an open table move */
 	int		(*hashfn)(void *);		/**< The hash function */
 	int		(*cmpfn)(void *, void *);	/**< The key comparison function */
 	HASHMEMORYFN	kcopyfn;			/**< Optional key copy function */
 	HASHMEMORYFN	vcopyfn;			/**< Optional value copy function */
 	HASHMEMORYFN	kfreefn;			/**< Optional key free function */
 	HASHMEMORYFN	vfreefn;			/**< Optional value free function */
-	SPINLOCK	spin;				/**< Internal spinlock for the hashtable */
-	int		n_readers;			/**< Number of clients reading the table */
-	int		writelock;			/**< The table is locked by a writer */
+	SPINLOCK	spin;				/**< Serialises the writers */
+	int		epoch;				/**< Selects the reader count of new readers */
+	COUNTER		readers[2];			/**< The readers of each epoch */
 #if defined(SS_DEBUG)
         skygw_chk_t     ht_chk_tail;
 #endif
 } HASHTABLE;
 
-extern HASHTABLE	*hashtable_alloc(int, int (*hashfn)(), int (*cmpfn)());
+extern HASHTABLE	*hashtable_alloc(int, int (*hashfn)(), int (*cmpfn)(), int);
 				/**< Allocate a hashtable */
 extern void		hashtable_memory_fns(HASHTABLE *, HASHMEMORYFN, HASHMEMORYFN, HASHMEMORYFN, HASHMEMORYFN);
 				/**< Provide an interface to control key/value memory
 				 * manipulation
 				 */
+extern void		hashtable_set_name(HASHTABLE *, const char *);
 extern void		hashtable_free(HASHTABLE *);			/**< Free a hashtable */
 extern int		hashtable_add(HASHTABLE *, void *, void *);	/**< Add an entry */
 extern int		hashtable_delete(HASHTABLE *, void *);
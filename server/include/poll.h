@@ -34,11 +34,32 @@
 #define	MAX_EVENTS	1000
 #define	EPOLL_TIMEOUT	1000	/**< The epoll timeout in milliseconds */
 
+/**
+ * A task posted to a polling thread, normally embedded in the data the
+ * task function is called with.
+ */
+typedef struct poll_task {
+	struct poll_task	*next;		/**< Next task posted to the thread */
+	void			(*fn)(void *);	/**< The task function */
+	void			*data;		/**< The argument of the function */
+} POLL_TASK;
+
 extern	void		poll_init();
 extern	int		poll_add_dcb(DCB *);
 extern	int		poll_remove_dcb(DCB *);
+extern	int		poll_update_dcb(DCB *, unsigned int, unsigned int);
 extern	void		poll_waitevents(void *);
 extern	void		poll_shutdown();
+extern	void		poll_wakeup(int);
+extern	void		poll_wakeup_all();
+extern	int		poll_thread_id();
+extern	void		poll_post(int, POLL_TASK *);
+extern	int		poll_handoff_thread();
+extern	void		poll_accept_loop(void *);
+extern	int		poll_nthreads();
+extern	unsigned long	poll_epoch_advance();
+extern	unsigned long	poll_epoch_min();
+extern	void		poll_epoch_wake(unsigned long);
 extern	GWBITMASK	*poll_bitmask();
 extern	void		dprintPollStats(DCB *);
 #endif
@@ -17,7 +17,10 @@
  *
  * Copyright SkySQL Ab 2013
  */
+#include <time.h>
+#include <netinet/in.h>
 #include <dcb.h>
+#include <atomic.h>
 
 /**
  * @file service.h
@@ -36,12 +39,13 @@
  */
 
 /**
- * The server statistics structure
+ * The server statistics structure, the counters are sharded so that the
+ * threads connecting to a server do not share a cache line
  *
  */
 typedef struct {
-	int		n_connections;	/**< Number of connections */
-	int		n_current;	/**< Current connections */
+	COUNTER		n_connections;	/**< Number of connections */
+	COUNTER		n_current;	/**< Current connections */
 } SERVER_STATS;
 
 /**
@@ -58,6 +62,11 @@ typedef struct server {
 	char		*monuser;	/**< User name to use to monitor the db */
 	char		*monpw;		/**< Password to use to monitor the db */
 	SERVER_STATS	stats;		/**< The server statistics */
+	SPINLOCK	addrlock;	/**< Protects the resolved address */
+	struct sockaddr_in addr;	/**< The resolved address of the server */
+	int		addr_valid;	/**< The address has been resolved */
+	int		addr_numeric;	/**< The name is an address, never refreshed */
+	time_t		addr_refresh;	/**< When to resolve the name again */
 	struct	server	*next;		/**< Next server */
 	struct	server	*nextdb;	/**< Next server in list attached to a service */
 } SERVER;
@@ -72,6 +81,9 @@ typedef struct server {
 #define SERVER_SLAVE	0x0004		/**<< The server is a slave, i.e. can handle reads */
 #define SERVER_JOINED	0x0008		/**<< The server is joined in a Galera cluster */
 
+#define	SERVER_RESOLVE_RETRY	5	/**< Seconds between attempts to resolve
+					 *   a name that did not resolve */
+
 /**
  * Is the server running - the macro returns true if the server is marked as running
  * regardless of it's state as a master or slave
@@ -108,4 +120,7 @@ extern void	server_set_status(SERVER *, int);
 extern void	server_clear_status(SERVER *, int);
 extern void	serverAddMonUser(SERVER *, char *, char *);
 extern void	server_update(SERVER *, char *, char *, char *);
+extern int	server_get_address(SERVER *, struct sockaddr_in *);
+extern void	server_resolver_start();
+extern void	server_resolver_stop();
 #endif
@@ -101,6 +101,16 @@ typedef struct service {
 	SPINLOCK	spin;		/**< The service spinlock */
 	SERVICE_STATS	stats;		/**< The service statistics */
 	struct users	*users;		/**< The user data for this service */
+	unsigned int	writeq_high_water;
+					/**< Queued bytes to a client at which
+					 * reads from its backends are paused */
+	unsigned int	writeq_low_water;
+					/**< Queued bytes to a client at which
+					 * reads from its backends resume */
+	int		conn_timeout;	/**< Seconds a client may be idle, 0 for ever */
+	int		connect_timeout;
+					/**< Seconds to wait for a backend
+					 * connection to complete, 0 for ever */
 	struct service	*next;		/**< The next service in the linked list */
 } SERVICE;
 
@@ -123,6 +133,8 @@ extern	int	serviceStop(SERVICE *);
 extern	int	serviceRestart(SERVICE *);
 extern	int	serviceSetUser(SERVICE *, char *, char *);
 extern	int	serviceGetUser(SERVICE *, char **, char **);
+extern	void	serviceSetWriteQueueLimits(SERVICE *, unsigned int, unsigned int);
+extern	void	serviceSetTimeouts(SERVICE *, int, int);
 extern	void	service_update(SERVICE *, char *, char *, char *);
 extern	void	printService(SERVICE *);
 extern	void	printAllServices();
@@ -27,12 +27,46 @@
  * generally wasteful as any blocked threads will spin, consuming CPU cycles, waiting
  * for the lock to be released. However they are useful in that they do not involve
  * system calls and are light weight when the expected wait time for a lock is low.
+ *
+ * There are two types of spinlock behind the same API. The default is a
+ * test-and-test-and-set lock, waiters spin reading the lock word and back
+ * off exponentially after a failed attempt, so the cache line is only
+ * written when the lock looks free. A ticket lock hands the lock to the
+ * waiters in the order they arrived, it is meant for hot global locks
+ * where a waiter could otherwise be starved.
+ *
+ * A spinlock may belong to a named lock class, the locks of a class are
+ * profiled together when lock profiling is enabled. The acquisitions are
+ * counted, and for the acquisitions that had to wait the number of
+ * retries and the cycles spent waiting. Without profiling the cost is a
+ * test of a global flag.
  */
 #include <thread.h>
 #include <stdbool.h>
 
+#define	SPINLOCK_TTAS	0	/*< Test-and-test-and-set with backoff */
+#define	SPINLOCK_TICKET	1	/*< First come, first served */
+
+/**
+ * A named class of spinlocks and its profile
+ */
+typedef struct spinlock_class {
+	char		*name;		/*< The name of the class */
+	unsigned long	acquired;	/*< Acquisitions, approximate */
+	unsigned long	contended;	/*< Acquisitions that had to wait */
+	unsigned long	spins;		/*< Failed attempts whilst waiting */
+	unsigned long long cycles;	/*< Cycles spent waiting */
+	int		registered;	/*< On the list of classes */
+	struct spinlock_class *next;	/*< The next registered class */
+} SPINLOCK_CLASS;
+
+#define	SPINLOCK_CLASS_INIT(name) { name, 0, 0, 0, 0, 0, NULL }
+
 typedef struct spinlock {
-	int		lock;
+	int		lock;		/*< The lock word or the ticket being served */
+	int		next;		/*< The next ticket to hand out */
+	int		type;		/*< SPINLOCK_TTAS or SPINLOCK_TICKET */
+	SPINLOCK_CLASS	*cls;		/*< The lock class, NULL if unnamed */
 #if DEBUG
 	int		spins;
 	int		acquired;
@@ -48,13 +82,24 @@ typedef struct spinlock {
 #endif
 
 #if DEBUG
-#define SPINLOCK_INIT { 0, 0, 0, NULL }
+#define SPINLOCK_INIT_CLASS(c) { 0, 0, SPINLOCK_TTAS, c, 0, 0, NULL }
+#define SPINLOCK_TICKET_INIT_CLASS(c) { 0, 0, SPINLOCK_TICKET, c, 0, 0, NULL }
 #else
-#define SPINLOCK_INIT { 0 }
+#define SPINLOCK_INIT_CLASS(c) { 0, 0, SPINLOCK_TTAS, c }
+#define SPINLOCK_TICKET_INIT_CLASS(c) { 0, 0, SPINLOCK_TICKET, c }
 #endif
+#define SPINLOCK_INIT		SPINLOCK_INIT_CLASS(NULL)
+#define SPINLOCK_TICKET_INIT	SPINLOCK_TICKET_INIT_CLASS(NULL)
+
+extern int	spinlock_profiling;	/*< Profile the lock classes */
 
 extern void	spinlock_init(SPINLOCK *lock);
+extern void	spinlock_init_ticket(SPINLOCK *lock);
 extern void	spinlock_acquire(SPINLOCK *lock);
 extern int	spinlock_acquire_nowait(SPINLOCK *lock);
 extern void	spinlock_release(SPINLOCK *lock);
+extern void	spinlock_set_class(SPINLOCK *lock, SPINLOCK_CLASS *cls);
+extern SPINLOCK_CLASS *spinlock_class(const char *name);
+extern int	spinlock_class_list(SPINLOCK_CLASS **classes, int max);
+extern void	spinlock_profile_reset();
 #endif
@@ -0,0 +1,81 @@
+#ifndef _SPLICE_H
+#define _SPLICE_H
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2013
+ */
+#include <spinlock.h>
+
+/**
+ * @file splice.h	The zero copy byte pump between a client and a backend
+ *
+ * Once a session no longer needs the protocol modules to look at the data,
+ * the bytes read from one side of the session are moved to the other side
+ * with splice() through a pipe, without being copied to user space.
+ */
+
+struct dcb;
+
+#define	SPLICE_PIPE_SIZE	(1024 * 1024)	/**< Requested size of the pipes */
+#define	SPLICE_PEEK_SIZE	5		/**< Bytes given to the filter */
+
+/**
+ * The return values of splice_read
+ */
+#define	SPLICE_FALLBACK	0	/**< The caller must read the data itself */
+#define	SPLICE_DONE	1	/**< The data has been dealt with */
+
+/**
+ * A filter that is applied to the start of each packet sent by the client,
+ * it is given up to SPLICE_PEEK_SIZE bytes of the packet and returns the
+ * total length of the packet, 0 if more bytes are needed or -1 if the packet
+ * must be handled by the protocol module, which also stops the pump.
+ */
+typedef int (*SPLICE_FILTER)(unsigned char *, int);
+
+/**
+ * One direction of the byte pump
+ */
+typedef struct {
+	SPINLOCK	lock;		/**< Protects the pipe */
+	int		fds[2];		/**< The read and write ends of the pipe */
+	int		pending;	/**< Bytes held in the pipe */
+	int		packet_left;	/**< Bytes left of the current packet */
+	unsigned long	bytes;		/**< Total bytes moved */
+} SPLICE_PIPE;
+
+/**
+ * The byte pump shared by the client and backend DCB of a session
+ */
+typedef struct splice {
+	struct dcb	*client;	/**< The client DCB */
+	struct dcb	*backend;	/**< The backend DCB */
+	SPLICE_PIPE	upstream;	/**< From the client to the backend */
+	SPLICE_PIPE	downstream;	/**< From the backend to the client */
+	SPLICE_FILTER	filter;		/**< Filter for packets from the client */
+	int		disabled;	/**< The protocol modules have taken over */
+	int		closed;		/**< One of the DCBs has been closed */
+	int		refcount;	/**< Number of DCBs using the pump */
+} SPLICE;
+
+extern int	splice_enable(struct dcb *, struct dcb *, SPLICE_FILTER);
+extern int	splice_read(struct dcb *);
+extern void	splice_write_ready(struct dcb *);
+extern void	splice_disable(struct dcb *);
+extern int	splice_pending(struct dcb *);
+extern void	splice_close(struct dcb *);
+extern void	splice_release(struct dcb *);
+#endif
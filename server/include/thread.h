@@ -34,5 +34,8 @@
 extern void 	*thread_start(void (*entry)(void *), void *arg);
 extern void	thread_wait(void *thd);
 extern void	thread_millisleep(int ms);
+extern int	thread_bind(const char *spec, int thread_id, int numa_local);
+
+extern __thread int	thread_node;	/*< The preferred node of the thread or -1 */
 
 #endif
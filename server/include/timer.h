@@ -0,0 +1,60 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2013
+ */
+
+/**
+ * @file timer.h	The timers of the polling threads
+ *
+ * Each polling thread has a hierarchical timer wheel with a resolution of
+ * one millisecond. The timers are run by the polling thread at the end of
+ * each pass of its polling loop and the wait for events is bounded by the
+ * next timer that is due. Adding and cancelling a timer are O(1).
+ */
+
+#define	TIMER_L0_BITS	8	/**< Slots of the first level, one per tick */
+#define	TIMER_LN_BITS	6	/**< Slots of each of the other levels */
+#define	TIMER_LEVELS	3	/**< Number of levels after the first */
+#define	TIMER_L0_SIZE	(1 << TIMER_L0_BITS)
+#define	TIMER_LN_SIZE	(1 << TIMER_LN_BITS)
+#define	TIMER_MAX_DELAY	((1UL << (TIMER_L0_BITS + TIMER_LEVELS * TIMER_LN_BITS)) - 1)
+
+typedef void (*TIMER_FN)(void *);
+
+/**
+ * A timer, normally embedded in the object it belongs to
+ */
+typedef struct timer {
+	struct timer	*next;		/**< Next timer in the wheel slot */
+	struct timer	**pprev;	/**< The pointer to this timer */
+	unsigned long	expires;	/**< The tick the timer is due at */
+	int		wheel;		/**< The wheel of the timer, -1 if idle */
+	TIMER_FN	fn;		/**< The function to call */
+	void		*data;		/**< The argument of the function */
+} TIMER;
+
+#define	TIMER_INIT	{ NULL, NULL, 0, -1, NULL, NULL }
+#define	TIMER_PENDING(t)	((t)->wheel != -1)
+
+extern void		timer_init(int);
+extern void		timer_add(TIMER *, int, unsigned long, TIMER_FN, void *);
+extern void		timer_cancel(TIMER *);
+extern unsigned long	timer_now();
+extern int		timer_next(int, int);
+extern void		timer_run(int);
+#endif
@@ -0,0 +1,80 @@
+#ifndef _URING_H
+#define _URING_H
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2013
+ */
+#include <stddef.h>
+#include <spinlock.h>
+
+/**
+ * @file uring.h	A minimal io_uring wrapper used as an event backend
+ *
+ * Only the operations needed by the polling loop are provided, a multishot
+ * poll for a descriptor, the removal of such a poll and the collection of
+ * the completions. The system calls are made directly, so no library is
+ * needed, and the wrapper compiles to stubs that always fail when the
+ * kernel headers do not support io_uring.
+ */
+
+#define	URING_ENTRIES	4096	/**< Submission queue entries per ring */
+#define	URING_INTERNAL	0UL	/**< User data of completions to ignore */
+
+/**
+ * The completion flags returned by uring_wait
+ */
+#define	URING_MORE	0x0001	/**< The poll remains armed */
+
+/**
+ * An io_uring instance, the submission queue may be filled by any thread
+ * but only one thread collects the completions.
+ */
+typedef struct {
+	int		fd;		/**< The ring descriptor */
+	SPINLOCK	lock;		/**< Serialises the submission queue */
+	unsigned int	*sq_head;	/**< Submission queue head, kernel owned */
+	unsigned int	*sq_tail;	/**< Submission queue tail */
+	unsigned int	sq_mask;	/**< Submission queue index mask */
+	unsigned int	sq_entries;	/**< Submission queue size */
+	unsigned int	*sq_array;	/**< Submission queue index array */
+	void		*sqes;		/**< The submission queue entries */
+	unsigned int	*cq_head;	/**< Completion queue head */
+	unsigned int	*cq_tail;	/**< Completion queue tail, kernel owned */
+	unsigned int	cq_mask;	/**< Completion queue index mask */
+	void		*cqes;		/**< The completion queue entries */
+	void		*sq_ring;	/**< The mapped submission ring */
+	size_t		sq_ring_size;	/**< Size of the submission ring mapping */
+	void		*cq_ring;	/**< The mapped completion ring */
+	size_t		cq_ring_size;	/**< Size of the completion ring mapping */
+	size_t		sqes_size;	/**< Size of the entries mapping */
+} URING;
+
+/**
+ * A completion collected from a ring
+ */
+typedef struct {
+	unsigned long	user_data;	/**< The user data of the request */
+	int		res;		/**< The poll events or -errno */
+	unsigned int	flags;		/**< URING_MORE if still armed */
+} URING_EVENT;
+
+extern int	uring_available();
+extern int	uring_init(URING *, unsigned int);
+extern void	uring_close(URING *);
+extern int	uring_poll_add(URING *, int, unsigned int, unsigned long);
+extern int	uring_poll_remove(URING *, unsigned long);
+extern int	uring_wait(URING *, URING_EVENT *, int, int);
+#endif
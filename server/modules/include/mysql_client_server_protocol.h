@@ -48,6 +48,7 @@
 #include <service.h>
 #include <router.h>
 #include <poll.h>
+#include <splice.h>
 #include <users.h>
 #include <version.h>
 
@@ -248,7 +249,7 @@ int  gw_send_authentication_to_backend(
         uint8_t *passwd,
         MySQLProtocol *protocol);
 const char *gw_mysql_protocol_state2string(int state);
-int gw_do_connect_to_backend(char *host, int port, int* fd);
+int gw_do_connect_to_backend(SERVER *server, int* fd);
 int mysql_send_custom_error (
         DCB *dcb,
         int packet_number,
@@ -295,4 +296,4 @@ int  gw_generate_random_str(char *output, int len);
 char *gw_strend(register const char *s);
 int  setnonblocking(int fd);
 void setipaddress(struct in_addr *a, char *p);
-int  gw_read_gwbuff(DCB *dcb, GWBUF **head, int b);
+int  gw_read_gwbuff(DCB *dcb, GWBUF **head);
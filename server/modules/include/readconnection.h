@@ -30,6 +30,7 @@
  * @endverbatim
  */
 #include <dcb.h>
+#include <atomic.h>
 
 /**
  * Internal structure used to define the set of backend servers we are routing
@@ -51,6 +52,10 @@ typedef struct router_client_session {
         SPINLOCK        rses_lock;     /*< protects rses_deleted              */
         int             rses_versno;   /*< even = no active update, else odd  */
         bool            rses_closed;   /*< true when closeSession is called   */
+        bool            rses_spliced;  /*< true once the byte pump was tried  */
+        unsigned int    rses_packet_left; /*< bytes left of the client packet */
+        unsigned int    rses_hdr_len;  /*< bytes held of a split header       */
+        uint8_t         rses_hdr[4];   /*< the start of a split header        */
 	BACKEND		*backend;      /*< Backend used by the client session */
 	DCB		*backend_dcb;  /*< DCB Connection to the backend      */
 	struct router_client_session 
@@ -61,11 +66,12 @@ typedef struct router_client_session {
 } ROUTER_CLIENT_SES;
 
 /**
- * The statistics for this router instance
+ * The statistics for this router instance, sharded counters
  */
 typedef struct {
-	int		n_sessions;	/*< Number sessions created     */
-	int		n_queries;	/*< Number of queries forwarded */
+	COUNTER		n_sessions;	/*< Number sessions created     */
+	COUNTER		n_queries;	/*< Number of queries forwarded */
+	COUNTER		n_spliced;	/*< Number of sessions using the byte pump */
 } ROUTER_STATS;
 
 
@@ -79,6 +85,7 @@ typedef struct router_instance {
 	BACKEND		  **servers;    /*< List of backend servers                  */
 	unsigned int	  bitmask;	/*< Bitmask to apply to server->status       */
 	unsigned int	  bitvalue;	/*< Required value of server->status         */
+	bool		  splice;	/*< Move session data with the byte pump     */
 	ROUTER_STATS	  stats;	/*< Statistics for this router               */
 	struct router_instance
                           *next;
@@ -30,6 +30,7 @@
  */
 
 #include <dcb.h>
+#include <atomic.h>
 
 /**
  * Internal structure used to define the set of backend servers we are routing
@@ -65,11 +66,11 @@ typedef struct router_client_session {
  * The statistics for this router instance
  */
 typedef struct {
-	int		n_sessions;	/*< Number sessions created        */
-	int		n_queries;	/*< Number of queries forwarded    */
-	int		n_master;	/*< Number of stmts sent to master */
-	int		n_slave;	/*< Number of stmts sent to slave  */
-	int		n_all;		/*< Number of stmts sent to all    */
+	COUNTER		n_sessions;	/*< Number sessions created        */
+	COUNTER		n_queries;	/*< Number of queries forwarded    */
+	COUNTER		n_master;	/*< Number of stmts sent to master */
+	COUNTER		n_slave;	/*< Number of stmts sent to slave  */
+	COUNTER		n_all;		/*< Number of stmts sent to all    */
 } ROUTER_STATS;
 
 
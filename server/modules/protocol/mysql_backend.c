@@ -287,7 +287,7 @@ static int gw_read_backend_event(DCB *dcb) {
                                  * vraa : errorHandle
                                  * check the delayq before the reply
                                  */
-                                if (dcb->delayq != NULL) {
+                                if (!GWBUF_QUEUE_EMPTY(&dcb->delayq)) {
                                         /* send an error to the client */
                                         mysql_send_custom_error(
                                                 dcb->session->client,
@@ -295,9 +295,9 @@ static int gw_read_backend_event(DCB *dcb) {
                                                 0,
                                                 "Connection to backend lost.");
                                         // consume all the delay queue
-                                        dcb->delayq = gwbuf_consume(
-                                                dcb->delayq,
-                                                gwbuf_length(dcb->delayq));
+                                        gwbuf_queue_consume(
+                                                &dcb->delayq,
+                                                GWBUF_QUEUE_LENGTH(&dcb->delayq));
                                 }
 
                                 while (session->state != SESSION_STATE_ROUTER_READY)
@@ -349,7 +349,7 @@ static int gw_read_backend_event(DCB *dcb) {
                                         current_session->user)));
 
                                 /* check the delay queue and flush the data */
-                                if (dcb->delayq)
+                                if (!GWBUF_QUEUE_EMPTY(&dcb->delayq))
                                 {
                                         backend_write_delayqueue(dcb);
                                         rc = 1;
@@ -371,6 +371,12 @@ static int gw_read_backend_event(DCB *dcb) {
 		SESSION		*session = dcb->session;
 
                 CHK_SESSION(session);
+
+                if (dcb->splice != NULL && splice_read(dcb) == SPLICE_DONE)
+                {
+                        rc = 0;
+                        goto return_rc;
+                }
 		/* read available backend data */
 		rc = dcb_read(dcb, &writebuf);
                 
@@ -419,6 +425,11 @@ static int gw_read_backend_event(DCB *dcb) {
                                                     rsession,
                                                     writebuf,
                                                     dcb);
+                                /*<
+                                 * Stop reading from the backend if the
+                                 * client is not keeping up with the data.
+                                 */
+                                dcb_throttle_check(session->client, dcb);
                                 rc = 1;
                         }
                         goto return_rc;
@@ -447,7 +458,7 @@ static int gw_write_backend_event(DCB *dcb) {
          * Don't write to backend if backend_dcb is not in poll set anymore.
          */
         if (dcb->state != DCB_STATE_POLLING) {
-                if (dcb->writeq != NULL) {
+                if (!GWBUF_QUEUE_EMPTY(&dcb->writeq)) {
                         /*< vraa : errorHandle */
                         mysql_send_custom_error(
                                 dcb->session->client,
@@ -675,7 +686,7 @@ static int gw_create_backend_connection(
         }
         
         /*< if succeed, fd > 0, -1 otherwise */
-        rv = gw_do_connect_to_backend(server->name, server->port, &fd);
+        rv = gw_do_connect_to_backend(server, &fd);
         /*< Assign protocol with backend_dcb */
         backend_dcb->protocol = protocol;
 
@@ -771,15 +782,8 @@ gw_backend_close(DCB *dcb)
 static void backend_set_delayqueue(DCB *dcb, GWBUF *queue) {
 	spinlock_acquire(&dcb->delayqlock);
 
-	if (dcb->delayq) {
-		/* Append data */
-		dcb->delayq = gwbuf_append(dcb->delayq, queue);
-	} else {
-		if (queue != NULL) {
-			/* create the delay queue */
-			dcb->delayq = queue;
-		}
-	}
+	/* Append data, creating the delay queue if empty */
+	gwbuf_queue_append(&dcb->delayq, queue);
 	spinlock_release(&dcb->delayqlock);
 }
 
@@ -798,8 +802,7 @@ static int backend_write_delayqueue(DCB *dcb)
 
 	spinlock_acquire(&dcb->delayqlock);
 
-	localq = dcb->delayq;
-	dcb->delayq = NULL;
+	localq = gwbuf_queue_take(&dcb->delayq);
 
 	/*<
 	 * Now we set the last command received, from the delayed queue
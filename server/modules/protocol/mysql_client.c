@@ -31,6 +31,7 @@
  * 16/12/2013	Massimiliano Pinto	Added: client closed socket detection with recv(..., MSG_PEEK)
  */
 
+#define _GNU_SOURCE
 #include <skygw_utils.h>
 #include <log_manager.h>
 #include <mysql_client_server_protocol.h>
@@ -39,7 +40,20 @@ extern int lm_enabled_logfiles_bitmask;
 
 static char *version_str = "V1.0.0";
 
+/**
+ * A connection accepted by the acceptor thread, on its way to the polling
+ * thread that sets it up.
+ */
+typedef struct {
+	POLL_TASK		task;		/**< The hand-off task */
+	DCB			*listener;	/**< The listener that accepted it */
+	int			fd;		/**< The client socket */
+	struct sockaddr_in	addr;		/**< The client address */
+} MYSQL_ACCEPTED;
+
 static int gw_MySQLAccept(DCB *listener);
+static int gw_MySQLClientSetup(DCB *listener, int c_sock, struct sockaddr_in *addr, int owner);
+static void gw_MySQLAccepted(void *data);
 static int gw_MySQLListener(DCB *listener, char *config_bind);
 static int gw_read_client_event(DCB* dcb);
 static int gw_write_client_event(DCB *dcb);
@@ -474,61 +488,15 @@ int gw_read_client_event(DCB* dcb) {
 	ROUTER         *router_instance = NULL;
 	void           *rsession = NULL;
 	MySQLProtocol  *protocol = NULL;
-	int             b = -1;
         int             rc = 0;
 
         CHK_DCB(dcb);
         protocol = DCB_PROTOCOL(dcb, MySQLProtocol);
         CHK_PROTOCOL(protocol);
-        /**
-         * Check how many bytes are readable in dcb->fd.
+        /*
+         * The data is read below with gw_read_gwbuff, which also
+         * handles the closed client socket.
          */
-        if (ioctl(dcb->fd, FIONREAD, &b) != 0) {
-                int eno = errno;
-                errno = 0;
-
-                LOGIF(LE, (skygw_log_write(
-                        LOGFILE_ERROR,
-                        "%lu [gw_read_client_event] ioctl FIONREAD for fd "
-                        "%d failed. errno %d, %s. dcb->state = %d",
-                        pthread_self(),
-                        dcb->fd,
-                        eno,
-                        strerror(eno),
-                        dcb->state)));
-                rc = 1;
-                goto return_rc;
-        }
-        
-	/*
-	 * Handle the closed client socket.
-	 */
-
-	if (b == 0) {
-		char c;
-		int l_errno = 0;
-		int r = -1;
-
-		rc = 0;
-
-		/* try to read 1 byte, without consuming the socket buffer */
-		r = recv(dcb->fd, &c, sizeof(char), MSG_PEEK);
-		l_errno = errno;
-
-		if (r <= 0) {
-			if ( (l_errno == EAGAIN) || (l_errno == EWOULDBLOCK)) {
-				goto return_rc;
-			}
-
-			// close client socket and the sessioA too
-			dcb->func.close(dcb);
-		} else {
-			// do nothing if reading 1 byte
-		}
-
-		goto return_rc;
-	}
-
 	switch (protocol->state) {
         case MYSQL_AUTH_SENT:
                 /*
@@ -541,11 +509,8 @@ int gw_read_client_event(DCB* dcb) {
                 int    auth_val = -1;
                 //////////////////////////////////////////////////////
                 // read and handle errors & close, or return if busy
-                // note: if b == 0 error handling is not
-                // triggered, just return
-                // without closing
                 //////////////////////////////////////////////////////
-                rc = gw_read_gwbuff(dcb, &gw_buffer, b); 
+                rc = gw_read_gwbuff(dcb, &gw_buffer);
                 
                 if (rc != 0) {
                         goto return_rc;
@@ -605,10 +570,10 @@ int gw_read_client_event(DCB* dcb) {
                  * Read all the data that is available into a chain of buffers
                  */
         {
-                int      len = -1;
                 GWBUF   *queue = NULL;
                 GWBUF   *gw_buffer = NULL;
-                uint8_t *ptr_buff = NULL;
+                GWBUF_INFO *info;
+                uint8_t  command;
                 int      mysql_command = -1;
                 
                 session = dcb->session;
@@ -622,23 +587,33 @@ int gw_read_client_event(DCB* dcb) {
                         rsession = session->router_session;
                 }
                 
+                /*<
+                 * The router may have handed the session over to the
+                 * byte pump, which moves the data to the backend itself.
+                 */
+                if (dcb->splice != NULL && splice_read(dcb) == SPLICE_DONE)
+                {
+                        rc = 0;
+                        goto return_rc;
+                }
                 //////////////////////////////////////////////////////
                 // read and handle errors & close, or return if busy
                 //////////////////////////////////////////////////////
-                rc = gw_read_gwbuff(dcb, &gw_buffer, b); 
+                rc = gw_read_gwbuff(dcb, &gw_buffer);
                 
                 if (rc != 0) {
                         goto return_rc;
                 }
-                /* Now, we are assuming in the first buffer there is
-                 * the information form mysql command */
                 queue = gw_buffer;
-                len = GWBUF_LENGTH(queue);
-                ptr_buff = GWBUF_DATA(queue);
                 
-                /* get mysql commang at fifth byte */
-                if (ptr_buff) {
-                        mysql_command = ptr_buff[4];
+                /*
+                 * get mysql command at fifth byte, the header may span
+                 * buffers. The packet metadata is kept for the router.
+                 */
+                if ((info = gwbuf_mysql_info(queue)) != NULL) {
+                        mysql_command = info->command;
+                } else if (gwbuf_copy_data(queue, 4, 1, &command) == 1) {
+                        mysql_command = command;
                 }
                 /**
                  * Without rsession there is no access to backend.
@@ -668,7 +643,7 @@ int gw_read_client_event(DCB* dcb) {
                         }
                         rc = 1;
                         /** Free buffer */
-                        queue = gwbuf_consume(queue, len);                
+                        queue = gwbuf_consume(queue, gwbuf_length(queue));
                         goto return_rc;
                 }
                 /** Route COM_QUIT to backend */
@@ -798,6 +773,7 @@ int gw_MySQLListener(
 	char address[1024] = "";
 	int  port = 0;
 	int  one = 1;
+        int  sendbuf = GW_BACKEND_SO_SNDBUF;
         int  rc;
 
 	/* this gateway, as default, will bind on port 4404 for localhost only */
@@ -841,6 +817,11 @@ int gw_MySQLListener(
 	}
 	// socket options
 	setsockopt(l_so, SOL_SOCKET, SO_REUSEADDR, (char *)&one, sizeof(one));
+        /*<
+         * The send buffer size is inherited by the accepted sockets, so
+         * it does not need to be set for each client.
+         */
+	setsockopt(l_so, SOL_SOCKET, SO_SNDBUF, &sendbuf, sizeof(sendbuf));
 
 	// set NONBLOCKING mode
         setnonblocking(l_so);
@@ -904,31 +885,27 @@ int gw_MySQLListener(
 }
 
 
-/** 
- * @node (write brief function description here) 
- *
- * Parameters:
- * @param listener - <usage>
- *          <description>
+/**
+ * Accept the new connections of a MySQL listener. The sockets are created
+ * non-blocking by accept4 and inherit their options from the listener, so
+ * no further system calls are needed before the handshake is sent.
  *
- * @return 0 in success, 1 in failure
- *
- * 
- * @details (write detailed description here)
+ * When called by the acceptor thread each connection is handed to one of
+ * the polling threads, which sets it up, otherwise it is set up here.
  *
+ * @param listener	The listener DCB
+ * @return 1 when all connections have been accepted or on failure
  */
 int gw_MySQLAccept(DCB *listener)
 {
         int                rc = 0;
-        DCB                *client_dcb;
-        MySQLProtocol      *protocol;
         int                c_sock;
         struct sockaddr_in local;
-        socklen_t          addrlen = sizeof(struct sockaddr_in);
-        int                sendbuf = GW_BACKEND_SO_SNDBUF;
-        socklen_t          optlen = sizeof(sendbuf);
+        socklen_t          addrlen;
         int                eno = 0;
         int                i = 0;
+        int                thread;
+        MYSQL_ACCEPTED     *accepted;
                 
         CHK_DCB(listener);
         
@@ -936,6 +913,7 @@ int gw_MySQLAccept(DCB *listener)
 
     retry_accept:
 
+                addrlen = sizeof(struct sockaddr_in);
 #if defined(SS_DEBUG)
                 if (fail_next_accept > 0)
                 {
@@ -946,9 +924,10 @@ int gw_MySQLAccept(DCB *listener)
                         fail_accept_errno = 0;          
 #endif /* SS_DEBUG */
                         // new connection from client
-		        c_sock = accept(listener->fd,
-                                        (struct sockaddr *) &local,
-                                        &addrlen);
+		        c_sock = accept4(listener->fd,
+                                         (struct sockaddr *) &local,
+                                         &addrlen,
+                                         SOCK_NONBLOCK|SOCK_CLOEXEC);
                         eno = errno;
                         errno = 0;
 #if defined(SS_DEBUG)
@@ -1030,87 +1009,132 @@ int gw_MySQLAccept(DCB *listener)
                         c_sock)));
                 conn_open[c_sock] = true;
 #endif
-                /* set nonblocking  */
-                setsockopt(c_sock, SOL_SOCKET, SO_SNDBUF, &sendbuf, optlen);
-                setnonblocking(c_sock);
-                
-                client_dcb = dcb_alloc(DCB_ROLE_REQUEST_HANDLER);
-                client_dcb->service = listener->session->service;
-                client_dcb->fd = c_sock;
-                client_dcb->remote = strdup(inet_ntoa(local.sin_addr));
-
-                protocol = mysql_protocol_init(client_dcb, c_sock);
-                ss_dassert(protocol != NULL);
-                
-                if (protocol == NULL) {
-                        /** delete client_dcb */
-                        dcb_close(client_dcb);
-                        LOGIF(LE, (skygw_log_write_flush(
-                                LOGFILE_ERROR,
-                                "%lu [gw_MySQLAccept] Failed to create "
-                                "protocol object for client connection.",
-                                pthread_self())));
-                        rc = 1;
-                        goto return_rc;
+                if ((thread = poll_handoff_thread()) != -1 &&
+                    (accepted = (MYSQL_ACCEPTED *)malloc(
+                            sizeof(MYSQL_ACCEPTED))) != NULL)
+                {
+                        accepted->task.fn = gw_MySQLAccepted;
+                        accepted->task.data = accepted;
+                        accepted->listener = listener;
+                        accepted->fd = c_sock;
+                        memcpy(&accepted->addr, &local, sizeof(local));
+                        poll_post(thread, &accepted->task);
+                        continue;
                 }
-                client_dcb->protocol = protocol;
-                // assign function poiters to "func" field
-                memcpy(&client_dcb->func, &MyObject, sizeof(GWPROTOCOL));
-                //send handshake to the client_dcb
-                MySQLSendHandshake(client_dcb);
-
-                // client protocol state change
-                protocol->state = MYSQL_AUTH_SENT;
-
-                /**
-                 * Set new descriptor to event set. At the same time,
-                 * change state to DCB_STATE_POLLING so that
-                 * thread which wakes up sees correct state.
-                 */
-                if (poll_add_dcb(client_dcb) == -1)
+                if (gw_MySQLClientSetup(listener, c_sock, &local, -1) != 0)
                 {
-                        /* Send a custom error as MySQL command reply */
-                        mysql_send_custom_error(
-                                client_dcb,
-                                1,
-                                0,
-                                "MaxScale internal error.");
-                        
-                        /** delete client_dcb */
-                        dcb_close(client_dcb);
-
-                        /** Previous state is recovered in poll_add_dcb. */
-                        LOGIF(LE, (skygw_log_write_flush(
-                                LOGFILE_ERROR,
-                                "%lu [gw_MySQLAccept] Failed to add dcb %p for "
-                                "fd %d to epoll set.",
-                                pthread_self(),
-                                client_dcb,
-                                client_dcb->fd)));
                         rc = 1;
                         goto return_rc;
                 }
-                else
-                {
-                        LOGIF(LD, (skygw_log_write(
-                                LOGFILE_DEBUG,
-                                "%lu [gw_MySQLAccept] Added dcb %p for fd "
-                                "%d to epoll set.",
-                                pthread_self(),
-                                client_dcb,
-                                client_dcb->fd)));
-                }
         } /**< while 1 */
-#if defined(SS_DEBUG)
-        if (rc == 0) {
-                CHK_DCB(client_dcb);
-                CHK_PROTOCOL(((MySQLProtocol *)client_dcb->protocol));
-        }
-#endif
 return_rc:
         return rc;
 }
 
+/**
+ * Set up the client DCB of a newly accepted connection, send the handshake
+ * and add the DCB to the poll set.
+ *
+ * @param listener	The listener that accepted the connection
+ * @param c_sock	The client socket
+ * @param addr		The client address
+ * @param owner		The polling thread to own the DCB, or -1 for any
+ * @return 0 on success, -1 on failure
+ */
+static int
+gw_MySQLClientSetup(DCB *listener, int c_sock, struct sockaddr_in *addr, int owner)
+{
+        DCB                *client_dcb;
+        MySQLProtocol      *protocol;
+
+        client_dcb = dcb_alloc(DCB_ROLE_REQUEST_HANDLER);
+        client_dcb->service = listener->session->service;
+        client_dcb->fd = c_sock;
+        client_dcb->remote = strdup(inet_ntoa(addr->sin_addr));
+        client_dcb->owner = owner;
+
+        protocol = mysql_protocol_init(client_dcb, c_sock);
+        ss_dassert(protocol != NULL);
+        
+        if (protocol == NULL) {
+                /** delete client_dcb */
+                dcb_close(client_dcb);
+                LOGIF(LE, (skygw_log_write_flush(
+                        LOGFILE_ERROR,
+                        "%lu [gw_MySQLAccept] Failed to create "
+                        "protocol object for client connection.",
+                        pthread_self())));
+                return -1;
+        }
+        client_dcb->protocol = protocol;
+        // assign function poiters to "func" field
+        memcpy(&client_dcb->func, &MyObject, sizeof(GWPROTOCOL));
+        //send handshake to the client_dcb
+        MySQLSendHandshake(client_dcb);
+
+        // client protocol state change
+        protocol->state = MYSQL_AUTH_SENT;
+
+        /**
+         * Set new descriptor to event set. At the same time,
+         * change state to DCB_STATE_POLLING so that
+         * thread which wakes up sees correct state.
+         */
+        if (poll_add_dcb(client_dcb) == -1)
+        {
+                /* Send a custom error as MySQL command reply */
+                mysql_send_custom_error(
+                        client_dcb,
+                        1,
+                        0,
+                        "MaxScale internal error.");
+                
+                /** delete client_dcb */
+                dcb_close(client_dcb);
+
+                /** Previous state is recovered in poll_add_dcb. */
+                LOGIF(LE, (skygw_log_write_flush(
+                        LOGFILE_ERROR,
+                        "%lu [gw_MySQLAccept] Failed to add dcb %p for "
+                        "fd %d to epoll set.",
+                        pthread_self(),
+                        client_dcb,
+                        client_dcb->fd)));
+                return -1;
+        }
+        LOGIF(LD, (skygw_log_write(
+                LOGFILE_DEBUG,
+                "%lu [gw_MySQLAccept] Added dcb %p for fd "
+                "%d to epoll set.",
+                pthread_self(),
+                client_dcb,
+                client_dcb->fd)));
+#if defined(SS_DEBUG)
+        CHK_DCB(client_dcb);
+        CHK_PROTOCOL(((MySQLProtocol *)client_dcb->protocol));
+#endif
+        return 0;
+}
+
+/**
+ * Set up a connection that the acceptor thread handed to this polling
+ * thread.
+ *
+ * @param data	The accepted connection
+ */
+static void
+gw_MySQLAccepted(void *data)
+{
+MYSQL_ACCEPTED	*accepted = (MYSQL_ACCEPTED *)data;
+
+        /*< The connection stays on the thread it was handed to */
+        gw_MySQLClientSetup(accepted->listener,
+                            accepted->fd,
+                            &accepted->addr,
+                            poll_thread_id());
+        free(accepted);
+}
+
 static int gw_error_client_event(DCB *dcb) {
         SESSION*       session;
         ROUTER_OBJECT* router;
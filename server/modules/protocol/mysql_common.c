@@ -576,9 +576,10 @@ int gw_send_authentication_to_backend(
  *
  * This routine creates socket and connects to a backend server.
  * Connect it non-blocking operation. If connect fails, socket is closed.
+ * The address connected to is the one cached in the server, the name of
+ * the server is not resolved here.
  *
- * @param host The host to connect to
- * @param port The host TCP/IP port 
+ * @param server The server to connect to
  * @param *fd where connected fd is copied
  * @return 0/1 on success and -1 on failure
  * If succesful, fd has file descriptor to socket which is connected to
@@ -586,16 +587,26 @@ int gw_send_authentication_to_backend(
  *
  */
 int gw_do_connect_to_backend(
-        char          *host,
-        int           port,
+        SERVER        *server,
         int*          fd)
 {
 	struct sockaddr_in serv_addr;
 	int rv;
 	int so = 0;
+        char *host = server->name;
+        int port = server->port;
         
-	memset(&serv_addr, 0, sizeof serv_addr);
-	serv_addr.sin_family = AF_INET;
+	if (server_get_address(server, &serv_addr) != 0) {
+                LOGIF(LE, (skygw_log_write_flush(
+                        LOGFILE_ERROR,
+                        "Error: Establishing connection to backend server "
+                        "%s:%d failed. The address of the server has not "
+                        "been resolved.",
+                        host,
+                        port)));
+                rv = -1;
+                goto return_rv;
+	}
 	so = socket(AF_INET,SOCK_STREAM,0);
         
 	if (so < 0) {
@@ -613,9 +624,6 @@ int gw_do_connect_to_backend(
                 rv = -1;
                 goto return_rv;
 	}
-	/* prepare for connect */
-	setipaddress(&serv_addr.sin_addr, host);
-	serv_addr.sin_port = htons(port);
 	/* set socket to as non-blocking here */
 	setnonblocking(so);
         rv = connect(so, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
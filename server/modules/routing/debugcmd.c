@@ -66,6 +66,8 @@
 
 #define	MAXARGS	5
 
+#define	MAX_LOCK_CLASSES	20	/*< Lock classes shown by show locks */
+
 #define	ARG_TYPE_ADDRESS	1
 #define	ARG_TYPE_STRING		2
 /**
@@ -82,10 +84,13 @@ struct subcommand {
 };
 
 static	void	telnetdShowUsers(DCB *);
+static	void	telnetdShowLocks(DCB *);
 /**
  * The subcommands of the show command
  */
 struct subcommand showoptions[] = {
+	{ "buffers",	0, dprintBufferPool,	"Show the buffer pool statistics",
+				{0, 0, 0} },
         { "dcbs",	0, dprintAllDCBs,	"Show all descriptor control blocks (network connections)",
 				{0, 0, 0} },
 	{ "dcb",	1, dprintDCB,		"Show a single descriptor control block e.g. show dcb 0x493340",
@@ -94,6 +99,8 @@ struct subcommand showoptions[] = {
 				{ARG_TYPE_ADDRESS, 0, 0} },
 	{ "epoll",	0, dprintPollStats,	"Show the poll statistics",
 				{0, 0, 0} },
+	{ "locks",	0, telnetdShowLocks,	"Show the most contended spinlock classes",
+				{0, 0, 0} },
 	{ "modules",	0, dprintAllModules,	"Show all currently loaded modules",
 				{0, 0, 0} },
 	{ "monitors",	0, monitorShowAll,	"Show the monitors that are configured",
@@ -206,6 +213,8 @@ struct subcommand reloadoptions[] = {
 
 static void enable_log_action(DCB *, char *);
 static void disable_log_action(DCB *, char *);
+static void enable_lock_profiling(DCB *);
+static void disable_lock_profiling(DCB *);
 
 /**
  *  * The subcommands of the enable command
@@ -219,6 +228,14 @@ struct subcommand enableoptions[] = {
                 "message E.g. enable log message.",
                 {ARG_TYPE_STRING, 0, 0}
         },
+        {
+                "lockprofile",
+                0,
+                enable_lock_profiling,
+                "Enable the profiling of the spinlock classes, the counts "
+                "are cleared. E.g. enable lockprofile",
+                {0, 0, 0}
+        },
         {
                 NULL,
                 0,
@@ -241,6 +258,14 @@ struct subcommand disableoptions[] = {
             "E.g. disable log debug",
             {ARG_TYPE_STRING, 0, 0}
     },
+    {
+            "lockprofile",
+            0,
+            disable_lock_profiling,
+            "Disable the profiling of the spinlock classes, the counts "
+            "are kept. E.g. disable lockprofile",
+            {0, 0, 0}
+    },
     {
             NULL,
             0,
@@ -715,6 +740,61 @@ telnetdShowUsers(DCB *dcb)
 	dcb_PrintAdminUsers(dcb);
 }
 
+/**
+ * Display the profile of the most contended spinlock classes
+ *
+ * @param dcb	The DCB to print the profile to
+ */
+static void
+telnetdShowLocks(DCB *dcb)
+{
+SPINLOCK_CLASS	*classes[MAX_LOCK_CLASSES];
+int		i, n;
+
+	n = spinlock_class_list(classes, MAX_LOCK_CLASSES);
+	dcb_printf(dcb, "Lock profiling is %s\n\n",
+		   spinlock_profiling ? "enabled" : "disabled");
+	dcb_printf(dcb, "%-20s %14s %12s %14s %18s %12s\n", "Lock class",
+		   "Acquired", "Contended", "Spins", "Wait cycles",
+		   "Cycles/wait");
+	for (i = 0; i < n; i++)
+	{
+		dcb_printf(dcb, "%-20s %14lu %12lu %14lu %18llu %12llu\n",
+			   classes[i]->name,
+			   classes[i]->acquired,
+			   classes[i]->contended,
+			   classes[i]->spins,
+			   classes[i]->cycles,
+			   classes[i]->contended ?
+			   classes[i]->cycles / classes[i]->contended : 0);
+	}
+}
+
+/**
+ * Enable the profiling of the spinlock classes
+ *
+ * @param dcb	The DCB to print messages to
+ */
+static void
+enable_lock_profiling(DCB *dcb)
+{
+	spinlock_profile_reset();
+	spinlock_profiling = 1;
+	dcb_printf(dcb, "Lock profiling enabled.\n");
+}
+
+/**
+ * Disable the profiling of the spinlock classes
+ *
+ * @param dcb	The DCB to print messages to
+ */
+static void
+disable_lock_profiling(DCB *dcb)
+{
+	spinlock_profiling = 0;
+	dcb_printf(dcb, "Lock profiling disabled.\n");
+}
+
 /**
  * Command to shutdown a running monitor
  *
@@ -38,6 +38,10 @@
  * as slaves. If neither option is specified the router will connect to either
  * masters or slaves.
  *
+ * The "splice" option hands each session over to the zero copy byte pump
+ * once the first reply has been returned by the backend server, the data
+ * then no longer passes through the router.
+ *
  * @verbatim
  * Revision History
  *
@@ -186,6 +190,9 @@ int		i, n;
         if ((inst = calloc(1, sizeof(ROUTER_INSTANCE))) == NULL) {
                 return NULL;
         }
+	inst->stats.n_sessions = counter_alloc();
+	inst->stats.n_queries = counter_alloc();
+	inst->stats.n_spliced = counter_alloc();
 
 	inst->service = service;
 	spinlock_init(&inst->lock);
@@ -245,6 +252,10 @@ int		i, n;
 				inst->bitmask |= (SERVER_JOINED);
 				inst->bitvalue |= SERVER_JOINED;
 			}
+			else if (!strcasecmp(options[i], "splice"))
+			{
+				inst->splice = true;
+			}
 			else
 			{
                             LOGIF(LE, (skygw_log_write(
@@ -356,8 +367,8 @@ int                     i;
 			}
                         else if (inst->servers[i]->current_connection_count ==
                                  candidate->current_connection_count &&
-                                 inst->servers[i]->server->stats.n_connections <
-                                 candidate->server->stats.n_connections)
+                                 counter_read(inst->servers[i]->server->stats.n_connections) <
+                                 counter_read(candidate->server->stats.n_connections))
                         {
 				/* This running server has the same number
 				of connections currently as the candidate
@@ -405,7 +416,7 @@ int                     i;
 		free(client_rses);
 		return NULL;
 	}
-	inst->stats.n_sessions++;
+	counter_inc(inst->stats.n_sessions);
 
 	/**
          * Add this session to the list of active sessions.
@@ -449,7 +460,7 @@ static void freeSession(
         prev_val = atomic_add(&router_cli_ses->backend->current_connection_count, -1);
         ss_dassert(prev_val > 0);
         
-	atomic_add(&router_cli_ses->backend->server->stats.n_current, -1);
+	counter_dec(router_cli_ses->backend->server->stats.n_current);
 	spinlock_acquire(&router->lock);
         
 	if (router->connections == router_cli_ses) {
@@ -516,6 +527,47 @@ DCB*              backend_dcb;
         }
 }
 
+/**
+ * Follow the packet boundaries of the data sent by the client, so that
+ * the byte pump is only started at the start of a packet.
+ *
+ * NB This is called with the caller holding the rses_lock
+ *
+ * @param router_cli_ses	The router session
+ * @param queue			The data that is about to be routed
+ * @return			True if the data ends at a packet boundary
+ */
+static bool
+rses_track_packets(ROUTER_CLIENT_SES *router_cli_ses, GWBUF *queue)
+{
+unsigned int	len = gwbuf_length(queue), off = 0, n;
+
+	while (off < len)
+	{
+		if (router_cli_ses->rses_packet_left > 0)
+		{
+			n = len - off;
+			if (n > router_cli_ses->rses_packet_left)
+				n = router_cli_ses->rses_packet_left;
+			router_cli_ses->rses_packet_left -= n;
+			off += n;
+			continue;
+		}
+		n = gwbuf_copy_data(queue, off, 4 - router_cli_ses->rses_hdr_len,
+			router_cli_ses->rses_hdr + router_cli_ses->rses_hdr_len);
+		router_cli_ses->rses_hdr_len += n;
+		off += n;
+		if (router_cli_ses->rses_hdr_len == 4)
+		{
+			router_cli_ses->rses_packet_left =
+				MYSQL_GET_PACKET_LEN(router_cli_ses->rses_hdr);
+			router_cli_ses->rses_hdr_len = 0;
+		}
+	}
+	return router_cli_ses->rses_packet_left == 0 &&
+		router_cli_ses->rses_hdr_len == 0;
+}
+
 /**
  * We have data from the client, we must route it to the backend.
  * This is simply a case of sending it to the connection that was
@@ -531,14 +583,23 @@ routeQuery(ROUTER *instance, void *router_session, GWBUF *queue)
 {
         ROUTER_INSTANCE	  *inst = (ROUTER_INSTANCE *)instance;
         ROUTER_CLIENT_SES *router_cli_ses = (ROUTER_CLIENT_SES *)router_session;
-        uint8_t           *payload = GWBUF_DATA(queue);
+        GWBUF_INFO        *info;
+        uint8_t           command = 0;
         int               mysql_command;
         int               rc;
         DCB*              backend_dcb;
         bool              rses_is_closed;
        
-	inst->stats.n_queries++;
-	mysql_command = MYSQL_GET_COMMAND(payload);
+	counter_inc(inst->stats.n_queries);
+	if ((info = gwbuf_mysql_info(queue)) != NULL)
+	{
+		mysql_command = info->command;
+	}
+	else
+	{
+		gwbuf_copy_data(queue, 4, 1, &command);
+		mysql_command = command;
+	}
 
         /** Dirty read for quick check if router is closed. */
         if (router_cli_ses->rses_closed)
@@ -569,6 +630,19 @@ routeQuery(ROUTER *instance, void *router_session, GWBUF *queue)
                         mysql_command)));
                 goto return_rc;
         }
+
+	/*<
+	 * The pump may have been started whilst this data was on its way,
+	 * it can not carry on from the middle of a packet.
+	 */
+	if (inst->splice)
+	{
+		spinlock_acquire(&router_cli_ses->rses_lock);
+		if (!rses_track_packets(router_cli_ses, queue) &&
+		    backend_dcb->splice != NULL)
+			splice_disable(backend_dcb);
+		spinlock_release(&router_cli_ses->rses_lock);
+	}
         
 	switch(mysql_command) {
         case MYSQL_COM_CHANGE_USER:
@@ -618,11 +692,37 @@ int		  i = 0;
 	}
 	spinlock_release(&router_inst->lock);
 	
-	dcb_printf(dcb, "\tNumber of router sessions:   	%d\n",
-                   router_inst->stats.n_sessions);
+	dcb_printf(dcb, "\tNumber of router sessions:   	%ld\n",
+                   counter_read(router_inst->stats.n_sessions));
 	dcb_printf(dcb, "\tCurrent no. of router sessions:	%d\n", i);
-	dcb_printf(dcb, "\tNumber of queries forwarded:   	%d\n",
-                   router_inst->stats.n_queries);
+	dcb_printf(dcb, "\tNumber of queries forwarded:   	%ld\n",
+                   counter_read(router_inst->stats.n_queries));
+	if (router_inst->splice)
+		dcb_printf(dcb, "\tNumber of spliced sessions:   	%ld\n",
+                	   counter_read(router_inst->stats.n_spliced));
+}
+
+/**
+ * The byte pump filter for the packets sent by the client. The packets
+ * that change the state of the session are left to the protocol module.
+ *
+ * @param hdr	The start of the packet
+ * @param len	The number of bytes available
+ * @return	The length of the packet, 0 if more bytes are needed or -1
+ *		if the packet must be handled by the protocol module
+ */
+static int
+spliceFilter(unsigned char *hdr, int len)
+{
+	if (len < 4)
+		return 0;
+	if (MYSQL_GET_PACKET_LEN(hdr) == 0)
+		return 4;
+	if (len < 5)
+		return 0;
+	if (hdr[4] == MYSQL_COM_CHANGE_USER || hdr[4] == MYSQL_COM_QUIT)
+		return -1;
+	return MYSQL_GET_PACKET_LEN(hdr) + 4;
 }
 
 /**
@@ -644,11 +744,35 @@ clientReply(
 {
 	DCB *client = NULL;
 
+	ROUTER_INSTANCE	  *inst = (ROUTER_INSTANCE *)instance;
+	ROUTER_CLIENT_SES *router_cli_ses = (ROUTER_CLIENT_SES *)router_session;
+
 	client = backend_dcb->session->client;
 
 	ss_dassert(client != NULL);
 
 	client->func.write(client, queue);
+
+	/*<
+	 * The session is authenticated once the backend has replied,
+	 * from here on the data can bypass the router. The pump reads the
+	 * client packets itself, so it is only started when all that the
+	 * client has sent ends at a packet boundary and has been written
+	 * to the backend.
+	 */
+	if (inst->splice && !router_cli_ses->rses_spliced)
+	{
+		spinlock_acquire(&router_cli_ses->rses_lock);
+		if (router_cli_ses->rses_packet_left == 0 &&
+		    router_cli_ses->rses_hdr_len == 0 &&
+		    GWBUF_QUEUE_EMPTY(&backend_dcb->writeq))
+		{
+			router_cli_ses->rses_spliced = true;
+			if (splice_enable(client, backend_dcb, spliceFilter) == 0)
+				counter_inc(inst->stats.n_spliced);
+		}
+		spinlock_release(&router_cli_ses->rses_lock);
+	}
 }
 
 /**
@@ -150,6 +150,11 @@ static ROUTER* createInstance(
         if ((router = calloc(1, sizeof(ROUTER_INSTANCE))) == NULL) {
             return NULL; 
         } 
+        router->stats.n_sessions = counter_alloc();
+        router->stats.n_queries = counter_alloc();
+        router->stats.n_master = counter_alloc();
+        router->stats.n_slave = counter_alloc();
+        router->stats.n_all = counter_alloc();
         router->service = service;
         spinlock_init(&router->lock);
         
@@ -331,7 +336,7 @@ static void* newSession(
         
         client_rses->be_slave = be_slave;
         client_rses->be_master = be_master;
-        router->stats.n_sessions += 1;
+        counter_inc(router->stats.n_sessions);
 
         /**
          * Version is bigger than zero once initialized.
@@ -409,8 +414,8 @@ static void freeSession(
 
         atomic_add(&router_cli_ses->be_slave->backend_conn_count, -1);
         atomic_add(&router_cli_ses->be_master->backend_conn_count, -1);
-        atomic_add(&router_cli_ses->be_slave->backend_server->stats.n_current, -1);
-        atomic_add(&router_cli_ses->be_master->backend_server->stats.n_current, -1);
+        counter_dec(router_cli_ses->be_slave->backend_server->stats.n_current);
+        counter_dec(router_cli_ses->be_master->backend_server->stats.n_current);
 
         spinlock_acquire(&router->lock);
 
@@ -462,10 +467,10 @@ static int routeQuery(
 {
         skygw_query_type_t qtype    = QUERY_TYPE_UNKNOWN;
         char*              querystr = NULL;
-        char*              startpos;
-        size_t             len;
-        unsigned char      packet_type;
-        unsigned char*     packet;
+        const char*        sql = "(empty)";
+        int                sql_len = 7;
+        GWBUF_INFO*        info;
+        unsigned char      packet_type = 0;
         int                ret = 0;
         DCB*               master_dcb = NULL;
         DCB*               slave_dcb  = NULL;
@@ -476,14 +481,28 @@ static int routeQuery(
 
         CHK_CLIENT_RSES(router_cli_ses);
                 
-        inst->stats.n_queries++;
+        counter_inc(inst->stats.n_queries);
 
-	packet = GWBUF_DATA(querybuf);
-        packet_type = packet[4];
-        startpos = (char *)&packet[5];
-        len      = packet[0];
-        len     += 255*packet[1];
-        len     += 255*255*packet[2];
+        /**
+         * The packet is parsed once, the metadata is shared by the clones
+         * of the buffer that are routed to the other backends.
+         */
+        if ((info = gwbuf_mysql_info(querybuf)) != NULL)
+        {
+                if (info->command >= 0)
+                {
+                        packet_type = info->command;
+                }
+                if (info->sql != NULL)
+                {
+                        sql = info->sql;
+                        sql_len = info->sql_len;
+                }
+        }
+        else
+        {
+                gwbuf_copy_data(querybuf, 4, 1, &packet_type);
+        }
 
         switch(packet_type) {
         case COM_QUIT:        /**< 1 QUIT will close all sessions */
@@ -501,10 +520,25 @@ static int routeQuery(
                 break;
 
         case COM_QUERY:
-                querystr = (char *)malloc(len);
-                memcpy(querystr, startpos, len-1);
-                memset(&querystr[len-1], 0, 1);
+                if (info == NULL || info->sql == NULL)
+                {
+                        break;
+                }
+                if (info->flags & GWBUF_INFO_CLASSIFIED)
+                {
+                        qtype = (skygw_query_type_t)info->qtype;
+                        break;
+                }
+                /** The classifier needs a NUL terminated string */
+                if ((querystr = (char *)malloc(info->sql_len + 1)) == NULL)
+                {
+                        break;
+                }
+                memcpy(querystr, info->sql, info->sql_len);
+                querystr[info->sql_len] = '\0';
                 qtype = skygw_query_classifier_get_type(querystr, 0);
+                info->qtype = qtype;
+                info->flags |= GWBUF_INFO_CLASSIFIED;
                 break;
                 
         case COM_SHUTDOWN:       /**< 8 where should shutdown be routed ? */
@@ -544,11 +578,12 @@ static int routeQuery(
         {
                 LOGIF(LE, (skygw_log_write_flush(
                         LOGFILE_ERROR,
-                        "Error: Failed to route %s:%s:\"%s\" to backend server. "
+                        "Error: Failed to route %s:%s:\"%.*s\" to backend server. "
                         "%s.",
                         STRPACKETTYPE(packet_type),
                         STRQTYPE(qtype),
-                        (querystr == NULL ? "(empty)" : querystr),
+                        sql_len,
+                        sql,
                         (rses_is_closed ? "Router was closed" :
                          "Router has no backend servers where to route to"))));
                         
@@ -556,8 +591,9 @@ static int routeQuery(
         }
         
         LOGIF(LT, (skygw_log_write(LOGFILE_TRACE,
-                                   "String\t\"%s\"",
-                                   querystr == NULL ? "(empty)" : querystr)));
+                                   "String\t\"%.*s\"",
+                                   sql_len,
+                                   sql)));
         LOGIF(LT, (skygw_log_write(LOGFILE_TRACE,
                         "Packet type\t%s",
                                    STRPACKETTYPE(packet_type))));
@@ -572,7 +608,7 @@ static int routeQuery(
                                    STRQTYPE(qtype))));
                 
                 ret = master_dcb->func.write(master_dcb, querybuf);
-                atomic_add(&inst->stats.n_master, 1);
+                counter_inc(inst->stats.n_master);
                 
                 goto return_ret;
                 break;
@@ -586,7 +622,7 @@ static int routeQuery(
                                    STRQTYPE(qtype))));
 
                 ret = slave_dcb->func.write(slave_dcb, querybuf);
-                atomic_add(&inst->stats.n_slave, 1);
+                counter_inc(inst->stats.n_slave);
                 
                 goto return_ret;
                 break;
@@ -663,7 +699,7 @@ static int routeQuery(
                         break;
                 } /**< switch by packet type */
 
-                atomic_add(&inst->stats.n_all, 1);
+                counter_inc(inst->stats.n_all);
                 goto return_ret;
                 break;
 
@@ -680,7 +716,7 @@ static int routeQuery(
                  * What is not known is routed to master.
                  */
                 ret = master_dcb->func.write(master_dcb, querybuf);
-                atomic_add(&inst->stats.n_master, 1);
+                counter_inc(inst->stats.n_master);
                 goto return_ret;
                 break;
         } /**< switch by query type */
@@ -775,23 +811,23 @@ int		  i = 0;
 	spinlock_release(&router->lock);
 	
 	dcb_printf(dcb,
-                   "\tNumber of router sessions:           	%d\n",
-                   router->stats.n_sessions);
+                   "\tNumber of router sessions:           	%ld\n",
+                   counter_read(router->stats.n_sessions));
 	dcb_printf(dcb,
                    "\tCurrent no. of router sessions:      	%d\n",
                    i);
 	dcb_printf(dcb,
-                   "\tNumber of queries forwarded:          	%d\n",
-                   router->stats.n_queries);
+                   "\tNumber of queries forwarded:          	%ld\n",
+                   counter_read(router->stats.n_queries));
 	dcb_printf(dcb,
-                   "\tNumber of queries forwarded to master:	%d\n",
-                   router->stats.n_master);
+                   "\tNumber of queries forwarded to master:	%ld\n",
+                   counter_read(router->stats.n_master));
 	dcb_printf(dcb,
-                   "\tNumber of queries forwarded to slave: 	%d\n",
-                   router->stats.n_slave);
+                   "\tNumber of queries forwarded to slave: 	%ld\n",
+                   counter_read(router->stats.n_slave));
 	dcb_printf(dcb,
-                   "\tNumber of queries forwarded to all:   	%d\n",
-                   router->stats.n_all);
+                   "\tNumber of queries forwarded to all:   	%ld\n",
+                   counter_read(router->stats.n_all));
 }
 
 /**
@@ -943,8 +979,8 @@ static bool search_backend_servers(
                                 }
                                 else if (be->backend_conn_count ==
                                          be_slave->backend_conn_count &&
-                                         be->backend_server->stats.n_connections <
-                                         be_slave->backend_server->stats.n_connections)
+                                         counter_read(be->backend_server->stats.n_connections) <
+                                         counter_read(be_slave->backend_server->stats.n_connections))
                                 {
                                         /**
                                          * This running server has the same